@@ -0,0 +1,74 @@
+#include <json.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define PARSES 200000
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * Build an array of n user objects, pretty printed or minified
+*/
+static char *build(int n, int pretty, size_t *len)
+{
+    size_t size = (size_t)n * 256 + 16;
+    char *text = (char *)malloc(size);
+    const char *sep = pretty ? "\n    " : "";
+    const char *space = pretty ? " " : "";
+    size_t used = snprintf(text, size, "[");
+    for (int i = 0; i < n; i++)
+    {
+        used += snprintf(text + used, size - used,
+            "%s{%s\"id\":%s%d,%s\"name\":%s\"user \\\"%d\\\"\",%s\"score\":%s%d.%d,%s\"active\":%s%s,%s\"tags\":%s[\"a\",%s\"b\"]}%s",
+            sep, sep, space, i, sep, space, i, sep, space, i % 100, i % 10, sep, space, i % 2 ? "true" : "false",
+            sep, space, space, i + 1 < n ? "," : "");
+    }
+    used += snprintf(text + used, size - used, "%s]", pretty ? "\n" : "");
+    *len = used;
+    return text;
+}
+
+static void run(int n, int pretty)
+{
+    size_t len;
+    char *text = build(n, pretty, &len);
+    char *copy = (char *)malloc(len);
+    int parses = PARSES / n + 1;
+
+    //the parser works in place, every run starts from a fresh copy
+    long long sum = 0;
+    double start = now();
+    for (int i = 0; i < parses; i++)
+    {
+        memcpy(copy, text, len);
+        json_t *root = parse_json(copy, len);
+        json_t *last = json_at(root, json_count(root) - 1);
+        long long id;
+        if (json_int(json_get(last, "id"), &id) == 0)
+            sum += id;
+        free(root);
+    }
+    double ns = (now() - start) / parses;
+    printf("%5d objects %-9s %8zu bytes: %10.0f ns per document  %7.1f MB/s  (%lld)\n", n, pretty ? "pretty" : "minified", len, ns, len / ns * 1e3, sum / parses);
+    free(copy);
+    free(text);
+}
+
+int main()
+{
+    int sizes[] = {1, 10, 100, 1000};
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        run(sizes[i], 0);
+        run(sizes[i], 1);
+    }
+    return 0;
+}
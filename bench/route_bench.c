@@ -0,0 +1,101 @@
+#include <route.h>
+#include <http_data.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUPS 2000000
+
+// the linked list the routes were kept in before the radix tree, as the baseline
+typedef struct list_route
+{
+    char *path;
+    callback cb;
+    struct list_route *next;
+} list_route_t;
+
+static void handler(request_t *req, response_t *res)
+{
+    (void)req;
+    (void)res;
+}
+
+static callback list_lookup(list_route_t *head, const char *path)
+{
+    while (head != NULL)
+    {
+        if (strcmp(head->path, path) == 0)
+            return head->cb;
+        head = head->next;
+    }
+    return NULL;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void run(int n_routes)
+{
+    char **paths = (char **)malloc(n_routes * sizeof(char *));
+    list_route_t *list = NULL;
+    for (int i = 0; i < n_routes; i++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/api/v1/resource%d/items", i);
+        paths[i] = strdup(path);
+        add_route("GET", paths[i], &handler);
+        list_route_t *node = (list_route_t *)malloc(sizeof(list_route_t));
+        node->path = paths[i];
+        node->cb = &handler;
+        node->next = list;
+        list = node;
+    }
+
+    //every route is looked up in turn, as many times for every size
+    volatile callback found = NULL;
+    double start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+        found = list_lookup(list, paths[i % n_routes]);
+    double list_ns = (now() - start) / LOOKUPS;
+
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+        found = get_route("GET", paths[i % n_routes]);
+    double tree_ns = (now() - start) / LOOKUPS;
+
+    freeze_routes();
+    start = now();
+    for (int i = 0; i < LOOKUPS; i++)
+        found = get_route("GET", paths[i % n_routes]);
+    double frozen_ns = (now() - start) / LOOKUPS;
+    (void)found;
+
+    printf("%6d routes: list %8.1f ns  radix tree %6.1f ns  frozen %6.1f ns\n", n_routes, list_ns, tree_ns, frozen_ns);
+
+    free_routes();
+    while (list != NULL)
+    {
+        list_route_t *next = list->next;
+        free(list);
+        list = next;
+    }
+    for (int i = 0; i < n_routes; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+int main(int argc, char const *argv[])
+{
+    (void)argc;
+    (void)argv;
+    run(10);
+    run(100);
+    run(1000);
+    return 0;
+}
\ No newline at end of file
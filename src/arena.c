@@ -0,0 +1,220 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/arena.c
+ * @brief implementation of arena.h
+*/
+
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static __thread arena_t *selected;
+
+/**
+ * Add a chunk of at least size bytes to an arena
+ * 
+ * @return the new chunk, NULL if an error occurred
+*/
+static arena_chunk_t *add_chunk(arena_t *arena, size_t size)
+{
+    size_t chunk_size = arena->chunks == NULL ? ARENA_CHUNK_SIZE : arena->chunks->size * 2;
+    while (chunk_size < size)
+        chunk_size *= 2;
+    arena_chunk_t *chunk = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + chunk_size);
+    if (chunk == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk;
+}
+
+/**
+ * Initialize an arena
+ * No memory is allocated until the first allocation.
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+void init_arena(arena_t *arena)
+{
+    arena->chunks = NULL;
+}
+
+/**
+ * Allocate memory from an arena
+ * The memory is aligned to 16 bytes and lives until the arena is reset.
+ * 
+ * @param arena a pointer to the arena_t struct
+ * @param size the number of bytes
+ * @return a pointer to the memory
+ * @return NULL if an error occurred
+*/
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    arena_chunk_t *chunk = arena->chunks;
+    if (chunk == NULL || chunk->size - chunk->used < size)
+    {
+        if ((chunk = add_chunk(arena, size)) == NULL)
+            return NULL;
+    }
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+/**
+ * Reset an arena
+ * This function releases everything allocated from the arena at once. The chunk in use,
+ * the largest since each one doubles the last, is kept for the next request: once it fits
+ * the requests of the connection a reset only rewinds it, without calling malloc or free.
+ * trim_arena releases it when the connection no longer needs it.
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+void reset_arena(arena_t *arena)
+{
+    arena_chunk_t *chunk = arena->chunks;
+    if (chunk == NULL)
+        return;
+    for (arena_chunk_t *older = chunk->next, *next; older != NULL; older = next)
+    {
+        next = older->next;
+        free(older);
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+}
+
+/**
+ * Trim a reset arena
+ * This function frees the chunk kept by reset_arena when it is larger than max_size, so
+ * that a connection going idle does not hold the memory of a large request it once served.
+ * The next allocation starts again from a chunk of ARENA_CHUNK_SIZE.
+ * 
+ * @param arena a pointer to the arena_t struct, reset
+ * @param max_size the largest chunk kept
+*/
+void trim_arena(arena_t *arena, size_t max_size)
+{
+    if (arena->chunks != NULL && arena->chunks->size > max_size)
+    {
+        free(arena->chunks);
+        arena->chunks = NULL;
+    }
+}
+
+/**
+ * Free an arena
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+void free_arena(arena_t *arena)
+{
+    reset_arena(arena);
+    free(arena->chunks);
+    arena->chunks = NULL;
+}
+
+/**
+ * Select the arena of the calling thread
+ * While an arena is selected mem_alloc, mem_strdup and the functions building requests
+ * and responses allocate from it.
+ * 
+ * @param arena a pointer to the arena_t struct, NULL to go back to malloc
+ * @return the arena selected before, to restore it
+*/
+arena_t *use_arena(arena_t *arena)
+{
+    arena_t *previous = selected;
+    selected = arena;
+    return previous;
+}
+
+/**
+ * Get the arena of the calling thread
+ * 
+ * @return the selected arena, NULL if none is selected
+*/
+arena_t *current_arena()
+{
+    return selected;
+}
+
+/**
+ * Allocate memory from the selected arena, or with malloc when none is selected
+ * 
+ * @param size the number of bytes
+ * @return a pointer to the memory
+ * @return NULL if an error occurred
+*/
+void *mem_alloc(size_t size)
+{
+    if (selected != NULL)
+        return arena_alloc(selected, size);
+    return malloc(size);
+}
+
+/**
+ * Duplicate a string with mem_alloc
+ * 
+ * @param s the string
+ * @return a pointer to the copy
+ * @return NULL if an error occurred
+*/
+char *mem_strdup(const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = (char *)mem_alloc(len);
+    if (copy != NULL)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+/**
+ * Check if memory belongs to an arena
+*/
+static int owns(arena_t *arena, void *ptr)
+{
+    for (arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    {
+        if ((char *)ptr >= chunk->data && (char *)ptr < chunk->data + chunk->size)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Free memory allocated while an arena was selected, or with malloc
+ * Memory of the arena is released by reset_arena, so it is left alone.
+ * 
+ * @param arena the arena selected when the memory was allocated, NULL for malloc
+ * @param ptr the memory, NULL is ignored
+*/
+void arena_free(arena_t *arena, void *ptr)
+{
+    if (ptr == NULL || (arena != NULL && owns(arena, ptr)))
+        return;
+    free(ptr);
+}
+
+/**
+ * Free memory from mem_alloc
+ * The memory must have been allocated while the same arena, or none, was selected.
+ * 
+ * @param ptr the memory, NULL is ignored
+*/
+void mem_free(void *ptr)
+{
+    arena_free(selected, ptr);
+}
\ No newline at end of file
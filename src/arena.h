@@ -0,0 +1,135 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/arena.h
+ * @brief provides a bump allocator backing the request and response of a connection
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_CHUNK_SIZE 4096
+
+typedef struct arena_chunk_t
+{
+    struct arena_chunk_t *next;
+    size_t size;
+    size_t used;
+    _Alignas(16) char data[];
+} arena_chunk_t;
+
+typedef struct arena_t
+{
+    arena_chunk_t *chunks;  // the chunk in use first, the first chunk allocated last
+} arena_t;
+
+/**
+ * Initialize an arena
+ * No memory is allocated until the first allocation.
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+extern void init_arena(arena_t *arena);
+
+/**
+ * Allocate memory from an arena
+ * The memory is aligned to 16 bytes and lives until the arena is reset.
+ * 
+ * @param arena a pointer to the arena_t struct
+ * @param size the number of bytes
+ * @return a pointer to the memory
+ * @return NULL if an error occurred
+*/
+extern void *arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * Reset an arena
+ * This function releases everything allocated from the arena at once. The chunk in use,
+ * the largest since each one doubles the last, is kept for the next request: once it fits
+ * the requests of the connection a reset only rewinds it, without calling malloc or free.
+ * trim_arena releases it when the connection no longer needs it.
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+extern void reset_arena(arena_t *arena);
+
+/**
+ * Trim a reset arena
+ * This function frees the chunk kept by reset_arena when it is larger than max_size, so
+ * that a connection going idle does not hold the memory of a large request it once served.
+ * The next allocation starts again from a chunk of ARENA_CHUNK_SIZE.
+ * 
+ * @param arena a pointer to the arena_t struct, reset
+ * @param max_size the largest chunk kept
+*/
+extern void trim_arena(arena_t *arena, size_t max_size);
+
+/**
+ * Free an arena
+ * 
+ * @param arena a pointer to the arena_t struct
+*/
+extern void free_arena(arena_t *arena);
+
+/**
+ * Select the arena of the calling thread
+ * While an arena is selected mem_alloc, mem_strdup and the functions building requests
+ * and responses allocate from it.
+ * 
+ * @param arena a pointer to the arena_t struct, NULL to go back to malloc
+ * @return the arena selected before, to restore it
+*/
+extern arena_t *use_arena(arena_t *arena);
+
+/**
+ * Get the arena of the calling thread
+ * 
+ * @return the selected arena, NULL if none is selected
+*/
+extern arena_t *current_arena();
+
+/**
+ * Allocate memory from the selected arena, or with malloc when none is selected
+ * 
+ * @param size the number of bytes
+ * @return a pointer to the memory
+ * @return NULL if an error occurred
+*/
+extern void *mem_alloc(size_t size);
+
+/**
+ * Duplicate a string with mem_alloc
+ * 
+ * @param s the string
+ * @return a pointer to the copy
+ * @return NULL if an error occurred
+*/
+extern char *mem_strdup(const char *s);
+
+/**
+ * Free memory allocated while an arena was selected, or with malloc
+ * Memory of the arena is released by reset_arena, so it is left alone. Use it for memory
+ * kept past the call that allocated it, like the fields of a request or a response, which
+ * record their arena.
+ * 
+ * @param arena the arena selected when the memory was allocated, NULL for malloc
+ * @param ptr the memory, NULL is ignored
+*/
+extern void arena_free(arena_t *arena, void *ptr);
+
+/**
+ * Free memory from mem_alloc
+ * The memory must have been allocated while the same arena, or none, was selected, see
+ * arena_free otherwise.
+ * 
+ * @param ptr the memory, NULL is ignored
+*/
+extern void mem_free(void *ptr);
+
+#endif // ARENA_H
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/buffer_pool.c
+ * @brief implementation of buffer_pool.h
+*/
+
+#include "buffer_pool.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//free buffers are linked through their first bytes
+typedef struct free_buffer_t
+{
+    struct free_buffer_t *next;
+} free_buffer_t;
+
+static free_buffer_t *pool;
+static int n_pooled;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Get a buffer
+ * Buffers of up to POOL_BUFFER_SIZE bytes are taken from the pool, larger ones are allocated.
+ * 
+ * @param size the minimum size of the buffer
+ * @param capacity set to the real size of the buffer
+ * @return a pointer to the buffer
+ * @return NULL if an error occurred
+*/
+char *get_buffer(size_t size, size_t *capacity)
+{
+    if (size <= POOL_BUFFER_SIZE)
+    {
+        pthread_mutex_lock(&pool_lock);
+        free_buffer_t *buffer = pool;
+        if (buffer != NULL)
+        {
+            pool = buffer->next;
+            n_pooled--;
+        }
+        pthread_mutex_unlock(&pool_lock);
+        size = POOL_BUFFER_SIZE;
+        if (buffer != NULL)
+        {
+            *capacity = size;
+            return (char *)buffer;
+        }
+    }
+    char *buffer = malloc(size);
+    if (buffer == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    *capacity = size;
+    return buffer;
+}
+
+/**
+ * Put a buffer back
+ * Buffers of POOL_BUFFER_SIZE bytes are kept in the pool for the next connections, up to
+ * POOL_MAX_BUFFERS of them, the others are freed.
+ * 
+ * @param buffer the buffer, NULL is ignored
+ * @param capacity the size of the buffer, as returned by get_buffer
+*/
+void put_buffer(char *buffer, size_t capacity)
+{
+    if (buffer == NULL)
+        return;
+    if (capacity == POOL_BUFFER_SIZE)
+    {
+        pthread_mutex_lock(&pool_lock);
+        if (n_pooled < POOL_MAX_BUFFERS)
+        {
+            free_buffer_t *node = (free_buffer_t *)buffer;
+            node->next = pool;
+            pool = node;
+            n_pooled++;
+            buffer = NULL;
+        }
+        pthread_mutex_unlock(&pool_lock);
+    }
+    free(buffer);
+}
+
+/**
+ * Free the buffer pool
+ * This function frees the buffers kept in the pool.
+*/
+void free_buffer_pool()
+{
+    pthread_mutex_lock(&pool_lock);
+    while (pool != NULL)
+    {
+        free_buffer_t *next = pool->next;
+        free(pool);
+        pool = next;
+    }
+    n_pooled = 0;
+    pthread_mutex_unlock(&pool_lock);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/buffer_pool.h
+ * @brief provides a pool of connection buffers, so memory follows the traffic instead of the number of connections
+*/
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+
+#define POOL_BUFFER_SIZE 16384
+#define POOL_MAX_BUFFERS 256
+
+/**
+ * Get a buffer
+ * Buffers of up to POOL_BUFFER_SIZE bytes are taken from the pool, larger ones are allocated.
+ * 
+ * @param size the minimum size of the buffer
+ * @param capacity set to the real size of the buffer
+ * @return a pointer to the buffer
+ * @return NULL if an error occurred
+*/
+extern char *get_buffer(size_t size, size_t *capacity);
+
+/**
+ * Put a buffer back
+ * Buffers of POOL_BUFFER_SIZE bytes are kept in the pool for the next connections, up to
+ * POOL_MAX_BUFFERS of them, the others are freed.
+ * 
+ * @param buffer the buffer, NULL is ignored
+ * @param capacity the size of the buffer, as returned by get_buffer
+*/
+extern void put_buffer(char *buffer, size_t capacity);
+
+/**
+ * Free the buffer pool
+ * This function frees the buffers kept in the pool.
+*/
+extern void free_buffer_pool();
+
+#endif // BUFFER_POOL_H
\ No newline at end of file
@@ -10,13 +10,467 @@
 */
 
 #include "client.h"
+#include "buffer_pool.h"
+#include "connection.h"
+#include "stream.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 #include <pthread.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 
 
 static client_t *clients;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Create a client
+ * This function allocates a client_t struct for an accepted connection together with
+ * its arena and the request/response structs allocated from it. The receive buffer is
+ * taken from the buffer pool when data arrives.
+ * 
+ * @param client_fd the file descriptor of the connection
+ * @return a pointer to the client_t struct
+ * @return NULL if an error occurred
+*/
+client_t *create_client(int client_fd)
+{
+    client_t *client = (client_t *)malloc(sizeof(client_t));
+    if (client == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    client->client_fd = client_fd;
+    client->thread_id = 0;
+    init_arena(&client->arena);
+    arena_t *previous = use_arena(&client->arena);
+    client->req = init_request(); //allocate request from the arena and set all fields to NULL
+    client->res = init_response(); //allocate response from the arena and set all fields to NULL
+    use_arena(previous);
+    client->state = STATE_FIRST_LINE;
+    client->request = NULL;
+    client->request_len = 0;
+    client->request_size = 0;
+    client->max_request = MAX_SIZE;
+    client->consumed = 0;
+    client->keep_alive = 1;
+    client->requests = 0;
+    client->max_requests = MAX_KEEP_ALIVE_REQUESTS;
+    client->arena_keep = ARENA_KEEP_SIZE;
+    client->timeouts.idle = IDLE_TIMEOUT;
+    client->timeouts.header = HEADER_TIMEOUT;
+    client->timeouts.body = BODY_TIMEOUT;
+    client->request_start = 0;
+    init_timer(&client->timer);
+    init_parser(&client->parser);
+    client->on_body = NULL;
+    client->body = NULL;
+    client->body_len = 0;
+    client->body_size = 0;
+    client->out = NULL;
+    client->out_tail = NULL;
+    client->io_state = NULL;
+    client->owner = NULL;
+    client->dispatch = NULL;
+    client->closing = 0;
+    client->prev = NULL;
+    client->next = NULL;
+    if (client->req == NULL || client->res == NULL)
+    {
+        perror("[-]malloc failed");
+        free_arena(&client->arena);
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+/**
+ * Destroy a client
+ * This function closes the connection and frees the memory allocated for the client.
+ * It does not remove the client from any list.
+ * 
+ * @param client a pointer to the client_t struct
+*/
+void destroy_client(client_t *client)
+{
+    if (client == NULL)
+        return;
+    close(client->client_fd);
+    free_request(client->req);
+    free_response(client->res);
+    free_arena(&client->arena);
+    put_buffer(client->request, client->request_size);
+    put_buffer(client->body, client->body_size);
+    free_output(client->out);
+    free(client);
+}
+
+/**
+ * Create an output segment
+ * 
+ * @param data the data to send, owned by the segment from now on
+ * @param len the length of the data
+ * @param size the capacity of data if it comes from the buffer pool, 0 if it is released with free
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, data is not released
+*/
+out_segment_t *create_segment(char *data, size_t len, size_t size)
+{
+    out_segment_t *segment = (out_segment_t *)malloc(sizeof(out_segment_t));
+    if (segment == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    segment->next = NULL;
+    segment->data = data;
+    segment->len = len;
+    segment->sent = 0;
+    segment->size = size;
+    segment->fd = -1;
+    segment->offset = 0;
+    segment->release = NULL;
+    segment->owner = NULL;
+    segment->stream = NULL;
+    return segment;
+}
+
+/**
+ * Create an output segment sending a range of a file
+ * The file is sent with sendfile, so its content is never copied into user space.
+ * 
+ * @param fd the file descriptor, owned by the segment from now on
+ * @param offset the offset of the first byte to send
+ * @param len the number of bytes to send
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, fd is not closed
+*/
+out_segment_t *create_file_segment(int fd, off_t offset, size_t len)
+{
+    out_segment_t *segment = create_segment(NULL, len, 0);
+    if (segment == NULL)
+        return NULL;
+    segment->fd = fd;
+    segment->offset = offset;
+    return segment;
+}
+
+static void release_stream(void *stream)
+{
+    free_stream((stream_t *)stream);
+}
+
+/**
+ * Create an output segment producing a streamed body
+ * The segment holds no data: when the output reaches it the chunks of the stream are
+ * pulled and sent before it, see expand_stream.
+ * 
+ * @param stream the stream, owned by the segment from now on
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, the stream is not freed
+*/
+out_segment_t *create_stream_segment(stream_t *stream)
+{
+    out_segment_t *segment = create_segment(NULL, 0, 0);
+    if (segment == NULL)
+        return NULL;
+    segment->stream = stream;
+    segment->release = release_stream;
+    segment->owner = stream;
+    return segment;
+}
+
+/**
+ * Expand the stream segment at the head of a list of output segments
+ * The chunks produced by the stream are linked before the segment. Once the stream has
+ * ended the segment is emptied, so that it is dropped like a segment sent completely.
+ * 
+ * @param segments a pointer to the head of the list, a stream segment
+ * @return 0 on success, -1 if the stream failed
+*/
+int expand_stream(out_segment_t **segments)
+{
+    out_segment_t *segment = *segments;
+    int ended;
+    out_segment_t *chunks = pull_stream(segment->stream, &ended);
+    if (chunks == NULL && !ended)
+        return -1;
+    if (ended)
+    {
+        free_stream(segment->stream);
+        segment->stream = NULL;
+        segment->release = NULL;
+        segment->owner = NULL;
+    }
+    if (chunks != NULL)
+    {
+        *segments = chunks;
+        while (chunks->next != NULL)
+            chunks = chunks->next;
+        chunks->next = segment;
+    }
+    return 0;
+}
+
+static void free_segment(out_segment_t *segment)
+{
+    if (segment->release != NULL)
+        segment->release(segment->owner);
+    else if (segment->fd >= 0)
+        close(segment->fd);
+    else if (segment->size > 0)
+        put_buffer(segment->data, segment->size);
+    else
+        free(segment->data);
+    free(segment);
+}
+
+/**
+ * Free a list of output segments, with their data
+ * 
+ * @param segments the first segment of the list, NULL is ignored
+*/
+void free_output(out_segment_t *segments)
+{
+    while (segments != NULL)
+    {
+        out_segment_t *next = segments->next;
+        free_segment(segments);
+        segments = next;
+    }
+}
+
+/**
+ * Queue output for a client
+ * This function copies data at the end of the output of the client, it is sent by flush_client.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param data the data to send
+ * @param len the length of the data
+ * @return 0 if the data was queued, -1 otherwise
+*/
+int queue_output(client_t *client, const char *data, size_t len)
+{
+    out_segment_t *tail = client->out_tail;
+    if (tail == NULL || tail->size == 0 || tail->size - tail->len < len)
+    {
+        size_t size;
+        char *buffer = get_buffer(len, &size);
+        if (buffer == NULL)
+            return -1;
+        if ((tail = create_segment(buffer, 0, size)) == NULL)
+        {
+            put_buffer(buffer, size);
+            return -1;
+        }
+        queue_segments(client, tail);
+    }
+    memcpy(tail->data + tail->len, data, len);
+    tail->len += len;
+    return 0;
+}
+
+/**
+ * Check whether a segment holds a buffer from the pool that output can be appended to
+*/
+static int is_pool_segment(const out_segment_t *segment)
+{
+    return segment->fd < 0 && segment->release == NULL && segment->size > 0;
+}
+
+/**
+ * Queue output segments for a client
+ * The segments are appended to the output of the client without copying their data,
+ * except for a first segment that fits in the pool buffer at the tail of the output: it is
+ * copied there, so that the heads of pipelined responses go out in one buffer.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param segments the first segment of the list, owned by the client from now on
+*/
+void queue_segments(client_t *client, out_segment_t *segments)
+{
+    if (segments == NULL)
+        return;
+    out_segment_t *tail = client->out_tail;
+    if (tail != NULL && is_pool_segment(tail) && is_pool_segment(segments) && segments->len <= tail->size - tail->len)
+    {
+        memcpy(tail->data + tail->len, segments->data, segments->len);
+        tail->len += segments->len;
+        out_segment_t *next = segments->next;
+        segments->next = NULL;
+        free_segment(segments);
+        if ((segments = next) == NULL)
+            return;
+    }
+    if (client->out_tail == NULL)
+        client->out = segments;
+    else
+        client->out_tail->next = segments;
+    while (segments->next != NULL)
+        segments = segments->next;
+    client->out_tail = segments;
+}
+
+/**
+ * Gather the unsent data of a list of output segments
+ * Gathering stops at the first file segment, which is sent on its own, and at the first
+ * stream segment, which must be expanded first.
+ * 
+ * @param segments the first segment of the list
+ * @param iov the vector to fill
+ * @param max the capacity of iov
+ * @return the number of entries filled
+*/
+int gather_output(out_segment_t *segments, struct iovec *iov, int max)
+{
+    int n = 0;
+    for (; segments != NULL && n < max && segments->fd < 0 && segments->stream == NULL; segments = segments->next)
+    {
+        if (segments->sent == segments->len)
+            continue;
+        iov[n].iov_base = segments->data + segments->sent;
+        iov[n].iov_len = segments->len - segments->sent;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Consume sent data from a list of output segments
+ * The segments sent completely are freed, consuming stops at a stream segment.
+ * 
+ * @param segments the first segment of the list
+ * @param sent the number of bytes sent
+ * @return the first segment still holding unsent data, NULL if everything was sent
+*/
+out_segment_t *consume_output(out_segment_t *segments, size_t sent)
+{
+    while (segments != NULL && segments->stream == NULL)
+    {
+        size_t left = segments->len - segments->sent;
+        if (sent < left)
+        {
+            segments->sent += sent;
+            break;
+        }
+        sent -= left;
+        out_segment_t *next = segments->next;
+        free_segment(segments);
+        segments = next;
+    }
+    return segments;
+}
+
+static int has_file(out_segment_t *segments)
+{
+    for (; segments != NULL; segments = segments->next)
+    {
+        if (segments->fd >= 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Discard the SIGPIPE raised by a send to a closed connection
+ * The signal is blocked in the calling thread, see block_sigpipe, so it stays pending
+ * until it is taken here.
+*/
+static void drop_sigpipe()
+{
+    int saved = errno;
+    sigset_t set;
+    struct timespec none = {0, 0};
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    while (sigtimedwait(&set, NULL, &none) == SIGPIPE)
+        ;
+    errno = saved;
+}
+
+/**
+ * Block SIGPIPE in the calling thread
+ * sendfile has no MSG_NOSIGNAL: the threads sending to clients block the signal instead
+ * of ignoring it for the whole process, which belongs to the application.
+*/
+void block_sigpipe()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    int result = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (result != 0)
+        fprintf(stderr, "[-]pthread_sigmask failed: %s\n", strerror(result));
+}
+
+/**
+ * Flush the output of a client
+ * This function sends as much queued output as the socket accepts, gathering the response
+ * heads and bodies into one sendmsg so that no response is copied into a single buffer.
+ * File bodies are sent with sendfile and streamed bodies are pulled chunk by chunk as the
+ * socket accepts them.
+ * On a blocking socket it returns only when everything is sent or an error occurred.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if all the output was sent
+ * @return 1 if the socket would block and output is still pending
+ * @return -1 if an error occurred
+*/
+int flush_client(client_t *client)
+{
+    struct iovec iov[OUT_IOV_MAX];
+    while (client->out != NULL)
+    {
+        out_segment_t *segment = client->out;
+        ssize_t sent;
+        if (segment->stream != NULL)
+        {
+            if (expand_stream(&client->out) < 0)
+                return -1;
+            continue;
+        }
+        if (segment->fd >= 0)
+        {
+            off_t offset = segment->offset + segment->sent;
+            sent = sendfile(client->client_fd, segment->fd, &offset, segment->len - segment->sent);
+            if (sent == 0)
+            {
+                fprintf(stderr, "[-]sendfile failed: file truncated\n");
+                return -1;
+            }
+        }
+        else
+        {
+            struct msghdr msg = {0};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = gather_output(segment, iov, OUT_IOV_MAX);
+            //a file segment follows, let the kernel put the head in the same packet as the file
+            sent = sendmsg(client->client_fd, &msg, MSG_NOSIGNAL | (has_file(segment) ? MSG_MORE : 0));
+        }
+        if (sent < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            if (errno == EPIPE && segment->fd >= 0)
+                drop_sigpipe();
+            perror("[-]send failed");
+            return -1;
+        }
+        client->out = consume_output(client->out, sent);
+    }
+    //an idle connection keeps no output buffer
+    client->out_tail = NULL;
+    return 0;
+}
 
 void init_clients()
 {
@@ -30,6 +484,7 @@ int add_client(client_t *client)
         perror("[-]malloc failed");
         return -1;
     }
+    pthread_mutex_lock(&clients_lock);
     if (clients == NULL)
         clients = client;
     else
@@ -41,6 +496,7 @@ int add_client(client_t *client)
         }
         current->next = client;
     }
+    pthread_mutex_unlock(&clients_lock);
     return 0;
 }
 
@@ -52,6 +508,7 @@ int add_client(client_t *client)
 */
 void remove_client(int client_fd)
 {
+    pthread_mutex_lock(&clients_lock);
     client_t *current = clients;
     client_t *prev = NULL;
     while (current != NULL)
@@ -66,15 +523,14 @@ void remove_client(int client_fd)
             {
                 prev->next = current->next;
             }
-            close(current->client_fd);
-            free_request(current->req); 
-            free_response(current->res);
-            free(current);
+            pthread_mutex_unlock(&clients_lock);
+            destroy_client(current);
             return;
         }
         prev = current;
         current = current->next;
     }
+    pthread_mutex_unlock(&clients_lock);
 }
 
 /**
@@ -86,16 +542,18 @@ void remove_client(int client_fd)
 */
 client_t* get_client(int client_fd)
 {
+    pthread_mutex_lock(&clients_lock);
     client_t *current = clients;
     while (current != NULL)
     {
         if (current->client_fd == client_fd)
         {
-            return current;
+            break;
         }
         current = current->next;
     }
-    return NULL;
+    pthread_mutex_unlock(&clients_lock);
+    return current;
 }
 
 /**
@@ -115,19 +573,18 @@ client_t* get_head()
 */
 void free_clients()
 {
+    pthread_mutex_lock(&clients_lock);
     client_t *current = clients;
     while (current != NULL)
     {
         client_t *next = current->next;
-        close(clients->client_fd);
-        if (clients->thread_id != 0)
-            pthread_cancel(clients->thread_id);
-        free_request(current->req);
-        free_response(current->res);
-        free(current);
+        if (current->thread_id != 0)
+            pthread_cancel(current->thread_id);
+        destroy_client(current);
         current = next;
     }
     clients = NULL;
+    pthread_mutex_unlock(&clients_lock);
 }
 
 /**
@@ -14,7 +14,38 @@
 #define CLIENT_H
 
 #include "http_data.h"
+#include "process_request.h"
+#include "arena.h"
+#include "timer_wheel.h"
 #include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#define OUT_IOV_MAX 64      // segments gathered by one send
+
+// a piece of output, response heads are copied into pool buffers, bodies are sent in place
+typedef struct out_segment_t
+{
+    struct out_segment_t *next;
+    char *data;
+    size_t len;
+    size_t sent;
+    size_t size;            // capacity of a buffer from the pool, 0 for a body released with free
+    int fd;                 // file sent with sendfile instead of data, -1 for memory
+    off_t offset;           // offset of the first byte of the file to send
+    void (*release)(void *owner);  // releases data owned by someone else, NULL to free it
+    void *owner;
+    struct stream_t *stream;    // produces the segments to send before this one when reached, NULL if none
+} out_segment_t;
+
+// limits of a connection in milliseconds, 0 disables one
+typedef struct timeouts_t
+{
+    unsigned idle;          // waiting for the next request or for the peer to read the output
+    unsigned header;        // from the first byte of a request to the end of its head
+    unsigned body;          // between two reads of the body
+} timeouts_t;
 
 typedef struct client_t
 {
@@ -22,9 +53,174 @@ typedef struct client_t
     pthread_t thread_id;
     request_t *req;
     response_t *res;
+    arena_t arena;          // backs req and res, reset between requests
+    int state;              // current parse state (STATE_FIRST_LINE ... STATE_RESET)
+    char *request;          // received bytes not yet consumed, NUL terminated, NULL while idle
+    size_t request_len;
+    size_t request_size;    // capacity of request
+    size_t max_request;     // limit of the head plus the body of a request
+    size_t consumed;        // bytes of request taken by the current request, the rest is pipelined
+    int keep_alive;         // the connection stays open after the current request
+    size_t requests;        // requests received on the connection
+    size_t max_requests;    // requests served before the connection is closed, 0 for no limit
+    size_t arena_keep;      // largest chunk of arena kept while the connection is idle
+    timeouts_t timeouts;
+    uint64_t request_start; // time the head of the current request started arriving, 0 if it did not
+    wheel_timer_t timer;    // deadline of the connection in the timer wheel of its reactor
+    http_parser_t parser;   // head of the current request, sliced out of request
+    body_reader_t reader;   // body of the current request when it is chunked or read by a body callback
+    body_callback on_body;  // body callback of the route of the current request, NULL to buffer the body
+    char *body;             // chunked body decoded so far, NULL unless one is being buffered
+    size_t body_len;
+    size_t body_size;       // capacity of body
+    out_segment_t *out;     // responses not yet sent, in order
+    out_segment_t *out_tail;
+    void *io_state;         // private state of the backend serving the connection
+    void *owner;            // reactor serving the connection
+    int (*dispatch)(struct client_t *client);  // hands the route callback to a worker, NULL to run it inline
+    int closing;            // closed by the peer while a worker still owns the request
+    struct client_t *prev;
     struct client_t *next;
 } client_t;
 
+/**
+ * Create a client
+ * This function allocates a client_t struct for an accepted connection together with
+ * its arena and the request/response structs allocated from it. The receive buffer is
+ * taken from the buffer pool when data arrives.
+ * 
+ * @param client_fd the file descriptor of the connection
+ * @return a pointer to the client_t struct
+ * @return NULL if an error occurred
+*/
+extern client_t *create_client(int client_fd);
+
+/**
+ * Destroy a client
+ * This function closes the connection and frees the memory allocated for the client.
+ * It does not remove the client from any list.
+ * 
+ * @param client a pointer to the client_t struct
+*/
+extern void destroy_client(client_t *client);
+
+/**
+ * Create an output segment
+ * 
+ * @param data the data to send, owned by the segment from now on
+ * @param len the length of the data
+ * @param size the capacity of data if it comes from the buffer pool, 0 if it is released with free
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, data is not released
+*/
+extern out_segment_t *create_segment(char *data, size_t len, size_t size);
+
+/**
+ * Create an output segment sending a range of a file
+ * The file is sent with sendfile, so its content is never copied into user space.
+ * 
+ * @param fd the file descriptor, owned by the segment from now on
+ * @param offset the offset of the first byte to send
+ * @param len the number of bytes to send
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, fd is not closed
+*/
+extern out_segment_t *create_file_segment(int fd, off_t offset, size_t len);
+
+/**
+ * Create an output segment producing a streamed body
+ * The segment holds no data: when the output reaches it the chunks of the stream are
+ * pulled and sent before it, see expand_stream.
+ * 
+ * @param stream the stream, owned by the segment from now on
+ * @return a pointer to the out_segment_t struct
+ * @return NULL if an error occurred, the stream is not freed
+*/
+extern out_segment_t *create_stream_segment(struct stream_t *stream);
+
+/**
+ * Expand the stream segment at the head of a list of output segments
+ * The chunks produced by the stream are linked before the segment. Once the stream has
+ * ended the segment is emptied, so that it is dropped like a segment sent completely.
+ * 
+ * @param segments a pointer to the head of the list, a stream segment
+ * @return 0 on success, -1 if the stream failed
+*/
+extern int expand_stream(out_segment_t **segments);
+
+/**
+ * Free a list of output segments, with their data
+ * 
+ * @param segments the first segment of the list, NULL is ignored
+*/
+extern void free_output(out_segment_t *segments);
+
+/**
+ * Queue output for a client
+ * This function copies data at the end of the output of the client, it is sent by flush_client.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param data the data to send
+ * @param len the length of the data
+ * @return 0 if the data was queued, -1 otherwise
+*/
+extern int queue_output(client_t *client, const char *data, size_t len);
+
+/**
+ * Queue output segments for a client
+ * The segments are appended to the output of the client without copying their data,
+ * except for a first segment that fits in the pool buffer at the tail of the output: it is
+ * copied there, so that the heads of pipelined responses go out in one buffer.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param segments the first segment of the list, owned by the client from now on
+*/
+extern void queue_segments(client_t *client, out_segment_t *segments);
+
+/**
+ * Gather the unsent data of a list of output segments
+ * Gathering stops at the first file segment, which is sent on its own, and at the first
+ * stream segment, which must be expanded first.
+ * 
+ * @param segments the first segment of the list
+ * @param iov the vector to fill
+ * @param max the capacity of iov
+ * @return the number of entries filled
+*/
+extern int gather_output(out_segment_t *segments, struct iovec *iov, int max);
+
+/**
+ * Consume sent data from a list of output segments
+ * The segments sent completely are freed, consuming stops at a stream segment.
+ * 
+ * @param segments the first segment of the list
+ * @param sent the number of bytes sent
+ * @return the first segment still holding unsent data, NULL if everything was sent
+*/
+extern out_segment_t *consume_output(out_segment_t *segments, size_t sent);
+
+/**
+ * Flush the output of a client
+ * This function sends as much queued output as the socket accepts, gathering the response
+ * heads and bodies into one sendmsg so that no response is copied into a single buffer.
+ * File bodies are sent with sendfile and streamed bodies are pulled chunk by chunk as the
+ * socket accepts them.
+ * On a blocking socket it returns only when everything is sent or an error occurred.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if all the output was sent
+ * @return 1 if the socket would block and output is still pending
+ * @return -1 if an error occurred
+*/
+extern int flush_client(client_t *client);
+
+/**
+ * Block SIGPIPE in the calling thread
+ * sendfile has no MSG_NOSIGNAL: the threads sending to clients block the signal instead
+ * of ignoring it for the whole process, which belongs to the application.
+*/
+extern void block_sigpipe();
+
 extern void init_clients();
 
 extern int add_client(client_t *client);
@@ -0,0 +1,306 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/compress.c
+ * @brief implementation of compress.h
+*/
+
+#include "compress.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+/**
+ * Parse the quality of a coding in Accept-Encoding
+ * 
+ * @param p the parameters after the coding, up to the next comma
+ * @param end the end of the parameters
+ * @return 1 if the quality is not 0, 0 otherwise
+*/
+static int has_quality(const char *p, const char *end)
+{
+    while ((p = memchr(p, ';', end - p)) != NULL)
+    {
+        p++;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (end - p < 2 || (*p != 'q' && *p != 'Q') || p[1] != '=')
+            continue;
+        //q=0, q=0. and q=0.000 refuse the coding, anything else above 0 accepts it
+        for (p += 2; p < end && (*p == '0' || *p == '.'); p++)
+            ;
+        return p < end && *p >= '1' && *p <= '9';
+    }
+    return 1;
+}
+
+/**
+ * Parse an Accept-Encoding header
+ * Codings with q=0 are refused, "*" accepts the codings not listed and x-gzip is taken
+ * as gzip.
+ * 
+ * @param value the value of the header, NULL if the request has none
+ * @return the codings accepted among ENCODING_GZIP and ENCODING_DEFLATE
+*/
+int accepted_encodings(const char *value)
+{
+    if (value == NULL)
+        return 0;
+    int accepted = 0, refused = 0, any = 0;
+    const char *p = value;
+    while (*p != '\0')
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        const char *coding = p;
+        while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        size_t len = p - coding;
+        const char *end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
+        int encoding = 0;
+        if ((len == 4 && strncasecmp(coding, "gzip", 4) == 0) || (len == 6 && strncasecmp(coding, "x-gzip", 6) == 0))
+            encoding = ENCODING_GZIP;
+        else if (len == 7 && strncasecmp(coding, "deflate", 7) == 0)
+            encoding = ENCODING_DEFLATE;
+        else if (len == 1 && *coding == '*')
+            encoding = ENCODING_GZIP | ENCODING_DEFLATE;
+        if (encoding != 0)
+        {
+            int ok = has_quality(p, end);
+            if (len == 1)
+                any = ok ? 1 : -1;
+            else if (ok)
+                accepted |= encoding;
+            else
+                refused |= encoding;
+        }
+        p = end;
+    }
+    if (any > 0)
+        accepted |= (ENCODING_GZIP | ENCODING_DEFLATE) & ~refused;
+    return accepted & ~refused;
+}
+
+/**
+ * Check if a Content-Type is worth compressing
+ * Text, JSON, JavaScript, XML and SVG are, images, audio, video and archives are already
+ * compressed.
+ * 
+ * @param content_type the Content-Type, parameters are ignored, NULL is not compressible
+ * @return 1 if the content type is compressible, 0 otherwise
+*/
+int is_compressible(const char *content_type)
+{
+    if (content_type == NULL)
+        return 0;
+    size_t len = strcspn(content_type, "; ");
+    static const char *types[] = {
+        "application/json",
+        "application/javascript",
+        "application/xml",
+        "application/wasm",
+        "image/svg+xml",
+    };
+    if (len > 5 && strncasecmp(content_type, "text/", 5) == 0)
+        return 1;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strlen(types[i]) == len && strncasecmp(content_type, types[i], len) == 0)
+            return 1;
+    }
+    //structured syntax suffixes, like application/ld+json or application/atom+xml
+    return (len > 5 && strncasecmp(content_type + len - 5, "+json", 5) == 0) ||
+           (len > 4 && strncasecmp(content_type + len - 4, "+xml", 4) == 0);
+}
+
+/**
+ * Compress a buffer
+ * 
+ * @param data the data
+ * @param len the length of the data
+ * @param encoding ENCODING_GZIP or ENCODING_DEFLATE (the zlib format, as HTTP defines it)
+ * @param level the zlib compression level
+ * @param out set to the compressed data, allocated with malloc
+ * @param out_len set to the length of the compressed data
+ * @return 0 on success, -1 if an error occurred or the server was built without zlib
+*/
+int compress_buffer(const char *data, size_t len, int encoding, int level, char **out, size_t *out_len)
+{
+#ifdef USE_ZLIB
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    //15 bits of window, plus 16 for the gzip wrapper instead of the zlib one
+    if (deflateInit2(&stream, level, Z_DEFLATED, encoding == ENCODING_GZIP ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        printf("[-]Error initializing zlib\n");
+        return -1;
+    }
+    size_t size = deflateBound(&stream, len);
+    char *buffer = (char *)malloc(size);
+    if (buffer == NULL)
+    {
+        perror("[-]malloc failed");
+        deflateEnd(&stream);
+        return -1;
+    }
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = len;
+    stream.next_out = (Bytef *)buffer;
+    stream.avail_out = size;
+    //the bound fits the whole output, so a single call finishes the stream
+    int result = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END)
+    {
+        printf("[-]Error compressing\n");
+        free(buffer);
+        return -1;
+    }
+    *out = buffer;
+    *out_len = stream.total_out;
+    return 0;
+#else
+    (void)data;
+    (void)len;
+    (void)encoding;
+    (void)level;
+    (void)out;
+    (void)out_len;
+    return -1;
+#endif
+}
+
+/**
+ * Add a suffix to a strong ETag, "abc" becomes "abc-gzip"
+ * 
+ * @return 0 on success, -1 if an error occurred
+*/
+static int tag_variant(response_t *res, const char *coding)
+{
+    for (node_t *header = res->headers; header != NULL; header = header->next)
+    {
+        if (header->key == NULL || strcasecmp(header->key, "ETag") != 0)
+            continue;
+        size_t len = strlen(header->value);
+        if (len < 2 || header->value[0] != '"' || header->value[len - 1] != '"')
+            return 0; //weak tags are shared by equivalent variants
+        size_t coding_len = strlen(coding);
+        char *value = (char *)mem_alloc(len + 1 + coding_len + 1);
+        if (value == NULL)
+        {
+            perror("[-]Error tagging variant");
+            return -1;
+        }
+        memcpy(value, header->value, len - 1);
+        value[len - 1] = '-';
+        memcpy(value + len, coding, coding_len);
+        memcpy(value + len + coding_len, "\"", 2);
+        arena_free(res->arena, header->value);
+        header->value = value;
+        return 0;
+    }
+    return 0;
+}
+
+/**
+ * Add Accept-Encoding to the Vary header of a response
+ * The field is appended to a Vary header already set, unless it is "*" or already lists
+ * Accept-Encoding, otherwise the header is added.
+ * 
+ * @param res a pointer to the response_t struct
+*/
+void vary_encoding(response_t *res)
+{
+    node_t *vary = NULL;
+    for (node_t *header = res->headers; header != NULL; header = header->next)
+    {
+        if (header->key == NULL || strcasecmp(header->key, "Vary") != 0)
+            continue;
+        for (const char *p = header->value; *p != '\0';)
+        {
+            while (*p == ' ' || *p == '\t' || *p == ',')
+                p++;
+            const char *field = p;
+            while (*p != '\0' && *p != ',' && *p != ' ' && *p != '\t')
+                p++;
+            size_t len = p - field;
+            if ((len == 1 && *field == '*') || (len == 15 && strncasecmp(field, "Accept-Encoding", 15) == 0))
+                return;
+        }
+        if (vary == NULL)
+            vary = header;
+    }
+    if (vary == NULL)
+    {
+        add_header(&(res->headers), "Vary", "Accept-Encoding");
+        return;
+    }
+    size_t len = strlen(vary->value);
+    char *value = (char *)mem_alloc(len + sizeof(", Accept-Encoding"));
+    if (value == NULL)
+    {
+        perror("[-]Error extending Vary");
+        return;
+    }
+    memcpy(value, vary->value, len);
+    memcpy(value + len, ", Accept-Encoding", sizeof(", Accept-Encoding"));
+    arena_free(res->arena, vary->value);
+    vary->value = value;
+}
+
+/**
+ * Compress the body of a response
+ * A body held in memory, at least COMPRESS_MIN_SIZE bytes long and with a compressible
+ * Content-Type is compressed with a coding of res->encodings, gzip preferred, unless the
+ * route callback already set Content-Encoding or Content-Length. Accept-Encoding is added
+ * to Vary whenever the body could have been compressed, see vary_encoding, and a strong
+ * ETag gets the coding as a suffix so that each variant has its own.
+ * 
+ * @param res a pointer to the response_t struct
+ * @return 0 on success, -1 if an error occurred, the body is then sent as it is
+*/
+int compress_response(response_t *res)
+{
+    if (res->body == NULL || res->body_len < COMPRESS_MIN_SIZE || res->stream != NULL || res->file != NULL || res->file_fd >= 0)
+        return 0;
+    if (res->status < 200 || res->status == 204 || res->status == 206 || res->status == 304)
+        return 0;
+    if (!is_compressible(get_header(res->headers, "Content-Type")) || get_header(res->headers, "Content-Encoding") != NULL ||
+        get_header(res->headers, "Content-Length") != NULL)
+        return 0;
+    vary_encoding(res);
+    if (res->encodings == 0)
+        return 0;
+    int encoding = res->encodings & ENCODING_GZIP ? ENCODING_GZIP : ENCODING_DEFLATE;
+    const char *coding = encoding == ENCODING_GZIP ? "gzip" : "deflate";
+    char *body;
+    size_t len;
+    if (compress_buffer(res->body, res->body_len, encoding, COMPRESS_LEVEL, &body, &len) < 0)
+        return -1;
+    if (len >= res->body_len)
+    {
+        free(body);
+        return 0;
+    }
+    if (tag_variant(res, coding) < 0)
+    {
+        free(body);
+        return -1;
+    }
+    free(res->body);
+    res->body = body;
+    res->body_len = len;
+    add_header(&(res->headers), "Content-Encoding", (char *)coding);
+    return 0;
+}
\ No newline at end of file
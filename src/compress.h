@@ -0,0 +1,77 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/compress.h
+ * @brief provides the gzip and deflate content codings of responses
+*/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "http_data.h"
+#include <stddef.h>
+
+#define COMPRESS_MIN_SIZE 1024      // smaller bodies are sent as they are
+#define COMPRESS_LEVEL 5            // zlib level of bodies compressed for each response
+#define COMPRESS_LEVEL_CACHED 9     // zlib level of cached files, compressed once
+
+/**
+ * Parse an Accept-Encoding header
+ * Codings with q=0 are refused, "*" accepts the codings not listed and x-gzip is taken
+ * as gzip.
+ * 
+ * @param value the value of the header, NULL if the request has none
+ * @return the codings accepted among ENCODING_GZIP and ENCODING_DEFLATE
+*/
+extern int accepted_encodings(const char *value);
+
+/**
+ * Check if a Content-Type is worth compressing
+ * Text, JSON, JavaScript, XML and SVG are, images, audio, video and archives are already
+ * compressed.
+ * 
+ * @param content_type the Content-Type, parameters are ignored, NULL is not compressible
+ * @return 1 if the content type is compressible, 0 otherwise
+*/
+extern int is_compressible(const char *content_type);
+
+/**
+ * Compress a buffer
+ * 
+ * @param data the data
+ * @param len the length of the data
+ * @param encoding ENCODING_GZIP or ENCODING_DEFLATE (the zlib format, as HTTP defines it)
+ * @param level the zlib compression level
+ * @param out set to the compressed data, allocated with malloc
+ * @param out_len set to the length of the compressed data
+ * @return 0 on success, -1 if an error occurred or the server was built without zlib
+*/
+extern int compress_buffer(const char *data, size_t len, int encoding, int level, char **out, size_t *out_len);
+
+/**
+ * Add Accept-Encoding to the Vary header of a response
+ * The field is appended to a Vary header already set, unless it is "*" or already lists
+ * Accept-Encoding, otherwise the header is added.
+ * 
+ * @param res a pointer to the response_t struct
+*/
+extern void vary_encoding(response_t *res);
+
+/**
+ * Compress the body of a response
+ * A body held in memory, at least COMPRESS_MIN_SIZE bytes long and with a compressible
+ * Content-Type is compressed with a coding of res->encodings, gzip preferred, unless the
+ * route callback already set Content-Encoding or Content-Length. Accept-Encoding is added
+ * to Vary whenever the body could have been compressed, see vary_encoding, and a strong
+ * ETag gets the coding as a suffix so that each variant has its own.
+ * 
+ * @param res a pointer to the response_t struct
+ * @return 0 on success, -1 if an error occurred, the body is then sent as it is
+*/
+extern int compress_response(response_t *res);
+
+#endif // COMPRESS_H
\ No newline at end of file
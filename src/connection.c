@@ -0,0 +1,935 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/connection.c
+ * @brief implementation of connection.h
+*/
+
+#include "connection.h"
+#include "arena.h"
+#include "buffer_pool.h"
+#include "file_cache.h"
+#include "http_data.h"
+#include "process_request.h"
+#include "process_response.h"
+#include "route.h"
+#include "stream.h"
+#include "compress.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+/**
+ * Append a string to a response head
+ * 
+ * @return the end of the appended string
+*/
+static char *put_string(char *p, const char *s, size_t len)
+{
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static void release_cached_file(void *entry)
+{
+    release_file((file_entry_t *)entry);
+}
+
+/**
+ * Serialize a response_t struct to output segments
+ * The status line and the headers are written into a buffer from the pool, sized exactly,
+ * and the body follows as a segment of its own that takes over res->body, res->file_fd
+ * to be sent with sendfile, the cached res->file or the stream res->stream, so a large
+ * body is never copied and may contain NUL bytes. Bodies up to INLINE_BODY_MAX bytes are
+ * copied after the head instead, so that small pipelined responses can share a buffer.
+ * Responses to HEAD keep their body and only send the head.
+ * 
+ * @param res response_t struct
+ * @return the segments of the response or NULL if an error occurred
+*/
+out_segment_t *serialize(response_t *res)
+{
+    if (validate_response(res) < 0)
+    {
+        return NULL;
+    }
+
+    size_t line_len;
+    const char *line = status_line(res->status, &line_len);
+    if (line == NULL)
+    {
+        perror("[-]Invalid status code");
+        return NULL;
+    }
+
+    //the precomputed line is for HTTP/1.1, other versions reuse it after "HTTP/1.1"
+    int http11 = strcmp(res->version, "1.1") == 0;
+    size_t version_len = http11 ? 3 : strlen(res->version);
+    size_t head_len = 5 + version_len + line_len - 8 + 2;
+    for (node_t *header = res->headers; header != NULL; header = header->next)
+    {
+        if (header->key != NULL && header->value != NULL)
+            head_len += strlen(header->key) + 2 + strlen(header->value) + 2;
+    }
+    static const char chunked[] = "Transfer-Encoding: chunked\r\n";
+    int is_chunked = res->stream != NULL && !res->stream->raw;
+    if (is_chunked)
+        head_len += sizeof(chunked) - 1;
+
+    const char *file_data = res->file == NULL ? NULL : res->file_gzip ? res->file->gzip : res->file->data;
+    //a small body costs less to copy than an iovec and a segment of its own
+    const char *inline_body = NULL;
+    if (!res->head_only && res->file_fd < 0 && res->body_len > 0 && res->body_len <= INLINE_BODY_MAX)
+        inline_body = res->file != NULL ? file_data : res->body;
+    size_t inline_len = inline_body != NULL ? res->body_len : 0;
+
+    size_t size;
+    char *head = get_buffer(head_len + inline_len, &size);
+    if (head == NULL)
+        return NULL;
+    char *p;
+    if (http11)
+        p = put_string(head, line, line_len);
+    else
+    {
+        p = put_string(head, "HTTP/", 5);
+        p = put_string(p, res->version, version_len);
+        p = put_string(p, line + 8, line_len - 8);
+    }
+    for (node_t *header = res->headers; header != NULL; header = header->next)
+    {
+        if (header->key == NULL || header->value == NULL)
+            continue;
+        p = put_string(p, header->key, strlen(header->key));
+        p = put_string(p, ": ", 2);
+        p = put_string(p, header->value, strlen(header->value));
+        p = put_string(p, "\r\n", 2);
+    }
+    if (is_chunked)
+        p = put_string(p, chunked, sizeof(chunked) - 1);
+    p = put_string(p, "\r\n", 2);
+    if (inline_body != NULL)
+        put_string(p, inline_body, inline_len);
+
+    out_segment_t *segments = create_segment(head, head_len + inline_len, size);
+    if (segments == NULL)
+    {
+        put_buffer(head, size);
+        return NULL;
+    }
+    if (res->head_only || inline_body != NULL)
+    {
+        //the body stays in the response and is dropped with it
+    }
+    else if (res->stream != NULL)
+    {
+        if ((segments->next = create_stream_segment(res->stream)) == NULL)
+        {
+            free_output(segments);
+            return NULL;
+        }
+        res->stream = NULL; //pulled by the output from now on
+    }
+    else if (res->file_fd >= 0 && res->body_len > 0)
+    {
+        if ((segments->next = create_file_segment(res->file_fd, 0, res->body_len)) == NULL)
+        {
+            free_output(segments);
+            return NULL;
+        }
+        res->file_fd = -1; //owned by the output from now on
+        res->body_len = 0;
+    }
+    else if (res->file != NULL && res->body_len > 0)
+    {
+        if ((segments->next = create_segment((char *)file_data, res->body_len, 0)) == NULL)
+        {
+            free_output(segments);
+            return NULL;
+        }
+        segments->next->release = release_cached_file;
+        segments->next->owner = res->file; //the reference is held until the file is sent
+        res->file = NULL;
+        res->body_len = 0;
+    }
+    else if (res->body != NULL && res->body_len > 0)
+    {
+        if ((segments->next = create_segment(res->body, res->body_len, 0)) == NULL)
+        {
+            free_output(segments);
+            return NULL;
+        }
+        res->body = NULL; //owned by the output from now on
+        res->body_len = 0;
+    }
+    return segments;
+}
+
+/**
+ * Send a response to a client
+ * The serialized response is queued on the client and sent by flush_client.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the response was queued successfully, -1 otherwise
+*/
+int send_response(client_t *client)
+{
+    out_segment_t *response = serialize(client->res);
+    if (response == NULL)
+        return -1;
+    queue_segments(client, response);
+    return 0;
+}
+
+/**
+ * Replace the response of a client with an error response
+ * 
+ * @param client a pointer to the client_t struct
+ * @param status status code
+ * @param message error message
+ * @return 0 if the error response was set, -1 otherwise
+*/
+static int set_error(client_t *client, int status, char *message)
+{
+    response_t *res = init_response();
+    if (res == NULL)
+        return -1;
+    res->head_only = client->res->head_only;
+    free_response(client->res);
+    client->res = res;
+    set_status_res(res, status);
+    add_body_res(res, message);
+    add_header(&(res->headers), "Content-Type", "text/plain");
+    return 0;
+}
+
+/**
+ * Check whether a comma separated header value contains a token, without case
+ * 
+ * @param list the value of the header
+ * @param token the token to look for
+ * @return 1 if the token is in the list, 0 otherwise
+*/
+static int has_token(const char *list, const char *token)
+{
+    size_t len = strlen(token);
+    while (*list != '\0')
+    {
+        while (*list == ' ' || *list == '\t' || *list == ',')
+            list++;
+        const char *end = list;
+        while (*end != '\0' && *end != ',')
+            end++;
+        const char *last = end;
+        while (last > list && (last[-1] == ' ' || last[-1] == '\t'))
+            last--;
+        if ((size_t)(last - list) == len && strncasecmp(list, token, len) == 0)
+            return 1;
+        list = end;
+    }
+    return 0;
+}
+
+/**
+ * Decide whether the connection of a client stays open after the current request
+ * HTTP/1.1 connections are persistent unless the request says "Connection: close",
+ * HTTP/1.0 ones are closed unless it says "Connection: keep-alive". Either way a
+ * connection is closed after max_requests requests.
+ * 
+ * @param client a pointer to the client_t struct, with the head of the request parsed
+ * @return 1 if the connection is kept open, 0 otherwise
+*/
+static int wants_keep_alive(client_t *client)
+{
+    client->requests++;
+    if (client->max_requests > 0 && client->requests >= client->max_requests)
+        return 0;
+    const char *connection = get_known_header(client->req, HEADER_CONNECTION);
+    int persistent = client->req->version != NULL && strcmp(client->req->version, "1.1") >= 0;
+    if (connection == NULL)
+        return persistent;
+    if (has_token(connection, "close"))
+        return 0;
+    return persistent || has_token(connection, "keep-alive");
+}
+
+/**
+ * Tell the peer whether the connection stays open after the response
+ * A callback can close the connection itself by setting "Connection: close".
+ * 
+ * @param client a pointer to the client_t struct
+*/
+static void set_connection_header(client_t *client)
+{
+    response_t *res = client->res;
+    const char *connection = get_header(res->headers, "Connection");
+    if (connection != NULL)
+    {
+        if (has_token(connection, "close"))
+            client->keep_alive = 0;
+    }
+    else if (!client->keep_alive)
+        add_header(&(res->headers), "Connection", "close");
+    else if (client->req->version != NULL && strcmp(client->req->version, "1.0") == 0)
+        add_header(&(res->headers), "Connection", "keep-alive");
+}
+
+/**
+ * Send an error response to a client
+ * 
+ * @param client a pointer to the client_t struct
+ * @param status status code
+ * @param message error message
+ * @return 0 if the error response was queued successfully, -1 otherwise
+*/
+int send_error(client_t *client, int status, char *message)
+{
+    arena_t *previous = use_arena(&client->arena);
+    int result = -1;
+    if (set_error(client, status, message) == 0)
+    {
+        set_connection_header(client);
+        result = send_response(client);
+    }
+    use_arena(previous);
+    return result;
+}
+
+/**
+ * Grow the receive buffer of a client
+ * The buffer only moves while the head is parsed: the slices of the parser move with it
+ * and the request does not point into it yet.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param size the capacity needed, NUL terminator included
+ * @return 0 if the buffer is large enough, -1 otherwise
+*/
+static int grow_request(client_t *client, size_t size)
+{
+    if (client->request_size >= size)
+        return 0;
+    size_t capacity = client->request_size == 0 ? POOL_BUFFER_SIZE : client->request_size;
+    while (capacity < size)
+        capacity *= 2;
+    if (capacity > client->max_request + 1)
+        capacity = client->max_request + 1;
+    char *request = get_buffer(capacity > size ? capacity : size, &capacity);
+    if (request == NULL)
+        return -1;
+    if (client->request != NULL)
+    {
+        memcpy(request, client->request, client->request_len + 1);
+        rebase_parser(&client->parser, client->request, request);
+        put_buffer(client->request, client->request_size);
+    }
+    else
+        request[0] = '\0';
+    client->request = request;
+    client->request_size = capacity;
+    return 0;
+}
+
+/**
+ * Refuse a request that cannot be parsed
+ * Where the request ends is unknown, so the connection is closed after the error.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param status status code
+ * @param message error message
+*/
+static void reject(client_t *client, int status, char *message)
+{
+    client->keep_alive = 0;
+    send_error(client, status, message);
+}
+
+/**
+ * Parse the head of a request
+ * The parser resumes where the previous call stopped, the request line and the headers
+ * are left in place in the receive buffer and the request points at them. The room for
+ * the body is reserved before, so that the buffer does not move anymore: all of it for a
+ * Content-Length body that is buffered, the room of the next reads for a chunked body or
+ * one read by the body callback of the route.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 1 if the head was parsed, 0 if more data is needed, -1 if an error response was queued
+*/
+int handle_head(client_t *client)
+{
+    http_parser_t *parser = &client->parser;
+    int result = parse_request(parser, client->request, client->request_len);
+    if (result == 0)
+    {
+        if (client->request_len >= client->max_request)
+        {
+            reject(client, 431, "Request Header Fields Too Large");
+            return -1;
+        }
+        client->state = parser->state == PARSE_FIRST_LINE ? STATE_FIRST_LINE : STATE_HEADERS;
+        return 0;
+    }
+    if (result < 0)
+    {
+        if (result == -2)
+            reject(client, 431, "Request Header Fields Too Large");
+        else if (result == -3)
+            reject(client, 501, "Not Implemented");
+        else if (result == -4)
+            reject(client, 505, "HTTP Version Not Supported");
+        else
+            reject(client, 400, "Bad Request");
+        return -1;
+    }
+    client->on_body = NULL;
+    if (parser->chunked || parser->content_length > 0)
+        client->on_body = find_body_route(parse_method(parser->method.data, parser->method.len), parsed_path(parser));
+    size_t room = parser->content_length;
+    if (parser->chunked || client->on_body != NULL)
+        room = BUFFER_SIZE;
+    else if (parser->content_length > client->max_request - parser->head_len)
+    {
+        reject(client, 413, "Request Entity Too Large");
+        return -1;
+    }
+    if (grow_request(client, parser->head_len + room + 1) < 0)
+    {
+        reject(client, 500, "Internal Server Error");
+        return -1;
+    }
+    if (fill_request(client->req, parser) < 0)
+    {
+        reject(client, 400, "Bad Request");
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * Parse the body of a request
+ * 
+ * @param client a pointer to the client_t struct
+ * @param body the body, preceded by one more byte that can be written, NUL terminated
+ *             when the byte after it is free
+ * @param len the length of the body
+ * @return 0 if the body was parsed successfully, -1 otherwise
+*/
+int handle_body(client_t *client, char *body, size_t len)
+{
+    if (parse_body(client->req, body, len) < 0)
+    {
+        reject(client, 400, "Bad Request");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Refuse a request with the status returned by a body callback
+ * 
+ * @param client a pointer to the client_t struct
+ * @param status the status, 400 is sent instead of one that is not an error
+*/
+static void refuse_body(client_t *client, int status)
+{
+    size_t len;
+    const char *line = status >= 400 && status < 600 ? status_line(status, &len) : NULL;
+    if (line == NULL)
+    {
+        status = 400;
+        line = status_line(status, &len);
+    }
+    //the reason phrase follows "HTTP/1.1 xxx " and ends with the line
+    char message[64];
+    snprintf(message, sizeof(message), "%.*s", (int)(len - 15), line + 13);
+    reject(client, status, message);
+}
+
+/**
+ * Grow the buffer of the chunked body of a client
+ * The body starts after the first byte of the buffer, which is left for parse_body, and
+ * is followed by one more byte for its NUL.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param size the capacity needed
+ * @return 0 if the buffer is large enough, -1 otherwise
+*/
+static int grow_body(client_t *client, size_t size)
+{
+    if (client->body_size >= size)
+        return 0;
+    size_t capacity = client->body_size == 0 ? POOL_BUFFER_SIZE : client->body_size;
+    while (capacity < size)
+        capacity *= 2;
+    char *body = get_buffer(capacity, &capacity);
+    if (body == NULL)
+        return -1;
+    if (client->body != NULL)
+    {
+        memcpy(body + 1, client->body + 1, client->body_len);
+        put_buffer(client->body, client->body_size);
+    }
+    client->body = body;
+    client->body_size = capacity;
+    return 0;
+}
+
+/**
+ * Take a fragment of the body of a request
+ * The fragment goes to the body callback of the route or, when the route has none, after
+ * the chunks decoded so far: the whole body is parsed once it has ended.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param data the fragment
+ * @param len the length of the fragment
+ * @return 0 on success, -1 if an error response was queued
+*/
+static int take_body(client_t *client, const char *data, size_t len)
+{
+    if (client->on_body != NULL)
+    {
+        int status = client->on_body(client->req, data, len);
+        if (status != 0)
+        {
+            refuse_body(client, status);
+            return -1;
+        }
+        client->req->body.len += len;
+        return 0;
+    }
+    if (len > client->max_request - client->parser.head_len - client->body_len)
+    {
+        reject(client, 413, "Request Entity Too Large");
+        return -1;
+    }
+    if (grow_body(client, 1 + client->body_len + len + 1) < 0)
+    {
+        reject(client, 500, "Internal Server Error");
+        return -1;
+    }
+    memcpy(client->body + 1 + client->body_len, data, len);
+    client->body_len += len;
+    client->body[1 + client->body_len] = '\0';
+    return 0;
+}
+
+/**
+ * Read the body of a request as it arrives
+ * The bytes received after the head are decoded and taken by take_body, then dropped, so
+ * that the next reads reuse the same room of the receive buffer. What follows the end of
+ * the body is left for the next request.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 1 if the body has ended, 0 if more data is needed, -1 if an error response was queued
+*/
+static int read_request_body(client_t *client)
+{
+    size_t head_len = client->parser.head_len;
+    char *received = client->request + head_len;
+    size_t len = client->request_len - head_len;
+    size_t pos = 0;
+    while (pos < len && client->reader.state != BODY_DONE)
+    {
+        slice_t data;
+        ssize_t n = read_body(&client->reader, received + pos, len - pos, &data);
+        if (n < 0)
+        {
+            reject(client, 400, "Bad Request");
+            return -1;
+        }
+        pos += n;
+        if (data.len > 0 && take_body(client, data.data, data.len) < 0)
+            return -1;
+    }
+    if (client->reader.state == BODY_DONE)
+    {
+        client->consumed = head_len + pos;
+        return 1;
+    }
+    client->request_len = head_len;
+    client->request[head_len] = '\0';
+    return 0;
+}
+
+/**
+ * Handle a response
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the response was handled successfully, -1 otherwise
+*/
+int handle_response(client_t *client)
+{
+    char *path = client->req->path;
+    http_method_t method = client->req->method_id;
+    callback cb = find_route(method, path, client->req);
+    //a body streamed to HTTP/1.0 ends with the connection instead of a last chunk
+    client->res->no_chunked = client->req->version == NULL || strcmp(client->req->version, "1.1") < 0;
+    client->res->encodings = accepted_encodings(get_known_header(client->req, HEADER_ACCEPT_ENCODING));
+    //the body of an answer to HEAD is left out when serializing, whichever route produces it
+    if (method == METHOD_HEAD)
+        client->res->head_only = 1;
+    //files attached to the response are checked against the validators before they are attached
+    if (method == METHOD_GET || method == METHOD_HEAD)
+    {
+        client->res->if_none_match = get_known_header(client->req, HEADER_IF_NONE_MATCH);
+        client->res->if_modified_since = get_known_header(client->req, HEADER_IF_MODIFIED_SINCE);
+    }
+    if (cb == NULL && method == METHOD_HEAD)
+    {
+        //HEAD is answered like GET
+        method = METHOD_GET;
+        cb = find_route(method, path, client->req);
+    }
+    if (cb == NULL)
+    {
+        //static files are served without a route callback
+        if (method == METHOD_GET && serve_static(client->res, path) == 0)
+            return 0;
+        set_error(client, 404, "Not Found");
+        return -1;
+    }
+    cb(client->req, client->res);
+    return 0;
+}
+
+/**
+ * Elaborate the response of a client
+ * This function runs the route callback and serializes the response. It only touches the
+ * request and response of the client, so it can run on a worker thread while the owner of
+ * the connection keeps receiving and sending.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the segments of the serialized response or NULL if an error occurred
+*/
+out_segment_t *elaborate_response(client_t *client)
+{
+    //the callback allocates from the arena of the client, on whichever thread it runs
+    arena_t *previous = use_arena(&client->arena);
+    if (handle_response(client) < 0)
+        perror("[-]Error handling response");
+    if (client->res->stream != NULL && client->res->stream->raw && !client->res->head_only)
+        client->keep_alive = 0;
+    //files are checked when they are attached, this catches the bodies built by the callback,
+    //a 304 leaves nothing to compress or send
+    check_not_modified(client->req, client->res);
+    if (compress_response(client->res) < 0)
+        perror("[-]Error compressing response");
+    set_connection_header(client);
+    out_segment_t *response = serialize(client->res);
+    use_arena(previous);
+    return response;
+}
+
+/**
+ * Queue a response produced by elaborate_response
+ * The response goes after the ones already queued, pipelined responses are gathered by
+ * the next flush_client into a single write.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param response the segments of the serialized response, NULL if it could not be produced
+*/
+static void queue_response(client_t *client, out_segment_t *response)
+{
+    if (response == NULL)
+        send_error(client, 500, "Internal Server Error");
+    else
+        queue_segments(client, response);
+    client->state = STATE_RESET;
+}
+
+/**
+ * Move to the next request of a client
+ * The bytes received after the current request are the start of the next one: they are
+ * moved to the front of the receive buffer and parsed right away. The rest of the data is
+ * dropped after an error, the end of the failed request is unknown.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 on success, -1 if the request or the response could not be allocated
+*/
+static int next_request(client_t *client)
+{
+    free_request(client->req);
+    free_response(client->res);
+    reset_arena(&client->arena);
+    client->req = init_request();
+    client->res = init_response();
+    if (client->req == NULL || client->res == NULL)
+        return -1;
+    size_t consumed = client->consumed < client->request_len ? client->consumed : client->request_len;
+    size_t left = client->request_len - consumed;
+    if (left > 0)
+        memmove(client->request, client->request + consumed, left + 1);
+    else
+    {
+        //an idle connection keeps no receive buffer, nor the arena of a large request
+        trim_arena(&client->arena, client->arena_keep);
+        put_buffer(client->request, client->request_size);
+        client->request = NULL;
+        client->request_size = 0;
+    }
+    client->request_len = left;
+    client->consumed = 0;
+    client->request_start = 0;
+    put_buffer(client->body, client->body_size);
+    client->body = NULL;
+    client->body_len = 0;
+    client->body_size = 0;
+    client->on_body = NULL;
+    init_parser(&client->parser);
+    client->state = STATE_FIRST_LINE;
+    return 0;
+}
+
+/**
+ * Complete the response of a client
+ * This function queues a response produced by elaborate_response, resets the parse states
+ * and processes the data received in the meantime.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param response the segments of the serialized response, NULL if it could not be produced
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+int complete_response(client_t *client, out_segment_t *response)
+{
+    queue_response(client, response);
+    return process_client(client);
+}
+
+/**
+ * Make room for received data
+ * While the head is parsed the receive buffer grows up to the request limit. Once the
+ * request points into it the buffer keeps the room reserved for the body, what is left
+ * after the body waits for the next request.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the number of bytes that can be appended to the received data
+*/
+size_t reserve_input(client_t *client)
+{
+    if (client->state == STATE_FIRST_LINE || client->state == STATE_HEADERS)
+    {
+        size_t size = client->request_len + BUFFER_SIZE + 1;
+        if (size > client->max_request + 1)
+            size = client->max_request + 1;
+        if (grow_request(client, size) < 0)
+            return 0;
+    }
+    if (client->request == NULL)
+        return 0;
+    return client->request_size - client->request_len - 1;
+}
+
+/**
+ * Receive data from a client
+ * This function performs one recv into the room left by reserve_input, appending the
+ * bytes to the received data of the client, which is kept NUL terminated.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the number of bytes received, 0 if the peer closed the connection, -1 on error (errno is set, ENOBUFS if there is no room)
+*/
+ssize_t receive_client(client_t *client)
+{
+    size_t space = reserve_input(client);
+    if (space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t received = recv(client->client_fd, client->request + client->request_len, space, 0);
+    if (received > 0)
+    {
+        client->request_len += received;
+        client->request[client->request_len] = '\0';
+    }
+    return received;
+}
+
+/**
+ * Drop the received data of a client, keeping the buffer
+*/
+static void drop_input(client_t *client)
+{
+    client->request_len = 0;
+    if (client->request != NULL)
+        client->request[0] = '\0';
+}
+
+/**
+ * Drive the parse states of a client, with its arena selected
+ * 
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+static int drive_client(client_t *client)
+{
+    if (client->state == STATE_DRAIN)
+    {
+        //nothing is answered after the last response, what the peer still sends is dropped
+        drop_input(client);
+        return 0;
+    }
+    //one request per iteration, as long as pipelined requests are left in the buffer
+    while (client->state != STATE_PROCESSING) //a worker owns the request until complete_response
+    {
+        if ((client->state == STATE_FIRST_LINE || client->state == STATE_HEADERS) && client->request_len > 0)
+        {
+            int result = handle_head(client);
+            if (result < 0)
+            {
+                client->consumed = client->request_len;
+                client->state = STATE_RESET;
+            }
+            else if (result > 0)
+            {
+                client->keep_alive = wants_keep_alive(client);
+                if (client->parser.chunked || client->on_body != NULL)
+                {
+                    //consumed is known once the body has ended
+                    init_body_reader(&client->reader, client->parser.chunked, client->parser.content_length);
+                    client->state = STATE_BODY;
+                }
+                else
+                {
+                    client->consumed = client->parser.head_len + client->parser.content_length;
+                    client->state = client->parser.content_length > 0 ? STATE_BODY : STATE_ELABORATE_RESPONSE;
+                }
+            }
+        }
+        if (client->state == STATE_BODY && (client->parser.chunked || client->on_body != NULL))
+        {
+            int result = read_request_body(client);
+            if (result > 0 && client->on_body == NULL && client->body_len > 0 && handle_body(client, client->body + 1, client->body_len) < 0)
+                result = -1;
+            if (result > 0)
+                client->state = STATE_ELABORATE_RESPONSE;
+            else if (result < 0)
+            {
+                client->consumed = client->request_len;
+                client->state = STATE_RESET;
+            }
+        }
+        else if (client->state == STATE_BODY)
+        {
+            size_t received = client->request_len - client->parser.head_len;
+            if (received >= client->parser.content_length)
+            {
+                //the received bytes are NUL terminated, so is the body unless a pipelined
+                //request follows it
+                if (handle_body(client, client->request + client->parser.head_len, client->parser.content_length) < 0)
+                {
+                    client->consumed = client->request_len;
+                    client->state = STATE_RESET;
+                }
+                else
+                    client->state = STATE_ELABORATE_RESPONSE;
+            }
+        }
+        if (client->state == STATE_ELABORATE_RESPONSE)
+        {
+            if (client->dispatch != NULL)
+            {
+                client->state = STATE_PROCESSING;
+                if (client->dispatch(client) == 0)
+                    return 0;
+                //all the worker queues are full
+                send_error(client, 503, "Service Unavailable");
+                client->state = STATE_RESET;
+            }
+            else
+                queue_response(client, elaborate_response(client));
+        }
+        if (client->state != STATE_RESET)
+            return 0; //waiting for more data
+        if (!client->keep_alive)
+        {
+            client->state = STATE_DRAIN;
+            drop_input(client);
+            return 0;
+        }
+        if (next_request(client) < 0)
+            return -1;
+        if (client->request_len == 0)
+            return 0;
+    }
+    return 0;
+}
+
+/**
+ * Process the received data of a client
+ * This function drives the parse states of the client over the bytes received so far.
+ * It never blocks: it consumes what is available, queues the responses on the client
+ * and returns, the caller receives more data and flushes the output.
+ * When the client has a dispatch function the route callback is handed to it and the
+ * client stays in STATE_PROCESSING until complete_response.
+ * Everything the request and the response allocate comes from the arena of the client,
+ * which is reset in one step once the response is queued.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+int process_client(client_t *client)
+{
+    arena_t *previous = use_arena(&client->arena);
+    int result = drive_client(client);
+    use_arena(previous);
+    return result;
+}
+
+/**
+ * Update the deadline of a client
+ * The timeout depends on what the connection is waiting for: the head of a request must
+ * arrive within the header timeout of its first byte, the body must keep arriving within
+ * the body timeout of the previous read and otherwise the connection may stay idle for the
+ * idle timeout, also while the peer is reading the output. Nothing times out while a
+ * worker runs the callback.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param now the current time in milliseconds, see monotonic_ms
+ * @return the time in milliseconds at which the connection times out, 0 if it does not
+*/
+uint64_t update_deadline(client_t *client, uint64_t now)
+{
+    unsigned timeout;
+    uint64_t from = now;
+    switch (client->state)
+    {
+        case STATE_PROCESSING:
+            return 0;
+        case STATE_FIRST_LINE:
+        case STATE_HEADERS:
+            if (client->request_len == 0)
+            {
+                timeout = client->timeouts.idle;
+                break;
+            }
+            if (client->request_start == 0)
+                client->request_start = now;
+            timeout = client->timeouts.header;
+            from = client->request_start;
+            break;
+        case STATE_BODY:
+            timeout = client->timeouts.body;
+            break;
+        default:
+            timeout = client->timeouts.idle;
+            break;
+    }
+    return timeout > 0 ? from + timeout : 0;
+}
+
+/**
+ * Check whether a client is done
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 1 if the last response of a connection that is not kept open has been sent, 0 otherwise
+*/
+int is_drained(client_t *client)
+{
+    return client->state == STATE_DRAIN && client->out == NULL;
+}
\ No newline at end of file
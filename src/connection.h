@@ -0,0 +1,151 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/connection.h
+ * @brief provides the per-connection request state machine shared by the server backends
+*/
+
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include "client.h"
+#include <sys/types.h>
+
+#define BUFFER_SIZE 2000     // room made for each recv while the head is parsed
+#define MAX_SIZE 1048576     // default limit of a request, head and body
+#define INLINE_BODY_MAX 1024 // smaller bodies are copied after the head rather than sent as a segment of their own
+#define IDLE_TIMEOUT 5000    // default timeouts of a connection in milliseconds, see timeouts_t
+#define HEADER_TIMEOUT 10000
+#define BODY_TIMEOUT 30000
+#define MAX_KEEP_ALIVE_REQUESTS 1000 // default requests served on a connection before closing it
+#define ARENA_KEEP_SIZE 65536 // default largest arena chunk an idle connection keeps
+
+enum
+{
+    STATE_FIRST_LINE = 0,
+    STATE_HEADERS = 1,
+    STATE_BODY = 2,
+    STATE_ELABORATE_RESPONSE = 3,
+    STATE_RESET = 4,
+    STATE_PROCESSING = 5,   // the route callback runs on a worker
+    STATE_DRAIN = 6         // the last response is queued, the connection closes once it is sent
+};
+
+/**
+ * Serialize a response_t struct to output segments
+ * The status line and the headers are written into a buffer from the pool, sized exactly,
+ * and the body follows as a segment of its own that takes over res->body, res->file_fd
+ * to be sent with sendfile, the cached res->file or the stream res->stream, so a large
+ * body is never copied and may contain NUL bytes. Bodies up to INLINE_BODY_MAX bytes are
+ * copied after the head instead, so that small pipelined responses can share a buffer.
+ * Responses to HEAD keep their body and only send the head.
+ * 
+ * @param res response_t struct
+ * @return the segments of the response or NULL if an error occurred
+*/
+extern out_segment_t *serialize(response_t *res);
+
+/**
+ * Send a response to a client
+ * The serialized response is queued on the client and sent by flush_client.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the response was queued successfully, -1 otherwise
+*/
+extern int send_response(client_t *client);
+
+/**
+ * Send an error response to a client
+ * 
+ * @param client a pointer to the client_t struct
+ * @param status status code
+ * @param message error message
+ * @return 0 if the error response was queued successfully, -1 otherwise
+*/
+extern int send_error(client_t *client, int status, char *message);
+
+/**
+ * Elaborate the response of a client
+ * This function runs the route callback and serializes the response. It only touches the
+ * request and response of the client, so it can run on a worker thread while the owner of
+ * the connection keeps receiving and sending.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the segments of the serialized response or NULL if an error occurred
+*/
+extern out_segment_t *elaborate_response(client_t *client);
+
+/**
+ * Complete the response of a client
+ * This function queues a response produced by elaborate_response, resets the parse states
+ * and processes the data received in the meantime.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param response the segments of the serialized response, NULL if it could not be produced
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+extern int complete_response(client_t *client, out_segment_t *response);
+
+/**
+ * Make room for received data
+ * While the head is parsed the receive buffer grows up to the request limit. Once the
+ * request points into it the buffer keeps the room reserved for the body, what is left
+ * after the body waits for the next request.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the number of bytes that can be appended to the received data
+*/
+extern size_t reserve_input(client_t *client);
+
+/**
+ * Receive data from a client
+ * This function performs one recv into the room left by reserve_input, appending the
+ * bytes to the received data of the client, which is kept NUL terminated.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return the number of bytes received, 0 if the peer closed the connection, -1 on error (errno is set, ENOBUFS if there is no room)
+*/
+extern ssize_t receive_client(client_t *client);
+
+/**
+ * Process the received data of a client
+ * This function drives the parse states of the client over the bytes received so far.
+ * It never blocks: it consumes what is available, queues the responses on the client
+ * and returns, the caller receives more data and flushes the output.
+ * When the client has a dispatch function the route callback is handed to it and the
+ * client stays in STATE_PROCESSING until complete_response.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+extern int process_client(client_t *client);
+
+/**
+ * Update the deadline of a client
+ * The timeout depends on what the connection is waiting for: the head of a request must
+ * arrive within the header timeout of its first byte, the body must keep arriving within
+ * the body timeout of the previous read and otherwise the connection may stay idle for the
+ * idle timeout, also while the peer is reading the output. Nothing times out while a
+ * worker runs the callback.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param now the current time in milliseconds, see monotonic_ms
+ * @return the time in milliseconds at which the connection times out, 0 if it does not
+*/
+extern uint64_t update_deadline(client_t *client, uint64_t now);
+
+/**
+ * Check whether a client is done
+ * A connection that is not kept open after its last response is in STATE_DRAIN, the
+ * backends close it once the output is sent.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 1 if the last response of a connection that is not kept open has been sent, 0 otherwise
+*/
+extern int is_drained(client_t *client);
+
+#endif // CONNECTION_H
\ No newline at end of file
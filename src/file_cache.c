@@ -0,0 +1,645 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/file_cache.c
+ * @brief implementation of file_cache.h
+*/
+
+#define _GNU_SOURCE
+
+#include "file_cache.h"
+#include "compress.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    file_entry_t *buckets[FILE_CACHE_BUCKETS];
+    file_entry_t *newest;
+    file_entry_t *oldest;
+    size_t used;
+} shard_t;
+
+// a directory watched by inotify
+typedef struct
+{
+    int wd;
+    char *path;
+} watch_t;
+
+static shard_t shards[FILE_CACHE_SHARDS];
+static size_t shard_capacity;
+static int enabled;
+
+static int inotify_fd = -1;
+static int stop_fd = -1;
+static pthread_t watcher;
+static watch_t *watches;
+static int n_watches;
+static int watches_size;
+static pthread_mutex_t watches_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long generation;    // incremented by every inotify event
+
+static const struct
+{
+    const char *extension;
+    const char *type;
+} mime_types[] = {
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"css", "text/css"},
+    {"js", "text/javascript"},
+    {"mjs", "text/javascript"},
+    {"json", "application/json"},
+    {"txt", "text/plain"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"mp3", "audio/mpeg"},
+};
+
+static const char *mime_type(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    const char *dot = strrchr(name != NULL ? name : path, '.');
+    if (dot != NULL)
+    {
+        for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++)
+        {
+            if (strcasecmp(dot + 1, mime_types[i].extension) == 0)
+                return mime_types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+/**
+ * Describe a file
+ * This function computes the headers of a file from its path and its stat.
+ * 
+ * @param path the path of the file, its extension selects the Content-Type
+ * @param st the stat of the file
+ * @param headers a pointer to the file_headers_t struct to fill
+*/
+void describe_file(const char *path, const struct stat *st, file_headers_t *headers)
+{
+    struct tm tm;
+    headers->content_type = mime_type(path);
+    //a strong tag: a rewrite changes the mtime, to the nanosecond, or the size
+    snprintf(headers->etag, sizeof(headers->etag), "\"%lx-%lx-%lx\"",
+             (unsigned long)st->st_mtim.tv_sec, (unsigned long)st->st_mtim.tv_nsec, (unsigned long)st->st_size);
+    gmtime_r(&st->st_mtime, &tm);
+    strftime(headers->last_modified, sizeof(headers->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *path != '\0'; path++)
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ULL;
+    return hash;
+}
+
+static time_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * Remove "//" and "/./" from a path, so that every spelling of a file maps to one entry
+ * 
+ * @return 0 on success, -1 if the path does not fit
+*/
+static int normalize_path(const char *path, char *key, size_t size)
+{
+    size_t n = 0;
+    while (*path != '\0')
+    {
+        if (n > 0 && key[n - 1] == '/' && (*path == '/' || (path[0] == '.' && path[1] == '/')))
+        {
+            path += *path == '/' ? 1 : 2;
+            continue;
+        }
+        if (n + 1 >= size)
+            return -1;
+        key[n++] = *path++;
+    }
+    key[n] = '\0';
+    return 0;
+}
+
+static file_entry_t **find_entry(shard_t *shard, uint64_t hash, const char *path)
+{
+    file_entry_t **link = &shard->buckets[(hash / FILE_CACHE_SHARDS) % FILE_CACHE_BUCKETS];
+    while (*link != NULL && strcmp((*link)->path, path) != 0)
+        link = &(*link)->next;
+    return link;
+}
+
+static void unlink_lru(shard_t *shard, file_entry_t *entry)
+{
+    if (entry->newer != NULL)
+        entry->newer->older = entry->older;
+    else
+        shard->newest = entry->older;
+    if (entry->older != NULL)
+        entry->older->newer = entry->newer;
+    else
+        shard->oldest = entry->newer;
+}
+
+static void push_lru(shard_t *shard, file_entry_t *entry)
+{
+    entry->newer = NULL;
+    entry->older = shard->newest;
+    if (shard->newest != NULL)
+        shard->newest->newer = entry;
+    shard->newest = entry;
+    if (shard->oldest == NULL)
+        shard->oldest = entry;
+}
+
+/**
+ * Take an entry out of its shard and drop the reference of the cache, with the shard locked
+*/
+static void remove_entry(shard_t *shard, file_entry_t **link)
+{
+    file_entry_t *entry = *link;
+    *link = entry->next;
+    unlink_lru(shard, entry);
+    shard->used -= entry->size + entry->gzip_size;
+    release_file(entry);
+}
+
+/**
+ * Release a file returned by get_file
+ * 
+ * @param entry a pointer to the file_entry_t struct
+*/
+void release_file(file_entry_t *entry)
+{
+    if (entry == NULL || __atomic_sub_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+    free(entry->path);
+    free(entry->data);
+    free(entry->gzip);
+    free(entry);
+}
+
+static void invalidate_path(const char *path)
+{
+    uint64_t hash = hash_path(path);
+    shard_t *shard = &shards[hash % FILE_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    file_entry_t **link = find_entry(shard, hash, path);
+    if (*link != NULL)
+        remove_entry(shard, link);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void drop_all()
+{
+    for (int i = 0; i < FILE_CACHE_SHARDS; i++)
+    {
+        shard_t *shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (int j = 0; j < FILE_CACHE_BUCKETS; j++)
+        {
+            while (shard->buckets[j] != NULL)
+                remove_entry(shard, &shard->buckets[j]);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+/**
+ * Watch the directory of a file, before reading it so that no change is missed
+ * 
+ * @return 0 if the directory is watched, -1 otherwise
+*/
+static int watch_directory(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char dir[PATH_MAX];
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash == path ? 1 : slash - path), path);
+
+    int result = 0;
+    pthread_mutex_lock(&watches_lock);
+    for (int i = 0; i < n_watches; i++)
+    {
+        if (strcmp(watches[i].path, dir) == 0)
+        {
+            pthread_mutex_unlock(&watches_lock);
+            return 0;
+        }
+    }
+    int wd = inotify_add_watch(inotify_fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+                               IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+    if (n_watches == watches_size)
+    {
+        int size = watches_size == 0 ? 16 : watches_size * 2;
+        watch_t *grown = (watch_t *)realloc(watches, size * sizeof(watch_t));
+        if (grown != NULL)
+        {
+            watches = grown;
+            watches_size = size;
+        }
+    }
+    char *copy = strdup(dir);
+    if (wd < 0 || n_watches == watches_size || copy == NULL)
+    {
+        free(copy);
+        result = -1;
+    }
+    else
+    {
+        watches[n_watches].wd = wd;
+        watches[n_watches].path = copy;
+        n_watches++;
+    }
+    pthread_mutex_unlock(&watches_lock);
+    return result;
+}
+
+/**
+ * Handle an inotify event: drop the entry of the file it names
+*/
+static void handle_event(const struct inotify_event *event)
+{
+    if ((event->mask & (IN_Q_OVERFLOW | IN_ISDIR)) || event->len == 0)
+    {
+        //events were lost, or a directory changed under cached paths
+        drop_all();
+    }
+    pthread_mutex_lock(&watches_lock);
+    for (int i = 0; i < n_watches; i++)
+    {
+        if (watches[i].wd != event->wd)
+            continue;
+        if (event->mask & IN_IGNORED)
+        {
+            //the directory is gone, the next file loaded from it watches it again
+            free(watches[i].path);
+            watches[i--] = watches[--n_watches];
+            continue;
+        }
+        if (event->len > 0)
+        {
+            char path[PATH_MAX];
+            int len = snprintf(path, sizeof(path), "%s/%s", watches[i].path, event->name);
+            invalidate_path(path);
+            //the gzip variant of a file comes from its ".gz" sibling
+            if (len > 3 && len < (int)sizeof(path) && strcmp(path + len - 3, ".gz") == 0)
+            {
+                path[len - 3] = '\0';
+                invalidate_path(path);
+            }
+        }
+    }
+    pthread_mutex_unlock(&watches_lock);
+}
+
+static void *watch_files(void *arg)
+{
+    (void)arg;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("[-]poll failed");
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+        ssize_t len = read(inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0)
+            continue;
+        __atomic_add_fetch(&generation, 1, __ATOMIC_ACQ_REL);
+        for (char *p = buffer; p < buffer + len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            handle_event(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Check whether an entry changed on disk, with its shard locked
+ * With inotify the watcher drops changed entries, otherwise the file is checked with stat
+ * once every FILE_CACHE_CHECK seconds.
+*/
+static int is_stale(file_entry_t *entry)
+{
+    if (inotify_fd >= 0)
+        return 0;
+    time_t t = now();
+    if (t - entry->checked < FILE_CACHE_CHECK)
+        return 0;
+    entry->checked = t;
+    struct stat st;
+    return stat(entry->path, &st) < 0 || (size_t)st.st_size != entry->size ||
+           st.st_mtim.tv_sec != entry->mtime.tv_sec || st.st_mtim.tv_nsec != entry->mtime.tv_nsec;
+}
+
+/**
+ * Open a file that is not served from the cache
+*/
+static int open_file(const char *path, struct stat *st)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, st) < 0 || !S_ISREG(st->st_mode))
+    {
+        close(fd);
+        errno = EISDIR;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Read a whole file
+ * 
+ * @return the content allocated with malloc or NULL if the file could not be read completely
+*/
+static char *read_file(int file, size_t size)
+{
+    char *data = (char *)malloc(size > 0 ? size : 1);
+    size_t n_read = 0;
+    while (data != NULL && n_read < size)
+    {
+        ssize_t n = pread(file, data + n_read, size - n_read, n_read);
+        if (n <= 0)
+            break;
+        n_read += n;
+    }
+    if (data != NULL && n_read < size)
+    {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * Give an entry its gzip variant, outside the lock of its shard
+ * A ".gz" sibling at least as recent as the file is taken as it is, otherwise a
+ * compressible file is compressed once. The variant is dropped if it is not smaller.
+ * 
+ * @param entry the entry, its data read
+ * @param path the path of the file
+ * @param st the stat of the file
+*/
+static void load_gzip(file_entry_t *entry, const char *path, const struct stat *st)
+{
+    char sibling[PATH_MAX];
+    struct stat gz;
+    int file = -1;
+    if (snprintf(sibling, sizeof(sibling), "%s.gz", path) < (int)sizeof(sibling))
+        file = open_file(sibling, &gz);
+    if (file >= 0)
+    {
+        if ((size_t)gz.st_size < entry->size && gz.st_mtime >= st->st_mtime && (entry->gzip = read_file(file, gz.st_size)) != NULL)
+        {
+            entry->gzip_size = gz.st_size;
+            file_headers_t headers;
+            describe_file(sibling, &gz, &headers);
+            snprintf(entry->gzip_etag, sizeof(entry->gzip_etag), "%s", headers.etag);
+        }
+        close(file);
+        return;
+    }
+    if (entry->size < COMPRESS_MIN_SIZE || !is_compressible(entry->headers.content_type))
+        return;
+    if (compress_buffer(entry->data, entry->size, ENCODING_GZIP, COMPRESS_LEVEL_CACHED, &entry->gzip, &entry->gzip_size) < 0)
+        return;
+    if (entry->gzip_size >= entry->size)
+    {
+        free(entry->gzip);
+        entry->gzip = NULL;
+        entry->gzip_size = 0;
+        return;
+    }
+    //the tag of the file with a suffix, like the variants compressed for each response
+    size_t len = strlen(entry->headers.etag);
+    snprintf(entry->gzip_etag, sizeof(entry->gzip_etag), "%.*s-gzip\"", (int)len - 1, entry->headers.etag);
+}
+
+/**
+ * Read a file and add it to its shard
+ * 
+ * @return the entry, NULL if the file is not cached
+*/
+static file_entry_t *load_file(shard_t *shard, uint64_t hash, const char *path, int *fd)
+{
+    unsigned long seen = __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+    int watched = inotify_fd < 0 || watch_directory(path) == 0;
+    struct stat st;
+    int file = open_file(path, &st);
+    if (file < 0)
+        return NULL;
+    if (!watched || (size_t)st.st_size > FILE_CACHE_MAX_ENTRY || (size_t)st.st_size > shard_capacity)
+    {
+        *fd = file;
+        return NULL;
+    }
+
+    file_entry_t *entry = (file_entry_t *)calloc(1, sizeof(file_entry_t));
+    char *data = read_file(file, st.st_size);
+    char *copy = strdup(path);
+    if (entry == NULL || data == NULL || copy == NULL)
+    {
+        //out of memory or truncated while read: let sendfile deal with it
+        free(entry);
+        free(data);
+        free(copy);
+        *fd = file;
+        return NULL;
+    }
+    close(file);
+    entry->path = copy;
+    entry->data = data;
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->checked = now();
+    entry->refs = 1;
+    describe_file(path, &st, &entry->headers);
+    load_gzip(entry, path, &st);
+
+    pthread_mutex_lock(&shard->lock);
+    if (__atomic_load_n(&generation, __ATOMIC_ACQUIRE) != seen)
+    {
+        //something changed while the file was read, serve it once without caching it
+        pthread_mutex_unlock(&shard->lock);
+        return entry;
+    }
+    file_entry_t **link = find_entry(shard, hash, path);
+    if (*link != NULL)
+    {
+        //loaded by another thread meanwhile
+        file_entry_t *existing = *link;
+        __atomic_add_fetch(&existing->refs, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&shard->lock);
+        release_file(entry);
+        return existing;
+    }
+    entry->refs = 2;
+    entry->next = NULL;
+    *link = entry;
+    push_lru(shard, entry);
+    shard->used += entry->size + entry->gzip_size;
+    while (shard->used > shard_capacity && shard->oldest != entry)
+    {
+        file_entry_t *oldest = shard->oldest;
+        remove_entry(shard, find_entry(shard, hash_path(oldest->path), oldest->path));
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+/**
+ * Get a file
+ * Files already in the cache are returned without touching the filesystem, the others are
+ * read and cached when they are not larger than FILE_CACHE_MAX_ENTRY.
+ * 
+ * @param path the path of the file
+ * @param fd set to the open file when it is not cached (too large or cache disabled), -1 otherwise
+ * @return the entry of the file, to be released with release_file
+ * @return NULL if the file is not cached or does not exist
+*/
+file_entry_t *get_file(const char *path, int *fd)
+{
+    char key[PATH_MAX];
+    struct stat st;
+    *fd = -1;
+    if (!enabled || normalize_path(path, key, sizeof(key)) < 0)
+    {
+        *fd = open_file(path, &st);
+        return NULL;
+    }
+
+    uint64_t hash = hash_path(key);
+    shard_t *shard = &shards[hash % FILE_CACHE_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    file_entry_t **link = find_entry(shard, hash, key);
+    if (*link != NULL && is_stale(*link))
+        remove_entry(shard, link);
+    file_entry_t *entry = *link;
+    if (entry != NULL)
+    {
+        unlink_lru(shard, entry);
+        push_lru(shard, entry);
+        __atomic_add_fetch(&entry->refs, 1, __ATOMIC_ACQ_REL);
+        pthread_mutex_unlock(&shard->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return load_file(shard, hash, key, fd);
+}
+
+/**
+ * Initialize the file cache
+ * The cache starts a thread watching the directories of the cached files with inotify.
+ * Without inotify the files are checked with stat at most once every FILE_CACHE_CHECK seconds.
+ * 
+ * @param capacity the maximum number of bytes of file content kept, 0 to disable the cache
+ * @return 0 on success, -1 if an error occurred
+*/
+int init_file_cache(size_t capacity)
+{
+    if (enabled || capacity == 0)
+        return 0;
+    for (int i = 0; i < FILE_CACHE_SHARDS; i++)
+    {
+        memset(&shards[i], 0, sizeof(shard_t));
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+    shard_capacity = capacity / FILE_CACHE_SHARDS;
+    generation = 0;
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (inotify_fd < 0 || stop_fd < 0 || pthread_create(&watcher, NULL, watch_files, NULL) != 0)
+    {
+        perror("[-]inotify unavailable, checking files with stat");
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+        if (stop_fd >= 0)
+            close(stop_fd);
+        inotify_fd = -1;
+        stop_fd = -1;
+    }
+    enabled = 1;
+    return 0;
+}
+
+/**
+ * Free the file cache
+ * This function stops the inotify thread and drops the cached files, files still being
+ * sent are freed when their last response releases them.
+*/
+void free_file_cache()
+{
+    if (!enabled)
+        return;
+    if (inotify_fd >= 0)
+    {
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) < 0)
+            perror("[-]write failed");
+        pthread_join(watcher, NULL);
+        close(inotify_fd);
+        close(stop_fd);
+        inotify_fd = -1;
+        stop_fd = -1;
+    }
+    enabled = 0;
+    drop_all();
+    for (int i = 0; i < n_watches; i++)
+        free(watches[i].path);
+    free(watches);
+    watches = NULL;
+    n_watches = 0;
+    watches_size = 0;
+    for (int i = 0; i < FILE_CACHE_SHARDS; i++)
+        pthread_mutex_destroy(&shards[i].lock);
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/file_cache.h
+ * @brief provides a sharded LRU cache of static files and their headers, invalidated through inotify
+*/
+
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define FILE_CACHE_SIZE (32 * 1024 * 1024)  // default capacity of the cache
+#define FILE_CACHE_MAX_ENTRY (1024 * 1024)  // larger files are sent with sendfile
+#define FILE_CACHE_SHARDS 16
+#define FILE_CACHE_BUCKETS 64               // hash buckets of a shard
+#define FILE_CACHE_CHECK 1                  // seconds between mtime checks without inotify
+
+// headers describing a file, computed once when it is loaded
+typedef struct
+{
+    const char *content_type;
+    char etag[48];
+    char last_modified[32];
+} file_headers_t;
+
+typedef struct file_entry_t
+{
+    struct file_entry_t *next;      // hash chain of the shard
+    struct file_entry_t *newer;     // LRU list of the shard
+    struct file_entry_t *older;
+    char *path;
+    char *data;
+    size_t size;
+    char *gzip;                     // gzip variant, read from a ".gz" sibling or compressed once, NULL if none
+    size_t gzip_size;
+    char gzip_etag[56];
+    struct timespec mtime;
+    time_t checked;                 // last mtime check, without inotify
+    int refs;                       // one for the cache, one for each response sending the file
+    file_headers_t headers;
+} file_entry_t;
+
+/**
+ * Initialize the file cache
+ * The cache starts a thread watching the directories of the cached files with inotify.
+ * Without inotify the files are checked with stat at most once every FILE_CACHE_CHECK seconds.
+ * 
+ * @param capacity the maximum number of bytes of file content kept, 0 to disable the cache
+ * @return 0 on success, -1 if an error occurred
+*/
+extern int init_file_cache(size_t capacity);
+
+/**
+ * Get a file
+ * Files already in the cache are returned without touching the filesystem, the others are
+ * read and cached when they are not larger than FILE_CACHE_MAX_ENTRY. A cached file also
+ * gets a gzip variant: its ".gz" sibling when there is one as recent as the file, or the
+ * file compressed once when its type is compressible.
+ * 
+ * @param path the path of the file
+ * @param fd set to the open file when it is not cached (too large or cache disabled), -1 otherwise
+ * @return the entry of the file, to be released with release_file
+ * @return NULL if the file is not cached or does not exist
+*/
+extern file_entry_t *get_file(const char *path, int *fd);
+
+/**
+ * Release a file returned by get_file
+ * 
+ * @param entry a pointer to the file_entry_t struct
+*/
+extern void release_file(file_entry_t *entry);
+
+/**
+ * Describe a file
+ * This function computes the headers of a file from its path and its stat.
+ * 
+ * @param path the path of the file, its extension selects the Content-Type
+ * @param st the stat of the file
+ * @param headers a pointer to the file_headers_t struct to fill
+*/
+extern void describe_file(const char *path, const struct stat *st, file_headers_t *headers);
+
+/**
+ * Free the file cache
+ * This function stops the inotify thread and drops the cached files, files still being
+ * sent are freed when their last response releases them.
+*/
+extern void free_file_cache();
+
+#endif // FILE_CACHE_H
\ No newline at end of file
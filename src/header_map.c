@@ -0,0 +1,160 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/header_map.c
+ * @brief implementation of header_map.h
+*/
+
+#include "header_map.h"
+#include <string.h>
+#include <strings.h>
+
+static const struct
+{
+    const char *name;
+    size_t len;
+} known_names[N_HEADER_IDS] = {
+    [HEADER_ACCEPT] = {"Accept", 6},
+    [HEADER_ACCEPT_ENCODING] = {"Accept-Encoding", 15},
+    [HEADER_AUTHORIZATION] = {"Authorization", 13},
+    [HEADER_CONNECTION] = {"Connection", 10},
+    [HEADER_CONTENT_ENCODING] = {"Content-Encoding", 16},
+    [HEADER_CONTENT_LENGTH] = {"Content-Length", 14},
+    [HEADER_CONTENT_TYPE] = {"Content-Type", 12},
+    [HEADER_COOKIE] = {"Cookie", 6},
+    [HEADER_EXPECT] = {"Expect", 6},
+    [HEADER_HOST] = {"Host", 4},
+    [HEADER_IF_MODIFIED_SINCE] = {"If-Modified-Since", 17},
+    [HEADER_IF_NONE_MATCH] = {"If-None-Match", 13},
+    [HEADER_KEEP_ALIVE] = {"Keep-Alive", 10},
+    [HEADER_RANGE] = {"Range", 5},
+    [HEADER_TRANSFER_ENCODING] = {"Transfer-Encoding", 17},
+    [HEADER_UPGRADE] = {"Upgrade", 7},
+    [HEADER_USER_AGENT] = {"User-Agent", 10},
+};
+
+/**
+ * Get the id of a header name
+ * 
+ * @param name the name of the header, compared without case
+ * @param len the length of the name
+ * @return the id of the header or HEADER_OTHER if it is not a well-known one
+*/
+header_id_t header_id(const char *name, size_t len)
+{
+    //the lengths rule out all the names but one or two, strncasecmp runs on those only
+    for (int id = HEADER_OTHER + 1; id < N_HEADER_IDS; id++)
+    {
+        if (known_names[id].len == len && strncasecmp(name, known_names[id].name, len) == 0)
+            return (header_id_t)id;
+    }
+    return HEADER_OTHER;
+}
+
+/**
+ * Get the name of a well-known header
+ * 
+ * @param id the id of the header
+ * @return the name of the header, NULL for HEADER_OTHER
+*/
+const char *header_name(header_id_t id)
+{
+    return id > HEADER_OTHER && id < N_HEADER_IDS ? known_names[id].name : NULL;
+}
+
+/**
+ * Hash a header name without case
+ * Setting bit 5 lowercases letters and leaves the other token characters distinct enough,
+ * the names are compared anyway.
+ * 
+ * @param key the NUL terminated name
+ * @return the hash
+*/
+static uint32_t hash_name(const char *key)
+{
+    //FNV-1a
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p != '\0'; p++)
+        hash = (hash ^ (*p | 0x20)) * 16777619u;
+    return hash;
+}
+
+/**
+ * Initialize a header map
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param nodes the array of the headers to index, at most HEADER_MAP_SLOTS / 2 of them
+*/
+void init_header_map(header_map_t *map, node_t *nodes)
+{
+    map->nodes = nodes;
+    memset(map->known, 0, sizeof(map->known));
+    memset(map->slots, 0, sizeof(map->slots));
+}
+
+/**
+ * Index a header
+ * Only the first header with a name is found, like a search of the list.
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param i the index of the header in the nodes of the map, its key must be NUL terminated
+ * @param id the id of the name of the header
+*/
+void index_header(header_map_t *map, size_t i, header_id_t id)
+{
+    if (id != HEADER_OTHER && map->known[id] == 0)
+        map->known[id] = (uint8_t)(i + 1);
+    const char *key = map->nodes[i].key;
+    uint32_t hash = hash_name(key);
+    uint8_t tag = (uint8_t)(hash >> 24);
+    size_t slot = hash & (HEADER_MAP_SLOTS - 1);
+    while (map->slots[slot] != 0)
+    {
+        //a repeated name keeps its first header
+        if (map->tags[slot] == tag && strcasecmp(map->nodes[map->slots[slot] - 1].key, key) == 0)
+            return;
+        slot = (slot + 1) & (HEADER_MAP_SLOTS - 1);
+    }
+    map->slots[slot] = (uint8_t)(i + 1);
+    map->tags[slot] = tag;
+}
+
+/**
+ * Find a header
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param key the name of the header, compared without case
+ * @return the node of the header or NULL if it is not found
+*/
+node_t *find_header(const header_map_t *map, const char *key)
+{
+    uint32_t hash = hash_name(key);
+    uint8_t tag = (uint8_t)(hash >> 24);
+    size_t slot = hash & (HEADER_MAP_SLOTS - 1);
+    while (map->slots[slot] != 0)
+    {
+        node_t *node = &map->nodes[map->slots[slot] - 1];
+        if (map->tags[slot] == tag && strcasecmp(node->key, key) == 0)
+            return node;
+        slot = (slot + 1) & (HEADER_MAP_SLOTS - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Find a well-known header
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param id the id of the header
+ * @return the node of the header or NULL if it is not found
+*/
+node_t *find_known_header(const header_map_t *map, header_id_t id)
+{
+    if (id <= HEADER_OTHER || id >= N_HEADER_IDS || map->known[id] == 0)
+        return NULL;
+    return &map->nodes[map->known[id] - 1];
+}
\ No newline at end of file
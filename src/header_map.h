@@ -0,0 +1,107 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/header_map.h
+ * @brief provides a case-insensitive hash index over the headers of a request
+*/
+
+#ifndef HEADER_MAP_H
+#define HEADER_MAP_H
+
+#include "linked_list.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEADER_MAP_SLOTS 128    // power of two, at least twice MAX_HEADERS
+
+// well-known headers, found without hashing their name
+typedef enum
+{
+    HEADER_OTHER,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_AUTHORIZATION,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_ENCODING,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_COOKIE,
+    HEADER_EXPECT,
+    HEADER_HOST,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_KEEP_ALIVE,
+    HEADER_RANGE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_UPGRADE,
+    HEADER_USER_AGENT,
+    N_HEADER_IDS
+} header_id_t;
+
+// open addressing table of the headers, 0 marks an empty slot and i + 1 the header nodes[i]
+typedef struct header_map_t
+{
+    node_t *nodes;
+    uint8_t known[N_HEADER_IDS];        // first header with each well-known name
+    uint8_t slots[HEADER_MAP_SLOTS];
+    uint8_t tags[HEADER_MAP_SLOTS];     // high byte of the hash of each slot, compared before the name
+} header_map_t;
+
+/**
+ * Get the id of a header name
+ * 
+ * @param name the name of the header, compared without case
+ * @param len the length of the name
+ * @return the id of the header or HEADER_OTHER if it is not a well-known one
+*/
+extern header_id_t header_id(const char *name, size_t len);
+
+/**
+ * Get the name of a well-known header
+ * 
+ * @param id the id of the header
+ * @return the name of the header, NULL for HEADER_OTHER
+*/
+extern const char *header_name(header_id_t id);
+
+/**
+ * Initialize a header map
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param nodes the array of the headers to index, at most HEADER_MAP_SLOTS / 2 of them
+*/
+extern void init_header_map(header_map_t *map, node_t *nodes);
+
+/**
+ * Index a header
+ * Only the first header with a name is found, like a search of the list.
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param i the index of the header in the nodes of the map, its key must be NUL terminated
+ * @param id the id of the name of the header
+*/
+extern void index_header(header_map_t *map, size_t i, header_id_t id);
+
+/**
+ * Find a header
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param key the name of the header, compared without case
+ * @return the node of the header or NULL if it is not found
+*/
+extern node_t *find_header(const header_map_t *map, const char *key);
+
+/**
+ * Find a well-known header
+ * 
+ * @param map a pointer to the header_map_t struct
+ * @param id the id of the header
+ * @return the node of the header or NULL if it is not found
+*/
+extern node_t *find_known_header(const header_map_t *map, header_id_t id);
+
+#endif // HEADER_MAP_H
\ No newline at end of file
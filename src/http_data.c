@@ -10,9 +10,22 @@
 */
 
 #include "http_data.h"
+#include "arena.h"
+#include "file_cache.h"
+#include "stream.h"
+#include "multipart.h"
+#include "compress.h"
+#include "scan.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <time.h>
 
 static char *public_path = NULL;
 
@@ -25,19 +38,29 @@ static char *public_path = NULL;
 */
 request_t *init_request()
 {
-    request_t *request = (request_t *)malloc(sizeof(request_t));
+    request_t *request = (request_t *)mem_alloc(sizeof(request_t));
     if (request == NULL)
     {
         perror("[-]Error malloc");
         return NULL;
     }
+    request->arena = current_arena();
     request->method = NULL;
+    request->method_id = METHOD_UNKNOWN;
     request->path = NULL;
     request->version = NULL;
     request->headers = NULL;
+    request->header_map = NULL;
     request->body.data = NULL;
+    request->body.len = 0;
     request->body.params = NULL;
     request->body.n_params = 0;
+    request->body.n_inline = 0;
+    request->body.blocks = NULL;
+    request->body.state = NULL;
+    request->body.json = NULL;
+    request->body.parts = NULL;
+    request->n_path_params = 0;
     return request;
 }
 
@@ -50,19 +73,48 @@ request_t *init_request()
 */
 response_t *init_response()
 {
-    response_t *response = (response_t *)malloc(sizeof(request_t));
+    response_t *response = (response_t *)mem_alloc(sizeof(response_t));
     if (response == NULL)
     {
         printf("[-]Error malloc");
         return NULL;
     }
+    response->arena = current_arena();
     response->version = NULL;
-    response->status_code = NULL;
+    response->status = 200;
     response->headers = NULL;
     response->body = NULL;
+    response->body_len = 0;
+    response->file_fd = -1;
+    response->file = NULL;
+    response->head_only = 0;
+    response->stream = NULL;
+    response->no_chunked = 0;
+    response->encodings = 0;
+    response->file_gzip = 0;
+    response->if_none_match = NULL;
+    response->if_modified_since = NULL;
     return response;
 }
 
+/**
+ * Drop the body of a response, whatever its kind
+*/
+static void clear_body(response_t *res)
+{
+    free(res->body);
+    res->body = NULL;
+    if (res->file_fd >= 0)
+        close(res->file_fd);
+    res->file_fd = -1;
+    release_file(res->file);
+    res->file = NULL;
+    res->file_gzip = 0;
+    free_stream(res->stream);
+    res->stream = NULL;
+    res->body_len = 0;
+}
+
 /**
  * Free a request_t struct
  * This function frees the memory allocated for a request_t struct.
@@ -71,17 +123,24 @@ response_t *init_response()
 */
 void free_request(request_t *req)
 {
-    if (req != NULL)
+    if (req == NULL)
+        return;
+    if (req->arena != NULL)
     {
-        free(req->method);
-        free(req->path);
-        free(req->version);
-        free_list(req->headers);
-        free(req->body.data);
-        free_list(req->body.params);
-        free(req); 
-        req = NULL;
+        release_parts(req->body.parts);
+        return;
+    }
+    //the params point into the buffer the request was parsed from, only their nodes are
+    //allocated: inline in the request or in blocks
+    while (req->body.blocks != NULL)
+    {
+        param_block_t *next = req->body.blocks->next;
+        free(req->body.blocks);
+        req->body.blocks = next;
     }
+    free(req->body.json); //the root is the start of the tape
+    free_parts(req->body.parts);
+    free(req);
 }
 
 /**
@@ -92,12 +151,13 @@ void free_request(request_t *req)
 */
 void free_response(response_t *res)
 {
-    if (res != NULL)
+    if (res == NULL)
+        return;
+    clear_body(res); //never allocated from the arena
+    if (res->arena == NULL)
     {
         free(res->version);
-        free(res->status_code);
         free_list(res->headers);
-        free(res->body);
         free(res);
         res = NULL;
     }
@@ -115,10 +175,48 @@ void free_response(response_t *res)
 */
 char *get_header(node_t *headers, char *key)
 {
-    node_t *node = search_node(headers, key);
-    if (node == NULL)
-        return NULL;
-    return node->value;
+    for (node_t *node = headers; node != NULL; node = node->next)
+    {
+        if (node->key != NULL && strcasecmp(node->key, key) == 0)
+            return node->value;
+    }
+    return NULL;
+}
+
+/**
+ * Get a header of a request
+ * This function looks a header up in the hash index of the request, the name is compared
+ * without case.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param key the name of the header
+ * @return the value of the first header with that name or NULL if there is none
+*/
+char *get_request_header(request_t *req, const char *key)
+{
+    if (req->header_map == NULL)
+        return get_header(req->headers, (char *)key);
+    node_t *node = find_header(req->header_map, key);
+    return node != NULL ? node->value : NULL;
+}
+
+/**
+ * Get a well-known header of a request
+ * This function reads the header from a slot of its own in the index, without hashing.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param id the id of the header, like HEADER_CONTENT_TYPE
+ * @return the value of the first header with that name or NULL if there is none
+*/
+char *get_known_header(request_t *req, header_id_t id)
+{
+    if (req->header_map == NULL)
+    {
+        const char *name = header_name(id);
+        return name != NULL ? get_header(req->headers, (char *)name) : NULL;
+    }
+    node_t *node = find_known_header(req->header_map, id);
+    return node != NULL ? node->value : NULL;
 }
 
 /**
@@ -147,72 +245,613 @@ void add_param(node_t **params, char *key, char *value)
     insert_node(params, key, value);
 }
 
+/**
+ * Get the nodes for a block of params
+ * The nodes come from the inline params of the request while they last, a larger block is
+ * allocated at once and freed with the request. The caller links them into
+ * req->body.params.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param n the number of nodes
+ * @return the nodes or NULL if an error occurred
+*/
+node_t *param_nodes(request_t *req, size_t n)
+{
+    if (n <= MAX_INLINE_PARAMS - req->body.n_inline)
+    {
+        node_t *nodes = &req->body.inline_params[req->body.n_inline];
+        req->body.n_inline += n;
+        return nodes;
+    }
+    param_block_t *block = (param_block_t *)mem_alloc(sizeof(param_block_t) + n * sizeof(node_t));
+    if (block == NULL)
+    {
+        perror("[-]Error allocating params");
+        return NULL;
+    }
+    block->next = req->body.blocks;
+    req->body.blocks = block;
+    return block->nodes;
+}
+
+/**
+ * Add a body
+ * This function adds a body to a response_t struct.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param body the body to add
+*/
 void add_body_res(response_t *res, char *body)
 {
-    char *body_copy = (char *)malloc(strlen(body) + 1);
+    add_binary_body_res(res, body, strlen(body));
+}
+
+/**
+ * Add a binary body
+ * This function adds len bytes of data, which may contain NUL bytes, as the body of a response_t struct.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param body the body to add
+ * @param len the length of the body
+*/
+void add_binary_body_res(response_t *res, const char *body, size_t len)
+{
+    char *body_copy = (char *)malloc(len + 1);
     if (body_copy == NULL)
     {
         perror("[-]Error malloc");
         return;
     }
-    strcpy(body_copy, body);
+    memcpy(body_copy, body, len);
+    body_copy[len] = '\0';
+    clear_body(res);
     res->body = body_copy;
+    res->body_len = len;
+}
+
+/**
+ * Begin a streamed body
+ * This function turns the body of a response into a stream sent with "Transfer-Encoding:
+ * chunked" instead of a Content-Length, so the head goes out before the body is known.
+ * The route callback can write the first chunks right away, then cb is called for the
+ * next ones whenever the output drains, until end_stream. HTTP/1.0 clients get the body
+ * without chunk framing and the connection is closed after it.
+ * 
+ * @param res a pointer to the response_t struct, its previous body is dropped
+ * @param cb the callback producing the body, NULL if the route callback writes all of it
+ * @param arg the argument passed to cb
+ * @param free_arg releases arg once the stream is done or dropped, NULL if nothing is to be released
+ * @return the stream or NULL if an error occurred, arg is released then
+*/
+stream_t *begin_stream_res(response_t *res, stream_callback cb, void *arg, void (*free_arg)(void *arg))
+{
+    stream_t *stream = create_stream(cb, arg, free_arg);
+    if (stream == NULL)
+        return NULL;
+    clear_body(res);
+    stream->raw = res->no_chunked;
+    res->stream = stream;
+    return stream;
 }
 
+/**
+ * Get a parameter of the path
+ * This function returns a parameter captured by the route of a request, the "id" of
+ * "/users/:id", or "*" for a wildcard without a name. The value points into the path of
+ * the request and is not NUL terminated.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param name the name of the parameter
+ * @param len set to the length of the value
+ * @return the value of the parameter or NULL if the route has no such parameter
+*/
+const char *get_path_param(request_t *req, const char *name, size_t *len)
+{
+    for (size_t i = 0; i < req->n_path_params; i++)
+    {
+        if (strcmp(req->path_params[i].name, name) == 0)
+        {
+            *len = req->path_params[i].len;
+            return req->path_params[i].value;
+        }
+    }
+    *len = 0;
+    return NULL;
+}
+
+/**
+ * Set the public path
+ * This function sets the public path where the server will look for files.
+ * 
+ * @param path the public path
+*/
 void set_public_path(char *path)
 {
     public_path = path;
 }
 
+/**
+ * Add the headers describing a file, unless the callback already set them
+*/
+static void add_file_headers(response_t *res, const file_headers_t *headers)
+{
+    if (get_header(res->headers, "Content-Type") == NULL)
+        add_header(&(res->headers), "Content-Type", (char *)headers->content_type);
+    if (get_header(res->headers, "ETag") == NULL)
+        add_header(&(res->headers), "ETag", (char *)headers->etag);
+    if (get_header(res->headers, "Last-Modified") == NULL)
+        add_header(&(res->headers), "Last-Modified", (char *)headers->last_modified);
+}
+
+/**
+ * Open the ".gz" sibling of a file too large for the cache
+ * 
+ * @param path the path of the file
+ * @param st the stat of the file, replaced by the one of the sibling
+ * @return the sibling or -1 if there is none as recent as the file
+*/
+static int open_sibling(const char *path, struct stat *st)
+{
+    char sibling[PATH_MAX];
+    if (snprintf(sibling, sizeof(sibling), "%s.gz", path) >= (int)sizeof(sibling))
+        return -1;
+    int fd = open(sibling, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat gz;
+    if (fstat(fd, &gz) < 0 || !S_ISREG(gz.st_mode) || gz.st_mtime < st->st_mtime)
+    {
+        close(fd);
+        return -1;
+    }
+    *st = gz;
+    return fd;
+}
+
+/**
+ * Parse an HTTP date in the IMF-fixdate format, "Sun, 06 Nov 1994 08:49:37 GMT"
+ * 
+ * @return the time or -1 if the date is NULL or not valid
+*/
+static time_t parse_http_date(const char *date)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (date == NULL || sscanf(date, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &tm.tm_mday, month, &tm.tm_year,
+                               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        return -1;
+    const char *found = strlen(month) == 3 ? strstr(months, month) : NULL;
+    if (found == NULL || (found - months) % 3 != 0)
+        return -1;
+    tm.tm_mon = (found - months) / 3;
+    tm.tm_year -= 1900;
+    return timegm(&tm);
+}
+
+/**
+ * Compare an entity tag of If-None-Match with the ETag of a response
+ * The comparison is weak, the W/ prefixes are ignored. A tag with the suffix of the coding
+ * compress_response would pick also matches the tag it was made from.
+ * 
+ * @param tag the entity tag, not NUL terminated
+ * @param len the length of the tag
+ * @param etag the ETag of the response
+ * @param encodings the codings accepted by the client
+ * @return 1 if the tags match, 2 if they match through the suffix, 0 otherwise
+*/
+static int tag_matches(const char *tag, size_t len, const char *etag, int encodings)
+{
+    if (len >= 2 && tag[0] == 'W' && tag[1] == '/')
+    {
+        tag += 2;
+        len -= 2;
+    }
+    if (strncmp(etag, "W/", 2) == 0)
+        etag += 2;
+    size_t etag_len = strlen(etag);
+    if (len == etag_len && memcmp(tag, etag, len) == 0)
+        return 1;
+    //"abc-gzip" and "abc" share everything but the closing quote
+    if (etag_len < 2 || len <= etag_len || memcmp(tag, etag, etag_len - 1) != 0)
+        return 0;
+    const char *suffix = tag + etag_len - 1;
+    size_t suffix_len = len - etag_len + 1;
+    if (encodings & ENCODING_GZIP)
+        return suffix_len == 6 && memcmp(suffix, "-gzip\"", 6) == 0 ? 2 : 0;
+    if (encodings & ENCODING_DEFLATE)
+        return suffix_len == 9 && memcmp(suffix, "-deflate\"", 9) == 0 ? 2 : 0;
+    return 0;
+}
+
+/**
+ * Evaluate If-None-Match
+ * A tag matching through the suffix of a coding replaces the ETag of the response, the
+ * 304 names the variant the client holds.
+ * 
+ * @return 1 if a tag of the list matches the response or the list is "*", 0 otherwise
+*/
+static int none_match(const char *list, response_t *res)
+{
+    node_t *header = res->headers;
+    while (header != NULL && (header->key == NULL || strcasecmp(header->key, "ETag") != 0))
+        header = header->next;
+    const char *etag = header != NULL ? header->value : NULL;
+    const char *p = list;
+    while (*p != '\0')
+    {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            p++;
+        const char *tag = p;
+        if (p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if (*p == '"')
+        {
+            //a quoted tag may contain commas
+            const char *end = strchr(p + 1, '"');
+            p = end != NULL ? end + 1 : p + strlen(p);
+        }
+        else
+            p += strcspn(p, ", \t");
+        size_t len = p - tag;
+        if (len == 1 && *tag == '*')
+            return 1;
+        int match = len > 0 && etag != NULL ? tag_matches(tag, len, etag, res->encodings) : 0;
+        if (match == 2)
+        {
+            char *variant = (char *)mem_alloc(len + 1);
+            if (variant == NULL)
+            {
+                perror("[-]Error tagging variant");
+                return 0;
+            }
+            memcpy(variant, tag, len);
+            variant[len] = '\0';
+            arena_free(res->arena, header->value);
+            header->value = variant;
+        }
+        if (match != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Check the validators of a request against a response
+ * 
+ * @param list the If-None-Match of the request, NULL if none
+ * @param since the If-Modified-Since of the request, NULL if none
+ * @param res a pointer to the response_t struct
+ * @return 1 if the client's copy is still valid, 0 otherwise
+*/
+static int not_modified(const char *list, const char *since, response_t *res)
+{
+    if (list != NULL)
+        return none_match(list, res);
+    //If-Modified-Since is only evaluated without If-None-Match
+    time_t since_time = parse_http_date(since);
+    time_t last = parse_http_date(get_header(res->headers, "Last-Modified"));
+    return since_time >= 0 && last >= 0 && last <= since_time;
+}
+
+/**
+ * Answer with 304 Not Modified a file about to be attached to a response
+ * The validators are the ones the request stored in the response before the route
+ * callback, the headers describing the file must already be set.
+ * 
+ * @param res a pointer to the response_t struct
+ * @return 1 if the response became 304 Not Modified and the file is not to be attached, 0 otherwise
+*/
+static int file_not_modified(response_t *res)
+{
+    if (res->status != 200 || (res->if_none_match == NULL && res->if_modified_since == NULL))
+        return 0;
+    if (!not_modified(res->if_none_match, res->if_modified_since, res))
+        return 0;
+    res->status = 304;
+    return 1;
+}
+
+/**
+ * Set a file as the body of a response
+ * The gzip variant of the file is sent instead when the peer accepts it, see get_file.
+ * When the validators of the request still match the file the response becomes 304 Not
+ * Modified before the file is attached, its data is neither read nor sent.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param path the full path of the file
+ * @return 0 on success, -1 if the file does not exist or is not a regular file
+*/
+static int attach_file(response_t *res, const char *path)
+{
+    int fd;
+    file_entry_t *entry = get_file(path, &fd);
+    if (entry != NULL)
+    {
+        //served from memory, shared with the other responses sending it
+        clear_body(res);
+        int gzip = 0;
+        if (entry->gzip != NULL)
+        {
+            vary_encoding(res);
+            if (res->encodings & ENCODING_GZIP)
+            {
+                gzip = 1;
+                add_header(&(res->headers), "Content-Encoding", "gzip");
+                if (get_header(res->headers, "ETag") == NULL)
+                    add_header(&(res->headers), "ETag", entry->gzip_etag);
+            }
+        }
+        add_file_headers(res, &entry->headers);
+        if (file_not_modified(res))
+        {
+            release_file(entry);
+            return 0;
+        }
+        res->file = entry;
+        res->file_gzip = gzip;
+        res->body_len = gzip ? entry->gzip_size : entry->size;
+        return 0;
+    }
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        perror("[-]Error fstat");
+        close(fd);
+        return -1;
+    }
+    //too large for the cache: sent from the file with sendfile, never read here
+    file_headers_t headers;
+    describe_file(path, &st, &headers);
+    clear_body(res);
+    //the sibling is looked for either way, the response varies whenever there is one
+    struct stat gz = st;
+    int sibling = open_sibling(path, &gz);
+    if (sibling >= 0)
+        vary_encoding(res);
+    if (sibling >= 0 && !(res->encodings & ENCODING_GZIP))
+    {
+        close(sibling);
+        sibling = -1;
+    }
+    if (sibling >= 0)
+    {
+        close(fd);
+        fd = sibling;
+        st = gz;
+        const char *content_type = headers.content_type;
+        describe_file(path, &st, &headers); //the tag and the date of the sibling
+        headers.content_type = content_type;
+        add_header(&(res->headers), "Content-Encoding", "gzip");
+    }
+    add_file_headers(res, &headers);
+    if (file_not_modified(res))
+    {
+        close(fd);
+        return 0;
+    }
+    res->file_fd = fd;
+    res->body_len = st.st_size;
+    return 0;
+}
+
 //start path is public/static
+/**
+ * Add a file body
+ * This function sets a file as the body of a response_t struct, with its Content-Type,
+ * ETag and Last-Modified headers unless they are already set. Small files are served from
+ * the file cache, larger ones stay open until the response is sent with sendfile; body
+ * stays NULL in both cases.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param path the path of the file
+*/
 void add_file_body(response_t *res, char *file_name)
 {
-    char path [100];
-    sprintf(path, "%s/static/%s", public_path, file_name);
-    FILE *file = fopen(path, "r");
-    if (file == NULL)
-    {
+    char path [PATH_MAX];
+    snprintf(path, sizeof(path), "%s/static/%s", public_path, file_name);
+    if (attach_file(res, path) < 0)
         perror("[-]Error file is not found");
-        return;
+}
+
+/**
+ * Serve a static file
+ * This function resolves the path of a request under the static folder of the public path
+ * and sets the file as the body of a response_t struct like add_file_body. The path is
+ * percent-decoded, "." and ".." segments and hidden files are refused so that nothing
+ * outside the folder can be reached, and paths ending with '/' serve their index.html.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param path the path of the request
+ * @return 0 if the file was set as the body, -1 if there is no such file
+*/
+int serve_static(response_t *res, const char *request_path)
+{
+    if (public_path == NULL || request_path[0] != '/')
+        return -1;
+    char path [PATH_MAX];
+    int prefix = snprintf(path, sizeof(path), "%s/static", public_path);
+    if (prefix < 0 || (size_t)prefix >= sizeof(path))
+        return -1;
+
+    //decode into path segment by segment, checking each one once it is complete
+    char *p = path + prefix;
+    char *end = path + sizeof(path) - sizeof("index.html");
+    char *segment = p;
+    for (const char *s = request_path; ; s++)
+    {
+        if (*s == '/' || *s == '\0')
+        {
+            //refuse ".", ".." and hidden files, and empty segments inside the path
+            if (p > segment + 1 && segment[1] == '.')
+                return -1;
+            if (p == segment + 1 && *s == '/')
+                return -1;
+            if (*s == '\0')
+                break;
+            if (p >= end)
+                return -1;
+            segment = p;
+            *p++ = '/';
+            continue;
+        }
+        char c = *s;
+        if (c == '%')
+        {
+            int high = hex_value(s[1]);
+            int low = high < 0 ? -1 : hex_value(s[2]);
+            if (low < 0)
+                return -1;
+            c = (char)(high << 4 | low);
+            s += 2;
+            //an encoded separator or NUL would bypass the checks above
+            if (c == '/' || c == '\0')
+                return -1;
+        }
+        if (c == '\\' || p >= end)
+            return -1;
+        *p++ = c;
     }
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    char *body = (char *)malloc(size + 1);
-    if (body == NULL)
+    if (p[-1] == '/')
     {
-        perror("[-]Error malloc");
-        return;
+        memcpy(p, "index.html", 10);
+        p += 10;
     }
-    fread(body, 1, size, file);
-    fclose(file);
-    body[size] = '\0';
-    add_body_res(res, body);
-    free(body);
+    *p = '\0';
+    return attach_file(res, path);
 }
 
+/**
+ * Add a version
+ * This function adds a version to a response_t struct.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param version the version to add
+*/
 void add_version_res(response_t *res, char *version)
 {
-    char *version_copy = (char *)malloc(strlen(version) + 1);
+    char *version_copy = mem_strdup(version);
     if (version_copy == NULL)
     {
         perror("[-]Error malloc");
         return;
     }
-    strcpy(version_copy, version);
+    arena_free(res->arena, res->version);
     res->version = version_copy;
 }
 
+/**
+ * Add a status code
+ * This function adds a status code to a response_t struct. It is kept for compatibility,
+ * set_status_res does not need to parse it.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param status_code the status code to add, as a string of three digits
+*/
 void add_status_code_res(response_t *res, char *status_code)
 {
-    char *status_code_copy = (char *)malloc(strlen(status_code) + 1);
-    if (status_code_copy == NULL)
+    //anything but three digits is kept as an invalid status, refused when serializing
+    int status = 0;
+    if (strlen(status_code) == 3)
+        for (int i = 0; i < 3 && isdigit((unsigned char)status_code[i]); i++)
+            status = status * 10 + status_code[i] - '0';
+    if (status < 100)
+        status = 0;
+    res->status = status;
+}
+
+/**
+ * Set the status of a response
+ * This function sets the status code of a response_t struct, its status line is rendered
+ * from a precomputed table.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param status the status code, between 100 and 599
+*/
+void set_status_res(response_t *res, int status)
+{
+    res->status = status;
+}
+
+/**
+ * Answer a conditional request with 304 Not Modified
+ * This function evaluates If-None-Match against the ETag of a response_t struct, or
+ * If-Modified-Since against its Last-Modified when the request has no If-None-Match. If
+ * the client's copy is still valid, the body is dropped and the status set to 304. Only
+ * GET and HEAD requests answered with 200 are concerned. Files attached by add_file_body
+ * or the static handler are checked before they are attached, this runs after the
+ * route callback for the bodies it built; a callback can also call it once it has set the
+ * validators to skip building the body.
+ * 
+ * @param req the request
+ * @param res a pointer to the response_t struct
+ * @return 1 if the response became 304 Not Modified, 0 otherwise
+*/
+int check_not_modified(request_t *req, response_t *res)
+{
+    if ((req->method_id != METHOD_GET && req->method_id != METHOD_HEAD) || res->status != 200)
+        return 0;
+    if (!not_modified(get_known_header(req, HEADER_IF_NONE_MATCH), get_known_header(req, HEADER_IF_MODIFIED_SINCE), res))
+        return 0;
+    clear_body(res);
+    res->status = 304;
+    return 1;
+}
+
+static const char *method_names[] = {"GET", "POST", "PUT", "DELETE", "PATCH", "HEAD", "OPTIONS", "UNKNOWN"};
+
+/**
+ * Parse a method
+ * 
+ * @param method the method, not necessarily NUL terminated
+ * @param len the length of the method
+ * @return the method or METHOD_UNKNOWN if it is not supported
+*/
+http_method_t parse_method(const char *method, size_t len)
+{
+    //the length alone leaves at most two candidates
+    switch (len)
     {
-        perror("[-]Error malloc");
-        return;
+    case 3:
+        if (memcmp(method, "GET", 3) == 0)
+            return METHOD_GET;
+        if (memcmp(method, "PUT", 3) == 0)
+            return METHOD_PUT;
+        break;
+    case 4:
+        if (memcmp(method, "POST", 4) == 0)
+            return METHOD_POST;
+        if (memcmp(method, "HEAD", 4) == 0)
+            return METHOD_HEAD;
+        break;
+    case 5:
+        if (memcmp(method, "PATCH", 5) == 0)
+            return METHOD_PATCH;
+        break;
+    case 6:
+        if (memcmp(method, "DELETE", 6) == 0)
+            return METHOD_DELETE;
+        break;
+    case 7:
+        if (memcmp(method, "OPTIONS", 7) == 0)
+            return METHOD_OPTIONS;
+        break;
     }
-    strcpy(status_code_copy, status_code);
-    res->status_code = status_code_copy;
+    return METHOD_UNKNOWN;
+}
+
+/**
+ * Get the name of a method
+ * 
+ * @param method the method
+ * @return the name of the method, "UNKNOWN" for METHOD_UNKNOWN
+*/
+const char *method_name(http_method_t method)
+{
+    return method_names[method <= METHOD_UNKNOWN ? method : METHOD_UNKNOWN];
 }
 
 /**
@@ -237,7 +876,7 @@ void print_request (request_t *req)
     printf("n_params: %ld\n", req->body.n_params);
     printf("Params:\n");
     print_list(req->body.params);
-    printf("Data: %s\n", req->body.data);
+    printf("Data: %.*s\n", (int)req->body.len, req->body.data != NULL ? req->body.data : "");
 }
 
 /**
@@ -254,7 +893,7 @@ void print_response (response_t *res)
         return;
     }
     printf("Version: HTTP/%s\n", res->version);
-    printf("Status code: %s\n", res->status_code);
+    printf("Status code: %d\n", res->status);
     printf("Headers:\n");
     print_list(res->headers);
     printf("Body: %s\n", res->body);
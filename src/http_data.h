@@ -13,33 +13,123 @@
 #define HTTP_DATA_H
 
 #include "linked_list.h"
+#include "header_map.h"
 #include <stddef.h>
 
+#define MAX_PATH_PARAMS 8
+#define ENCODING_GZIP 1         // content codings of response bodies, see accepted_encodings
+#define ENCODING_DEFLATE 2
+#define MAX_INLINE_PARAMS 16    // query and form params stored in the request before an array is allocated
+
+typedef enum
+{
+    METHOD_GET,
+    METHOD_POST,
+    METHOD_PUT,
+    METHOD_DELETE,
+    METHOD_PATCH,
+    METHOD_HEAD,
+    METHOD_OPTIONS,
+    METHOD_UNKNOWN
+}http_method_t;
+
+// parameter captured from the path by a route like "/users/:id", see get_path_param
+typedef struct
+{
+    const char *name;
+    const char *value;      // points into the path, not NUL terminated
+    size_t len;
+}path_param_t;
+
+// params taken at once when the inline params of a request are used up, see param_nodes
+typedef struct param_block_t
+{
+    struct param_block_t *next;
+    node_t nodes[];
+}param_block_t;
+
 typedef struct 
 {
-    char *method;
+    char *method;       // method, path, version and headers point into the receive buffer
+    http_method_t method_id;
     char *path;
     char *version;
     node_t *headers;
+    header_map_t *header_map;   // index of the headers, NULL for a request built by hand
     struct
     {
-        char *data;
-        node_t *params;
+        char *data;         // the body where it was received, NUL terminated only if the byte after it is free, JSON, form and multipart bodies are decoded in place in it
+        size_t len;         // length of data, or the bytes handed to the body callback of the route so far
+        node_t *params;     // query and form params point into the receive buffer, decoded in place
         size_t n_params;
+        node_t inline_params[MAX_INLINE_PARAMS];
+        size_t n_inline;    // inline_params taken
+        param_block_t *blocks;  // the params that did not fit in inline_params
+        void *state;        // kept by the body callback of the route between fragments, NULL at first
+        struct json_t *json;    // parsed application/json body, see json.h, NULL if there is none
+        struct part_t *parts;   // parts of a multipart/form-data body, see multipart.h, NULL if there are none
     }body;
+    path_param_t path_params[MAX_PATH_PARAMS];
+    size_t n_path_params;
+    struct arena_t *arena;  // arena the request was allocated from, NULL for malloc
 }request_t;
 
 typedef struct
 {
     char *version;
-    char *status_code;
+    int status;             // status code, 200 unless set
     node_t *headers;
-    char *body;
+    char *body;             // malloc'd even in an arena, it is handed to the output when sent
+    size_t body_len;
+    int file_fd;            // file sent as the body with sendfile instead of body, -1 if none
+    struct file_entry_t *file;  // cached file sent as the body instead of body, NULL if none
+    int head_only;          // answer to HEAD: Content-Length describes the body but it is not sent
+    struct stream_t *stream;    // body produced while it is sent, see begin_stream_res, NULL if none
+    int no_chunked;         // the peer does not know chunked encoding (HTTP/1.0), set before the route callback
+    int encodings;          // content codings accepted by the peer (ENCODING_GZIP, ENCODING_DEFLATE), set before the route callback
+    int file_gzip;          // the gzip variant of file is sent instead of its data
+    const char *if_none_match;      // validators of a GET or HEAD request, set before the route callback, NULL if none
+    const char *if_modified_since;
+    struct arena_t *arena;  // arena the response was allocated from, NULL for malloc
 }response_t;
 
+/**
+ * Read a fragment of the body of a request
+ * A route added with add_body_route gets the body through this callback as it arrives,
+ * decoded if it is chunked, instead of buffered whole. The fragments follow each other
+ * in order and are only valid during the call. The callback runs on the thread receiving
+ * the connection, in epoll and io_uring mode the event loop, so it must not block. The
+ * route callback runs once the body has ended, it may never run if the request is refused
+ * or the connection closed: state allocated with mem_alloc (see arena.h) is released with
+ * the request either way.
+ * 
+ * @param req the request, its head is filled and req->body.state is kept between calls
+ * @param data the fragment
+ * @param len the length of the fragment, never 0
+ * @return 0 to go on, otherwise the status of the error response refusing the request, like 413
+*/
+typedef int (*body_callback)(request_t *req, const char *data, size_t len);
+
+typedef struct stream_t stream_t;
+
+/**
+ * Produce the next part of a streamed body
+ * The callback is called each time the chunks written so far have been sent, so no more
+ * than one call worth of the body is held in memory. It runs on the thread sending the
+ * output of the connection, in epoll and io_uring mode the event loop, so it must not
+ * block. Each call writes at least one chunk with write_chunk or ends the stream with
+ * end_stream.
+ * 
+ * @param stream the stream to write to
+ * @param arg the argument given to begin_stream_res
+ * @return 0 to go on, -1 to abort the response, the connection is closed
+*/
+typedef int (*stream_callback)(stream_t *stream, void *arg);
+
 /**
  * Initialize a request_t struct
  * This function allocates memory for a new request_t struct and initializes its fields to NULL.
+ * When the calling thread has selected an arena (see arena.h) the request is allocated from it.
  * 
  * @return a pointer to the request_t struct
  * @return NULL if an error occurred
@@ -49,6 +139,7 @@ extern request_t * init_request();
 /**
  * Initialize a response_t struct
  * This function allocates memory for a new response_t struct and initializes its fields to NULL.
+ * When the calling thread has selected an arena (see arena.h) the response is allocated from it.
  * 
  * @return a pointer to the response_t struct
  * @return NULL if an error occurred
@@ -58,6 +149,10 @@ extern response_t * init_response();
 /**
  * Free a request_t struct
  * This function frees the memory allocated for a request_t struct.
+ * A request allocated from an arena is released with the arena instead. Otherwise the
+ * blocks of params, the JSON tape and the parts are freed with it, the params themselves
+ * point into the buffer the request was parsed from. A list built with add_param is
+ * freed with free_list.
  * 
  * @param req a pointer to the request_t struct
 */
@@ -66,6 +161,7 @@ extern void free_request(request_t *req);
 /**
  * Free a response_t struct
  * This function frees the memory allocated for a response_t struct.
+ * A response allocated from an arena is released with the arena instead.
  * 
  * @param res a pointer to the response_t struct
 */
@@ -73,7 +169,8 @@ extern void free_response(response_t *res);
 
 /**
  * Get a header value
- * This function searches for a header in a list of headers and returns its value.
+ * This function searches for a header in a list of headers and returns its value. Keys
+ * are compared without case. It walks the list, get_request_header is constant time.
  * 
  * @param headers a pointer to the list of headers
  * @param key the key of the header to search for
@@ -83,6 +180,27 @@ extern void free_response(response_t *res);
 */
 extern char *get_header(node_t *headers, char *key);
 
+/**
+ * Get a header of a request
+ * This function looks a header up in the hash index of the request, the name is compared
+ * without case.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param key the name of the header
+ * @return the value of the first header with that name or NULL if there is none
+*/
+extern char *get_request_header(request_t *req, const char *key);
+
+/**
+ * Get a well-known header of a request
+ * This function reads the header from a slot of its own in the index, without hashing.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param id the id of the header, like HEADER_CONTENT_TYPE
+ * @return the value of the first header with that name or NULL if there is none
+*/
+extern char *get_known_header(request_t *req, header_id_t id);
+
 /**
  * Add a header
  * This function adds a header to a list of headers.
@@ -104,14 +222,86 @@ extern void add_header(node_t **headers, char *key, char *value);
 extern void add_param(node_t **params, char *key, char *value);
 
 /**
- * Add a body
- * This function adds a body to a request_t struct.
+ * Get the nodes for a block of params
+ * The nodes come from the inline params of the request while they last, a larger block is
+ * allocated at once and freed with the request. The caller links them into
+ * req->body.params.
  * 
  * @param req a pointer to the request_t struct
+ * @param n the number of nodes
+ * @return the nodes or NULL if an error occurred
+*/
+extern node_t *param_nodes(request_t *req, size_t n);
+
+/**
+ * Add a body
+ * This function adds a body to a response_t struct.
+ * 
+ * @param res a pointer to the response_t struct
  * @param body the body to add
 */
 extern void add_body_res(response_t *res, char *body);
 
+/**
+ * Add a binary body
+ * This function adds len bytes of data, which may contain NUL bytes, as the body of a response_t struct.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param body the body to add
+ * @param len the length of the body
+*/
+extern void add_binary_body_res(response_t *res, const char *body, size_t len);
+
+/**
+ * Begin a streamed body
+ * This function turns the body of a response into a stream sent with "Transfer-Encoding:
+ * chunked" instead of a Content-Length, so the head goes out before the body is known.
+ * The route callback can write the first chunks right away, then cb is called for the
+ * next ones whenever the output drains, until end_stream. HTTP/1.0 clients get the body
+ * without chunk framing and the connection is closed after it.
+ * 
+ * @param res a pointer to the response_t struct, its previous body is dropped
+ * @param cb the callback producing the body, NULL if the route callback writes all of it
+ * @param arg the argument passed to cb
+ * @param free_arg releases arg once the stream is done or dropped, NULL if nothing is to be released
+ * @return the stream or NULL if an error occurred, arg is released then
+*/
+extern stream_t *begin_stream_res(response_t *res, stream_callback cb, void *arg, void (*free_arg)(void *arg));
+
+/**
+ * Write a chunk of a streamed body
+ * The data is copied, small chunks written in a row share a buffer from the pool and go
+ * out in one send. Writing nothing does nothing, the end of the body is sent by end_stream.
+ * 
+ * @param stream the stream
+ * @param data the data of the chunk, it may contain NUL bytes
+ * @param len the length of the data
+ * @return 0 if the chunk was written, -1 if the stream has ended or an error occurred
+*/
+extern int write_chunk(stream_t *stream, const void *data, size_t len);
+
+/**
+ * End a streamed body
+ * The chunks written before are sent, then the last empty chunk, and the callback is not
+ * called anymore.
+ * 
+ * @param stream the stream
+*/
+extern void end_stream(stream_t *stream);
+
+/**
+ * Get a parameter of the path
+ * This function returns a parameter captured by the route of a request, the "id" of
+ * "/users/:id", or "*" for a wildcard without a name. The value points into the path of
+ * the request and is not NUL terminated.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param name the name of the parameter
+ * @param len set to the length of the value
+ * @return the value of the parameter or NULL if the route has no such parameter
+*/
+extern const char *get_path_param(request_t *req, const char *name, size_t *len);
+
 /**
  * Set the public path
  * This function sets the public path where the server will look for files.
@@ -122,13 +312,29 @@ extern void set_public_path(char *path);
 
 /**
  * Add a file body
- * This function adds the content of a file to a response_t struct.
+ * This function sets a file as the body of a response_t struct, with its Content-Type,
+ * ETag and Last-Modified headers unless they are already set. Small files are served from
+ * the file cache, larger ones stay open until the response is sent with sendfile; body
+ * stays NULL in both cases.
  * 
  * @param res a pointer to the response_t struct
  * @param path the path of the file
 */
 extern void add_file_body(response_t *res, char *path);
 
+/**
+ * Serve a static file
+ * This function resolves the path of a request under the static folder of the public path
+ * and sets the file as the body of a response_t struct like add_file_body. The path is
+ * percent-decoded, "." and ".." segments and hidden files are refused so that nothing
+ * outside the folder can be reached, and paths ending with '/' serve their index.html.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param path the path of the request
+ * @return 0 if the file was set as the body, -1 if there is no such file
+*/
+extern int serve_static(response_t *res, const char *path);
+
 /**
  * Add a version
  * This function adds a version to a response_t struct.
@@ -140,13 +346,57 @@ extern void add_version_res(response_t *res, char *version);
 
 /**
  * Add a status code
- * This function adds a status code to a response_t struct.
+ * This function adds a status code to a response_t struct. It is kept for compatibility,
+ * set_status_res does not need to parse it.
  * 
  * @param res a pointer to the response_t struct
- * @param status_code the status code to add
+ * @param status_code the status code to add, as a string of three digits
 */
 extern void add_status_code_res(response_t *res, char *status_code);
 
+/**
+ * Set the status of a response
+ * This function sets the status code of a response_t struct, its status line is rendered
+ * from a precomputed table.
+ * 
+ * @param res a pointer to the response_t struct
+ * @param status the status code, between 100 and 599
+*/
+extern void set_status_res(response_t *res, int status);
+
+/**
+ * Answer a conditional request with 304 Not Modified
+ * This function evaluates If-None-Match against the ETag of a response_t struct, or
+ * If-Modified-Since against its Last-Modified when the request has no If-None-Match. If
+ * the client's copy is still valid, the body is dropped and the status set to 304. Only
+ * GET and HEAD requests answered with 200 are concerned. Files attached by add_file_body
+ * or the static handler are checked before they are attached, this runs after the
+ * route callback for the bodies it built; a callback can also call it once it has set the
+ * validators to skip building the body.
+ * 
+ * @param req the request
+ * @param res a pointer to the response_t struct
+ * @return 1 if the response became 304 Not Modified, 0 otherwise
+*/
+extern int check_not_modified(request_t *req, response_t *res);
+
+/**
+ * Parse a method
+ * 
+ * @param method the method, not necessarily NUL terminated
+ * @param len the length of the method
+ * @return the method or METHOD_UNKNOWN if it is not supported
+*/
+extern http_method_t parse_method(const char *method, size_t len);
+
+/**
+ * Get the name of a method
+ * 
+ * @param method the method
+ * @return the name of the method, "UNKNOWN" for METHOD_UNKNOWN
+*/
+extern const char *method_name(http_method_t method);
+
 /**
  * Print a request
  * This function prints the fields of a request_t struct.
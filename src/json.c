@@ -0,0 +1,600 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/json.c
+ * @brief implementation of json.h
+*/
+
+#include "json.h"
+#include "arena.h"
+#include "scan.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// values recorded so far, indices are used while parsing as the tape moves when it grows
+typedef struct
+{
+    json_t *values;
+    size_t n;
+    size_t size;
+} tape_t;
+
+/**
+ * Append a value to a tape
+ * 
+ * @return the index of the value, -1 if an error occurred
+*/
+static long push_value(tape_t *tape)
+{
+    if (tape->n == tape->size)
+    {
+        if (tape->size >= UINT32_MAX / 2)
+            return -1;
+        size_t size = tape->size * 2;
+        json_t *values = (json_t *)mem_alloc(size * sizeof(json_t));
+        if (values == NULL)
+        {
+            perror("[-]Error allocating the json tape");
+            return -1;
+        }
+        memcpy(values, tape->values, tape->n * sizeof(json_t));
+        mem_free(tape->values);
+        tape->values = values;
+        tape->size = size;
+    }
+    json_t *value = &tape->values[tape->n];
+    value->escaped = 0;
+    value->len = 0;
+    value->span = 1;
+    value->count = 0;
+    return (long)tape->n++;
+}
+
+static char *skip_space(char *p, char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+    return p;
+}
+
+/**
+ * Check a UTF-8 sequence
+ * Overlong forms, surrogates and code points above U+10FFFF are refused (RFC 3629).
+ * 
+ * @param p the first byte of the sequence, from 0x80
+ * @param end the end of the text
+ * @return the byte after the sequence, NULL if it is not valid
+*/
+static char *skip_utf8(char *p, char *end)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    size_t len;
+    unsigned char min = 0x80, max = 0xbf; //range of the second byte
+    if (u[0] >= 0xc2 && u[0] <= 0xdf)
+        len = 2;
+    else if (u[0] >= 0xe0 && u[0] <= 0xef)
+    {
+        len = 3;
+        if (u[0] == 0xe0)
+            min = 0xa0;
+        else if (u[0] == 0xed)
+            max = 0x9f;
+    }
+    else if (u[0] >= 0xf0 && u[0] <= 0xf4)
+    {
+        len = 4;
+        if (u[0] == 0xf0)
+            min = 0x90;
+        else if (u[0] == 0xf4)
+            max = 0x8f;
+    }
+    else
+        return NULL;
+    if ((size_t)(end - p) < len || u[1] < min || u[1] > max)
+        return NULL;
+    for (size_t i = 2; i < len; i++)
+    {
+        if ((u[i] & 0xc0) != 0x80)
+            return NULL;
+    }
+    return p + len;
+}
+
+/**
+ * Scan a string, p is after the opening quote
+ * The escapes and the UTF-8 sequences are only checked, the closing quote is replaced by a NUL.
+ * 
+ * @return the byte after the string, NULL if the string is not valid
+*/
+static char *scan_string(json_t *value, char *p, char *end)
+{
+    char *start = p;
+    while (1)
+    {
+        if ((p = scan_json_string(p, end)) == NULL)
+            return NULL;
+        if ((unsigned char)*p >= 0x80)
+        {
+            if ((p = skip_utf8(p, end)) == NULL)
+                return NULL;
+            continue;
+        }
+        if (*p != '\\')
+            break;
+        value->escaped = 1;
+        if (end - p < 2)
+            return NULL;
+        if (p[1] == 'u')
+        {
+            if (end - p < 6 || hex_value(p[2]) < 0 || hex_value(p[3]) < 0 || hex_value(p[4]) < 0 || hex_value(p[5]) < 0)
+                return NULL;
+            p += 6;
+        }
+        else if (p[1] != '\0' && strchr("\"\\/bfnrt", p[1]) != NULL)
+            p += 2;
+        else
+            return NULL;
+    }
+    if (*p != '"')
+        return NULL; //a control character
+    value->type = JSON_STRING;
+    value->text = start;
+    value->len = p - start;
+    *p = '\0';
+    return p + 1;
+}
+
+static char *skip_digits(char *p, char *end)
+{
+    while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    return p;
+}
+
+/**
+ * Scan a number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+ * 
+ * @return the byte after the number, NULL if the number is not valid
+*/
+static char *scan_number(char *p, char *end)
+{
+    if (p < end && *p == '-')
+        p++;
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+    p = *p == '0' ? p + 1 : skip_digits(p, end);
+    if (p < end && *p == '.')
+    {
+        if (++p == end || *p < '0' || *p > '9')
+            return NULL;
+        p = skip_digits(p, end);
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        if (++p < end && (*p == '+' || *p == '-'))
+            p++;
+        if (p == end || *p < '0' || *p > '9')
+            return NULL;
+        p = skip_digits(p, end);
+    }
+    return p;
+}
+
+/**
+ * Scan a value that is not an array or an object
+ * 
+ * @return the byte after the value, NULL if the value is not valid
+*/
+static char *scan_scalar(json_t *value, char *p, char *end)
+{
+    static const struct
+    {
+        const char *word;
+        size_t len;
+        json_type_t type;
+    } literals[] = {{"true", 4, JSON_TRUE}, {"false", 5, JSON_FALSE}, {"null", 4, JSON_NULL}};
+
+    if (*p == '"')
+        return scan_string(value, p + 1, end);
+    value->text = p;
+    if (*p == '-' || (*p >= '0' && *p <= '9'))
+    {
+        char *after = scan_number(p, end);
+        if (after != NULL)
+        {
+            value->type = JSON_NUMBER;
+            value->len = after - p;
+        }
+        return after;
+    }
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++)
+    {
+        if ((size_t)(end - p) >= literals[i].len && memcmp(p, literals[i].word, literals[i].len) == 0)
+        {
+            value->type = literals[i].type;
+            value->len = literals[i].len;
+            return p + literals[i].len;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Parse a JSON document
+ * The document is read as a flat sequence of values with an explicit stack of the open
+ * arrays and objects, so deep documents cannot exhaust the stack of the thread. Each
+ * value is recorded when it starts, an array or an object gets its span and count when
+ * it is closed.
+ * 
+ * @param text the document, modified in place
+ * @param len the length of the document
+ * @return the root value or NULL if the document is not valid JSON or an error occurred
+*/
+json_t *parse_json(char *text, size_t len)
+{
+    if (len >= UINT32_MAX)
+        return NULL;
+    tape_t tape;
+    //a value takes a few bytes of text at least, the tape rarely grows more than once
+    tape.size = len / 8 + 8;
+    tape.n = 0;
+    if ((tape.values = (json_t *)mem_alloc(tape.size * sizeof(json_t))) == NULL)
+    {
+        perror("[-]Error allocating the json tape");
+        return NULL;
+    }
+    uint32_t open[JSON_MAX_DEPTH];
+    size_t depth = 0;
+    char *end = text + len;
+    char *p = skip_space(text, end);
+    while (1)
+    {
+        //a value, after its key inside an object
+        if (depth > 0 && tape.values[open[depth - 1]].type == JSON_OBJECT)
+        {
+            long key = push_value(&tape);
+            if (key < 0 || p == end || *p != '"' || (p = scan_string(&tape.values[key], p + 1, end)) == NULL)
+                goto fail;
+            p = skip_space(p, end);
+            if (p == end || *p != ':')
+                goto fail;
+            p = skip_space(p + 1, end);
+        }
+        long index = push_value(&tape);
+        if (index < 0 || p == end)
+            goto fail;
+        json_t *value = &tape.values[index];
+        if (*p == '{' || *p == '[')
+        {
+            if (depth == JSON_MAX_DEPTH)
+                goto fail;
+            value->type = *p == '{' ? JSON_OBJECT : JSON_ARRAY;
+            value->text = p;
+            char close = *p == '{' ? '}' : ']';
+            p = skip_space(p + 1, end);
+            if (p == end || *p != close)
+            {
+                open[depth++] = (uint32_t)index;
+                continue;
+            }
+            value->len = p + 1 - value->text;
+            p++;
+        }
+        else if ((p = scan_scalar(value, p, end)) == NULL)
+            goto fail;
+
+        //the value is complete, so may be the arrays and objects it closes
+        p = skip_space(p, end);
+        while (depth > 0)
+        {
+            json_t *container = &tape.values[open[depth - 1]];
+            container->count++;
+            if (p < end && *p == ',')
+                break;
+            if (p == end || *p != (container->type == JSON_OBJECT ? '}' : ']'))
+                goto fail;
+            container->span = (uint32_t)(tape.n - open[depth - 1]);
+            container->len = p + 1 - container->text;
+            depth--;
+            p = skip_space(p + 1, end);
+        }
+        if (depth == 0)
+            break;
+        p = skip_space(p + 1, end);
+    }
+    if (p != end)
+        goto fail;
+    return tape.values;
+
+fail:
+    mem_free(tape.values);
+    return NULL;
+}
+
+/**
+ * Get the type of a value
+ * 
+ * @param value the value, NULL is taken as a missing value
+ * @return the json_type_t of the value, JSON_NULL for NULL
+*/
+json_type_t json_type(const json_t *value)
+{
+    return value != NULL ? (json_type_t)value->type : JSON_NULL;
+}
+
+/**
+ * Get the number of members of an object or elements of an array
+ * 
+ * @param value the value
+ * @return the number of members or elements, 0 for other values
+*/
+size_t json_count(const json_t *value)
+{
+    return value != NULL && (value->type == JSON_ARRAY || value->type == JSON_OBJECT) ? value->count : 0;
+}
+
+/**
+ * Get the first element of an array or the key of the first member of an object
+ * The value of a member is the one after its key, key + 1.
+ * 
+ * @param value the array or object
+ * @return the element or key, NULL if there is none
+*/
+json_t *json_first(json_t *value)
+{
+    return json_count(value) > 0 ? value + 1 : NULL;
+}
+
+/**
+ * Get the next element of an array or the key of the next member of an object
+ * 
+ * @param value the array or object
+ * @param item the current element or key
+ * @return the next element or key, NULL after the last one
+*/
+json_t *json_next(json_t *value, json_t *item)
+{
+    //the key of a member is a string, its span is 1 and the value follows
+    json_t *next = value->type == JSON_OBJECT ? item + 1 + item[1].span : item + item->span;
+    return next < value + value->span ? next : NULL;
+}
+
+/**
+ * Get a member of an object
+ * The members are compared in order, the first one with the key is returned.
+ * 
+ * @param object the object
+ * @param key the key of the member
+ * @return the value of the member or NULL if there is none or object is not an object
+*/
+json_t *json_get(json_t *object, const char *key)
+{
+    if (json_type(object) != JSON_OBJECT)
+        return NULL;
+    size_t len = strlen(key);
+    for (json_t *member = json_first(object); member != NULL; member = json_next(object, member))
+    {
+        size_t member_len = 0;
+        const char *name = json_string(member, &member_len);
+        if (name != NULL && member_len == len && memcmp(name, key, len) == 0)
+            return member + 1;
+    }
+    return NULL;
+}
+
+/**
+ * Get an element of an array
+ * The elements before it are skipped without being read, a step each.
+ * 
+ * @param array the array
+ * @param index the index of the element
+ * @return the element or NULL if the index is out of range or array is not an array
+*/
+json_t *json_at(json_t *array, size_t index)
+{
+    if (json_type(array) != JSON_ARRAY || index >= array->count)
+        return NULL;
+    json_t *element = json_first(array);
+    while (index-- > 0)
+        element += element->span;
+    return element;
+}
+
+/**
+ * Read the 4 hex digits of a \u escape
+*/
+static unsigned read_hex4(const char *p)
+{
+    unsigned code = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        code = code << 4 | (unsigned)hex_value(p[i]);
+    }
+    return code;
+}
+
+/**
+ * Encode a code point in UTF-8
+ * 
+ * @return the end of the encoded bytes
+*/
+static char *put_utf8(char *p, unsigned code)
+{
+    if (code < 0x80)
+        *p++ = (char)code;
+    else if (code < 0x800)
+    {
+        *p++ = (char)(0xc0 | code >> 6);
+        *p++ = (char)(0x80 | (code & 0x3f));
+    }
+    else if (code < 0x10000)
+    {
+        *p++ = (char)(0xe0 | code >> 12);
+        *p++ = (char)(0x80 | (code >> 6 & 0x3f));
+        *p++ = (char)(0x80 | (code & 0x3f));
+    }
+    else
+    {
+        *p++ = (char)(0xf0 | code >> 18);
+        *p++ = (char)(0x80 | (code >> 12 & 0x3f));
+        *p++ = (char)(0x80 | (code >> 6 & 0x3f));
+        *p++ = (char)(0x80 | (code & 0x3f));
+    }
+    return p;
+}
+
+/**
+ * Decode the escapes of a string in place
+ * An escape is never shorter than what it decodes to, so the decoded bytes can be written
+ * over the text. The escapes were checked by parse_json.
+ * 
+ * @return the length of the decoded string
+*/
+static size_t unescape(char *text, size_t len)
+{
+    char *end = text + len;
+    char *out = text;
+    for (char *p = text; p < end;)
+    {
+        if (*p != '\\')
+        {
+            *out++ = *p++;
+            continue;
+        }
+        char c = p[1];
+        p += 2;
+        if (c != 'u')
+        {
+            static const char decoded[256] = {['"'] = '"', ['\\'] = '\\', ['/'] = '/', ['b'] = '\b', ['f'] = '\f', ['n'] = '\n', ['r'] = '\r', ['t'] = '\t'};
+            *out++ = decoded[(unsigned char)c];
+            continue;
+        }
+        unsigned code = read_hex4(p);
+        p += 4;
+        if (code >= 0xd800 && code < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+        {
+            unsigned low = read_hex4(p + 2);
+            if (low >= 0xdc00 && low < 0xe000)
+            {
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            }
+        }
+        if (code >= 0xd800 && code < 0xe000)
+            code = 0xfffd; //a surrogate without its pair
+        out = put_utf8(out, code);
+    }
+    *out = '\0';
+    return out - text;
+}
+
+/**
+ * Get a string
+ * The escapes of the string are decoded in place the first time it is read, invalid
+ * surrogates become U+FFFD.
+ * 
+ * @param value the value
+ * @param len set to the length of the string, which may contain NUL bytes, NULL to ignore it
+ * @return the NUL terminated string or NULL if the value is not a string
+*/
+const char *json_string(json_t *value, size_t *len)
+{
+    if (json_type(value) != JSON_STRING)
+        return NULL;
+    if (value->escaped)
+    {
+        value->len = (uint32_t)unescape(value->text, value->len);
+        value->escaped = 0;
+    }
+    if (len != NULL)
+        *len = value->len;
+    return value->text;
+}
+
+/**
+ * Get an integer
+ * 
+ * @param value the value
+ * @param out set to the integer
+ * @return 0 on success, -1 if the value is not a number without fraction and exponent or does not fit
+*/
+int json_int(const json_t *value, long long *out)
+{
+    if (json_type(value) != JSON_NUMBER)
+        return -1;
+    const char *p = value->text;
+    const char *end = p + value->len;
+    int negative = *p == '-';
+    if (negative)
+        p++;
+    //accumulated as a negative number, whose range is the larger one
+    long long result = 0;
+    for (; p < end; p++)
+    {
+        if (*p < '0' || *p > '9')
+            return -1; //fraction or exponent
+        int digit = *p - '0';
+        if (result < (LLONG_MIN + digit) / 10)
+            return -1;
+        result = result * 10 - digit;
+    }
+    if (!negative && result == LLONG_MIN)
+        return -1;
+    *out = negative ? result : -result;
+    return 0;
+}
+
+/**
+ * Get a number
+ * 
+ * @param value the value
+ * @param out set to the number
+ * @return 0 on success, -1 if the value is not a number or overflows a double
+*/
+int json_double(const json_t *value, double *out)
+{
+    if (json_type(value) != JSON_NUMBER)
+        return -1;
+    //the text is copied, the byte after the number may belong to something else
+    char buffer[64];
+    char *copy = value->len < sizeof(buffer) ? buffer : (char *)malloc(value->len + 1);
+    if (copy == NULL)
+    {
+        perror("[-]malloc failed");
+        return -1;
+    }
+    memcpy(copy, value->text, value->len);
+    copy[value->len] = '\0';
+    errno = 0;
+    *out = strtod(copy, NULL);
+    int result = errno == ERANGE && (*out > 1 || *out < -1) ? -1 : 0; //underflow to 0 is fine
+    if (copy != buffer)
+        free(copy);
+    return result;
+}
+
+/**
+ * Get a boolean
+ * 
+ * @param value the value
+ * @return 1 for true, 0 for false, -1 if the value is not a boolean
+*/
+int json_bool(const json_t *value)
+{
+    switch (json_type(value))
+    {
+        case JSON_TRUE:
+            return 1;
+        case JSON_FALSE:
+            return 0;
+        default:
+            return -1;
+    }
+}
\ No newline at end of file
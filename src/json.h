@@ -0,0 +1,149 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/json.h
+ * @brief provides a single pass JSON parser building a tape of the values, read with typed accessors
+*/
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH 256  // nested arrays and objects accepted
+
+typedef enum
+{
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+}json_type_t;
+
+// value of a parsed document, the values are laid out in document order on a tape: the
+// members of an object follow it as a key and a value each, the elements of an array follow it
+typedef struct json_t
+{
+    uint8_t type;           // json_type_t
+    uint8_t escaped;        // the escapes of a string are not decoded yet, see json_string
+    uint32_t len;           // bytes of text
+    uint32_t span;          // values on the tape from this one to the end of its last member, itself included
+    uint32_t count;         // members of an object, elements of an array
+    char *text;             // the value in the parsed text, a string without its quotes
+}json_t;
+
+/**
+ * Parse a JSON document
+ * This function validates the document and records each value on a tape in one pass over
+ * the text, the tape is one allocation grown by doubling. Nothing else is materialized:
+ * strings are decoded and numbers converted when they are read. The closing quote of each
+ * string is replaced by a NUL, so the values point into the text, which must outlive
+ * them. When the calling thread has selected an arena (see arena.h) the tape is allocated
+ * from it, in a route callback it is released with the request.
+ * 
+ * @param text the document, modified in place
+ * @param len the length of the document
+ * @return the root value or NULL if the document is not valid JSON or an error occurred
+*/
+extern json_t *parse_json(char *text, size_t len);
+
+/**
+ * Get the type of a value
+ * 
+ * @param value the value, NULL is taken as a missing value
+ * @return the json_type_t of the value, JSON_NULL for NULL
+*/
+extern json_type_t json_type(const json_t *value);
+
+/**
+ * Get the number of members of an object or elements of an array
+ * 
+ * @param value the value
+ * @return the number of members or elements, 0 for other values
+*/
+extern size_t json_count(const json_t *value);
+
+/**
+ * Get a member of an object
+ * The members are compared in order, the first one with the key is returned.
+ * 
+ * @param object the object
+ * @param key the key of the member
+ * @return the value of the member or NULL if there is none or object is not an object
+*/
+extern json_t *json_get(json_t *object, const char *key);
+
+/**
+ * Get an element of an array
+ * The elements before it are skipped without being read, a step each.
+ * 
+ * @param array the array
+ * @param index the index of the element
+ * @return the element or NULL if the index is out of range or array is not an array
+*/
+extern json_t *json_at(json_t *array, size_t index);
+
+/**
+ * Get the first element of an array or the key of the first member of an object
+ * The value of a member is the one after its key, key + 1.
+ * 
+ * @param value the array or object
+ * @return the element or key, NULL if there is none
+*/
+extern json_t *json_first(json_t *value);
+
+/**
+ * Get the next element of an array or the key of the next member of an object
+ * 
+ * @param value the array or object
+ * @param item the current element or key
+ * @return the next element or key, NULL after the last one
+*/
+extern json_t *json_next(json_t *value, json_t *item);
+
+/**
+ * Get a string
+ * The escapes of the string are decoded in place the first time it is read, invalid
+ * surrogates become U+FFFD.
+ * 
+ * @param value the value
+ * @param len set to the length of the string, which may contain NUL bytes, NULL to ignore it
+ * @return the NUL terminated string or NULL if the value is not a string
+*/
+extern const char *json_string(json_t *value, size_t *len);
+
+/**
+ * Get an integer
+ * 
+ * @param value the value
+ * @param out set to the integer
+ * @return 0 on success, -1 if the value is not a number without fraction and exponent or does not fit
+*/
+extern int json_int(const json_t *value, long long *out);
+
+/**
+ * Get a number
+ * 
+ * @param value the value
+ * @param out set to the number
+ * @return 0 on success, -1 if the value is not a number or overflows a double
+*/
+extern int json_double(const json_t *value, double *out);
+
+/**
+ * Get a boolean
+ * 
+ * @param value the value
+ * @return 1 for true, 0 for false, -1 if the value is not a boolean
+*/
+extern int json_bool(const json_t *value);
+
+#endif // JSON_H
\ No newline at end of file
@@ -0,0 +1,199 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/json_test.c
+ * @brief tests of the JSON parser of json.h
+*/
+
+#include "json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("[-]%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static char buffer[JSON_MAX_DEPTH * 2 + 4096];
+
+/**
+ * Parse a document from a copy of it, the tape is freed by the caller
+ * 
+ * @return the root value or NULL if the document is not valid JSON
+*/
+static json_t *parse(const char *text, size_t len)
+{
+    memcpy(buffer, text, len);
+    buffer[len] = '\0';
+    return parse_json(buffer, len);
+}
+
+/**
+ * Check whether a document is valid JSON
+*/
+static int is_valid(const char *text)
+{
+    json_t *root = parse(text, strlen(text));
+    free(root);
+    return root != NULL;
+}
+
+static void test_values()
+{
+    const char *text = " {\"name\": \"box\", \"size\": [1, -2.5e3, 0], \"open\": true, \"lid\": null, \"empty\": {}} ";
+    json_t *root = parse(text, strlen(text));
+    CHECK(root != NULL);
+    if (root == NULL)
+        return;
+    CHECK(json_type(root) == JSON_OBJECT);
+    CHECK(json_count(root) == 5);
+    CHECK(strcmp(json_string(json_get(root, "name"), NULL), "box") == 0);
+
+    json_t *size = json_get(root, "size");
+    CHECK(json_type(size) == JSON_ARRAY);
+    CHECK(json_count(size) == 3);
+    long long integer;
+    double number;
+    CHECK(json_int(json_at(size, 0), &integer) == 0 && integer == 1);
+    CHECK(json_int(json_at(size, 1), &integer) == -1);
+    CHECK(json_double(json_at(size, 1), &number) == 0 && number == -2500.0);
+    CHECK(json_at(size, 3) == NULL);
+
+    CHECK(json_bool(json_get(root, "open")) == 1);
+    CHECK(json_type(json_get(root, "lid")) == JSON_NULL);
+    CHECK(json_get(root, "lid") != NULL);
+    CHECK(json_count(json_get(root, "empty")) == 0);
+    CHECK(json_get(root, "missing") == NULL);
+
+    //the members come back in order, each value right after its key
+    const char *keys[] = {"name", "size", "open", "lid", "empty"};
+    size_t i = 0;
+    for (json_t *key = json_first(root); key != NULL; key = json_next(root, key), i++)
+        CHECK(i < 5 && strcmp(json_string(key, NULL), keys[i]) == 0);
+    CHECK(i == 5);
+    free(root);
+}
+
+static void test_integers()
+{
+    long long integer;
+    const char *text = "[9223372036854775807, -9223372036854775808, 9223372036854775808, 1.0]";
+    json_t *root = parse(text, strlen(text));
+    CHECK(root != NULL);
+    if (root == NULL)
+        return;
+    CHECK(json_int(json_at(root, 0), &integer) == 0 && integer == 9223372036854775807LL);
+    CHECK(json_int(json_at(root, 1), &integer) == 0 && integer == -9223372036854775807LL - 1);
+    CHECK(json_int(json_at(root, 2), &integer) == -1);
+    CHECK(json_int(json_at(root, 3), &integer) == -1);
+    free(root);
+}
+
+static void test_escapes()
+{
+    const char *text = "[\"a\\\"b\\\\c\\/d\\n\", \"\\u00e9\\ud83d\\ude00\", \"\\ud83d!\", \"nul\\u0000in\"]";
+    json_t *root = parse(text, strlen(text));
+    CHECK(root != NULL);
+    if (root == NULL)
+        return;
+    CHECK(strcmp(json_string(json_at(root, 0), NULL), "a\"b\\c/d\n") == 0);
+    CHECK(strcmp(json_string(json_at(root, 1), NULL), "\xc3\xa9\xf0\x9f\x98\x80") == 0);
+    //a lone surrogate becomes U+FFFD
+    CHECK(strcmp(json_string(json_at(root, 2), NULL), "\xef\xbf\xbd!") == 0);
+    size_t len;
+    const char *nul = json_string(json_at(root, 3), &len);
+    CHECK(len == 6 && memcmp(nul, "nul\0in", 6) == 0);
+    //a string is decoded once, reading it again gives the same text
+    CHECK(strcmp(json_string(json_at(root, 0), NULL), "a\"b\\c/d\n") == 0);
+    free(root);
+}
+
+static void test_long_strings()
+{
+    //the strings are scanned in blocks, a quote, a backslash or a control character is
+    //found wherever it falls in a block
+    for (size_t pos = 0; pos < 70; pos++)
+    {
+        char text[128];
+        memset(text, 'a', sizeof(text));
+        text[0] = '"';
+        text[1 + pos] = '\\';
+        text[2 + pos] = '"';
+        text[80] = '"';
+        json_t *root = parse(text, 81);
+        CHECK(root != NULL);
+        if (root != NULL)
+        {
+            size_t len;
+            const char *s = json_string(root, &len);
+            CHECK(len == 78 && s[pos] == '"');
+            free(root);
+        }
+        text[1 + pos] = '\n';
+        CHECK(parse(text, 81) == NULL);
+        text[1 + pos] = '"';
+        CHECK(parse(text, 81) == NULL);
+    }
+}
+
+static void test_utf8()
+{
+    CHECK(is_valid("\"caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80\""));
+    CHECK(!is_valid("\"\xff\""));
+    CHECK(!is_valid("\"\xc3\""));
+    CHECK(!is_valid("\"\xc0\x80\""));           //overlong NUL
+    CHECK(!is_valid("\"\xed\xa0\x80\""));       //surrogate
+    CHECK(!is_valid("\"\xf4\x90\x80\x80\""));   //beyond U+10FFFF
+}
+
+static void test_invalid()
+{
+    const char *documents[] = {
+        "", " ", "{", "[1,]", "{\"a\":1,}", "{\"a\" 1}", "{1:2}", "[1 2]", "{} {}", "[] x",
+        "01", "-", "1.", "1e", ".5", "+1", "tru", "nul", "True", "\"open", "\"\\x\"",
+        "\"\\u12\"", "'a'", "[\"a\"]]",
+    };
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++)
+        CHECK(!is_valid(documents[i]));
+    CHECK(is_valid("0"));
+    CHECK(is_valid("-0.5e+10"));
+    CHECK(is_valid("\"\""));
+}
+
+static void test_depth()
+{
+    char text[JSON_MAX_DEPTH * 2 + 4];
+    for (int depth = JSON_MAX_DEPTH; depth <= JSON_MAX_DEPTH + 1; depth++)
+    {
+        memset(text, '[', depth);
+        memset(text + depth, ']', depth);
+        text[depth * 2] = '\0';
+        CHECK(is_valid(text) == (depth <= JSON_MAX_DEPTH));
+    }
+}
+
+int main()
+{
+    test_values();
+    test_integers();
+    test_escapes();
+    test_long_strings();
+    test_utf8();
+    test_invalid();
+    test_depth();
+    if (failures > 0)
+        printf("[-]%d checks failed\n", failures);
+    return failures > 0;
+}
@@ -10,6 +10,7 @@
 */
 
 #include "linked_list.h"
+#include "arena.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -24,17 +25,19 @@
  * @return NULL if an error occurred
 */
 node_t *create_node(char *key, char *value) {
-    node_t *new_node = (node_t *)malloc(sizeof(node_t));
+    node_t *new_node = (node_t *)mem_alloc(sizeof(node_t));
     if (new_node == NULL) {
         perror("[-]Error malloc");
         return NULL;
     }
-    new_node->value = strdup(value);
-    new_node->key = strdup(key);
+    new_node->value = mem_strdup(value);
+    new_node->key = mem_strdup(key);
     new_node->next = NULL;
     if (new_node->key == NULL || new_node->value == NULL) {
         perror("[-]Error strdup");
-        free(new_node);
+        mem_free(new_node->key);
+        mem_free(new_node->value);
+        mem_free(new_node);
         return NULL;
     }
     return new_node;
@@ -82,9 +85,9 @@ int delete_node(node_t **head, char *key) {
             } else {
                 prev->next = current->next;
             }
-            free(current->key);
-            free(current->value);
-            free(current);
+            mem_free(current->key);
+            mem_free(current->value);
+            mem_free(current);
             return 0;
         }
         prev = current;
@@ -124,9 +127,9 @@ void free_list(node_t *head) {
     node_t *next;
     while (current != NULL) {
         next = current->next;
-        free(current->key);
-        free(current->value);
-        free(current);
+        mem_free(current->key);
+        mem_free(current->value);
+        mem_free(current);
         current = next;
     }
     head = NULL;
@@ -0,0 +1,714 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/multipart.c
+ * @brief implementation of multipart.h
+*/
+
+#include "multipart.h"
+#include "arena.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+enum
+{
+    MP_PREAMBLE,            // before the first delimiter, dropped
+    MP_BOUNDARY,            // after a delimiter, before its CRLF or "--"
+    MP_DASH,                // after the first '-' of the final delimiter
+    MP_CR,                  // after the CR following a delimiter
+    MP_HEADERS,
+    MP_CONTENT,
+    MP_EPILOGUE             // after the final delimiter, dropped
+};
+
+static char *upload_path = "/tmp";
+static char no_name[] = ""; //name of a part without one, not allocated
+
+/**
+ * Initialize a multipart parser
+ * 
+ * @param mp a pointer to the multipart_t struct
+ * @param content_type the Content-Type of the body, its boundary parameter delimits the parts
+ * @param cb the callback receiving the parts
+ * @param arg the argument passed to cb
+ * @return 0 on success, -1 if the Content-Type is not multipart/form-data with a valid boundary
+*/
+int init_multipart(multipart_t *mp, const char *content_type, part_callback cb, void *arg)
+{
+    size_t type_len = sizeof("multipart/form-data") - 1;
+    if (content_type == NULL || strncasecmp(content_type, "multipart/form-data", type_len) != 0)
+        return -1;
+    const char *p = content_type + type_len, *boundary = NULL;
+    if (*p != '\0' && *p != ';' && *p != ' ')
+        return -1;
+    size_t len = 0;
+    while (boundary == NULL && (p = strchr(p, ';')) != NULL)
+    {
+        p++;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (strncasecmp(p, "boundary=", 9) != 0)
+            continue;
+        p += 9;
+        if (*p == '"')
+        {
+            const char *end = strchr(++p, '"');
+            if (end == NULL)
+                return -1;
+            len = end - p;
+        }
+        else
+            len = strcspn(p, "; \t");
+        boundary = p;
+    }
+    if (boundary == NULL || len == 0 || len > MULTIPART_MAX_BOUNDARY)
+        return -1;
+    memcpy(mp->delimiter, "\r\n--", 4);
+    memcpy(mp->delimiter + 4, boundary, len);
+    mp->delimiter_len = len + 4;
+    memset(mp->shift, (int)mp->delimiter_len, sizeof(mp->shift));
+    for (size_t i = 0; i + 1 < mp->delimiter_len; i++)
+        mp->shift[(unsigned char)mp->delimiter[i]] = (uint8_t)(mp->delimiter_len - 1 - i);
+    mp->state = MP_PREAMBLE;
+    mp->status = 0;
+    //the first delimiter has no CRLF before it, as if the body started with one
+    memcpy(mp->held, "\r\n", 2);
+    mp->held_len = 2;
+    mp->line_len = 0;
+    mp->parts = NULL;
+    mp->last = NULL;
+    mp->cb = cb;
+    mp->arg = arg;
+    return 0;
+}
+
+/**
+ * Find the first delimiter in a range
+ * 
+ * @return the start of the delimiter or NULL if the range does not hold a whole one
+*/
+static const char *search(const multipart_t *mp, const char *p, const char *end)
+{
+    size_t last = mp->delimiter_len - 1;
+    while ((size_t)(end - p) > last)
+    {
+        unsigned char c = p[last];
+        if (c == (unsigned char)mp->delimiter[last] && memcmp(p, mp->delimiter, last) == 0)
+            return p;
+        p += mp->shift[c];
+    }
+    return NULL;
+}
+
+/**
+ * Get the end of a range that may start a delimiter
+ * 
+ * @return the length of the longest suffix of the range that is a prefix of the delimiter
+*/
+static size_t partial_tail(const multipart_t *mp, const char *p, const char *end)
+{
+    size_t max = mp->delimiter_len - 1;
+    const char *q = (size_t)(end - p) > max ? end - max : p;
+    while ((q = memchr(q, '\r', end - q)) != NULL)
+    {
+        if (memcmp(q, mp->delimiter, end - q) == 0)
+            return end - q;
+        q++;
+    }
+    return 0;
+}
+
+/**
+ * Hand content to the callback, the preamble is dropped
+ * 
+ * @return 0 to go on, the status of the callback otherwise
+*/
+static int emit(multipart_t *mp, const char *data, size_t len)
+{
+    if (len == 0 || mp->state != MP_CONTENT)
+        return 0;
+    mp->last->len += len;
+    return mp->status = mp->cb(PART_DATA, mp->last, data, len, mp->arg);
+}
+
+/**
+ * End the content before a delimiter
+ * 
+ * @param after the byte after the delimiter
+ * @return after
+*/
+static const char *found(multipart_t *mp, const char *after)
+{
+    if (mp->state == MP_CONTENT)
+    {
+        mp->last->complete = 1;
+        if ((mp->status = mp->cb(PART_END, mp->last, NULL, 0, mp->arg)) != 0)
+            return after;
+    }
+    mp->state = MP_BOUNDARY;
+    return after;
+}
+
+/**
+ * Scan the content of a part or the preamble up to the next delimiter
+ * The bytes held back from the last fragment are joined with the start of this one, so
+ * that a delimiter split between the two is found.
+ * 
+ * @return the first byte not consumed
+*/
+static const char *scan_content(multipart_t *mp, const char *p, const char *end)
+{
+    size_t len = end - p, dl = mp->delimiter_len;
+    if (mp->held_len > 0)
+    {
+        char joined[2 * sizeof(mp->delimiter)];
+        size_t held = mp->held_len, take = len < dl - 1 ? len : dl - 1, n = held + take;
+        memcpy(joined, mp->held, held);
+        memcpy(joined + held, p, take);
+        mp->held_len = 0;
+        //less than a delimiter is taken from p, so a match starts in the held bytes
+        const char *match = search(mp, joined, joined + n);
+        if (match != NULL)
+        {
+            if (emit(mp, joined, match - joined) != 0)
+                return end;
+            return found(mp, p + (match - joined) + dl - held);
+        }
+        if (take < dl - 1)
+        {
+            size_t tail = partial_tail(mp, joined, joined + n);
+            if (emit(mp, joined, n - tail) != 0)
+                return end;
+            memcpy(mp->held, joined + n - tail, tail);
+            mp->held_len = tail;
+            return end;
+        }
+        if (emit(mp, joined, held) != 0)
+            return end;
+    }
+    const char *match = search(mp, p, end);
+    if (match != NULL)
+    {
+        if (emit(mp, p, match - p) != 0)
+            return end;
+        return found(mp, match + dl);
+    }
+    size_t tail = partial_tail(mp, p, end);
+    if (emit(mp, p, len - tail) != 0)
+        return end;
+    memcpy(mp->held, end - tail, tail);
+    mp->held_len = tail;
+    return end;
+}
+
+/**
+ * Start a new part after a delimiter
+ * 
+ * @return 0 on success, -1 if an error occurred
+*/
+static int begin_part(multipart_t *mp)
+{
+    part_t *part = (part_t *)mem_alloc(sizeof(part_t));
+    if (part == NULL)
+    {
+        perror("[-]Error allocating part");
+        return -1;
+    }
+    part->name = no_name;
+    part->filename = NULL;
+    part->content_type = NULL;
+    part->data = NULL;
+    part->len = 0;
+    part->size = 0;
+    part->path = NULL;
+    part->fd = -1;
+    part->complete = 0;
+    part->next = NULL;
+    if (mp->last == NULL)
+        mp->parts = part;
+    else
+        mp->last->next = part;
+    mp->last = part;
+    mp->state = MP_HEADERS;
+    mp->line_len = 0;
+    return 0;
+}
+
+/**
+ * Read the end of a delimiter, a CRLF before the headers of a part or "--" after the last one
+ * Transport padding, spaces and tabs, is allowed before the CRLF.
+ * 
+ * @return the first byte not consumed
+*/
+static const char *read_boundary(multipart_t *mp, const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        if (mp->state == MP_BOUNDARY)
+        {
+            if (*p == '-')
+                mp->state = MP_DASH;
+            else if (*p == '\r')
+                mp->state = MP_CR;
+            else if (*p != ' ' && *p != '\t')
+                break;
+        }
+        else if (mp->state == MP_DASH)
+        {
+            if (*p != '-')
+                break;
+            mp->state = MP_EPILOGUE;
+            return p + 1;
+        }
+        else
+        {
+            if (*p != '\n')
+                break;
+            if (begin_part(mp) < 0)
+                break;
+            return p + 1;
+        }
+    }
+    if (p < end)
+        mp->status = -1;
+    return end;
+}
+
+/**
+ * Copy a string with mem_alloc
+ * 
+ * @return the NUL terminated copy or NULL if an error occurred
+*/
+static char *copy_text(const char *p, size_t len)
+{
+    char *text = (char *)mem_alloc(len + 1);
+    if (text == NULL)
+    {
+        perror("[-]Error copying a part header");
+        return NULL;
+    }
+    memcpy(text, p, len);
+    text[len] = '\0';
+    return text;
+}
+
+/**
+ * Parse the name and filename parameters of a Content-Disposition header
+ * The value of a parameter is a token or a quoted string, unquoted in place.
+ * 
+ * @return 0 on success, -1 if an error occurred
+*/
+static int parse_disposition(part_t *part, char *p)
+{
+    while ((p = strchr(p, ';')) != NULL)
+    {
+        p++;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        char *key = p;
+        while (*p != '\0' && *p != '=' && *p != ';' && *p != ' ')
+            p++;
+        size_t key_len = p - key;
+        while (*p == ' ')
+            p++;
+        if (*p != '=')
+            continue;
+        p++;
+        while (*p == ' ')
+            p++;
+        char *value = p;
+        size_t len;
+        if (*p == '"')
+        {
+            char *out = value;
+            for (p++; *p != '\0' && *p != '"'; p++)
+            {
+                if (*p == '\\' && p[1] != '\0')
+                    p++;
+                *out++ = *p;
+            }
+            if (*p == '"')
+                p++;
+            len = out - value;
+        }
+        else
+        {
+            p += strcspn(p, "; \t");
+            len = p - value;
+        }
+        char **field = NULL;
+        if (key_len == 4 && strncasecmp(key, "name", 4) == 0)
+            field = &part->name;
+        else if (key_len == 8 && strncasecmp(key, "filename", 8) == 0)
+            field = &part->filename;
+        if (field != NULL && (*field = copy_text(value, len)) == NULL)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Parse a header line of a part
+ * 
+ * @param part the part
+ * @param line the NUL terminated line, without its CRLF
+ * @return 0 on success, -1 if an error occurred
+*/
+static int parse_part_header(part_t *part, char *line)
+{
+    char *colon = strchr(line, ':');
+    if (colon == NULL)
+        return 0;
+    size_t name_len = colon - line;
+    char *value = colon + 1;
+    while (*value == ' ' || *value == '\t')
+        value++;
+    size_t len = strlen(value);
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+        len--;
+    value[len] = '\0';
+    if (name_len == 19 && strncasecmp(line, "Content-Disposition", 19) == 0)
+        return parse_disposition(part, value);
+    if (name_len == 12 && strncasecmp(line, "Content-Type", 12) == 0)
+        return (part->content_type = copy_text(value, len)) != NULL ? 0 : -1;
+    return 0;
+}
+
+/**
+ * Read the headers of a part, a line at a time
+ * 
+ * @return the first byte not consumed
+*/
+static const char *read_headers(multipart_t *mp, const char *p, const char *end)
+{
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', end - p);
+        size_t n = (nl != NULL ? nl : end) - p;
+        if (n > MULTIPART_MAX_LINE - mp->line_len)
+        {
+            mp->status = -1;
+            return end;
+        }
+        memcpy(mp->line + mp->line_len, p, n);
+        mp->line_len += n;
+        if (nl == NULL)
+            return end;
+        p = nl + 1;
+        size_t len = mp->line_len;
+        mp->line_len = 0;
+        if (len == 0 || mp->line[len - 1] != '\r')
+        {
+            mp->status = -1;
+            return end;
+        }
+        mp->line[len - 1] = '\0';
+        if (len == 1)
+        {
+            mp->state = MP_CONTENT;
+            mp->status = mp->cb(PART_BEGIN, mp->last, NULL, 0, mp->arg);
+            return p;
+        }
+        if (parse_part_header(mp->last, mp->line) < 0)
+        {
+            mp->status = -1;
+            return end;
+        }
+    }
+    return end;
+}
+
+/**
+ * Parse a fragment of a multipart body
+ * The delimiters are searched with the Boyer-Moore-Horspool algorithm, the content between
+ * them reaches the callback without being copied, except for the few bytes at the end of a
+ * fragment that may start a delimiter: they are held back until the next one. The headers
+ * of a part are parsed a line at a time, only Content-Disposition and Content-Type are kept.
+ * 
+ * @param mp a pointer to the multipart_t struct
+ * @param data the fragment
+ * @param len the length of the fragment
+ * @return 0 to go on, -1 if the body is malformed or an error occurred, otherwise the status returned by the callback
+*/
+int feed_multipart(multipart_t *mp, const char *data, size_t len)
+{
+    const char *p = data, *end = data + len;
+    while (mp->status == 0 && p < end)
+    {
+        switch (mp->state)
+        {
+        case MP_PREAMBLE:
+        case MP_CONTENT:
+            p = scan_content(mp, p, end);
+            break;
+        case MP_HEADERS:
+            p = read_headers(mp, p, end);
+            break;
+        case MP_EPILOGUE:
+            p = end;
+            break;
+        default:
+            p = read_boundary(mp, p, end);
+            break;
+        }
+    }
+    return mp->status;
+}
+
+/**
+ * Check if a multipart body has ended
+ * 
+ * @param mp a pointer to the multipart_t struct, NULL is taken as a body that did not start
+ * @return 1 if the final delimiter was received, 0 otherwise
+*/
+int multipart_done(const multipart_t *mp)
+{
+    return mp != NULL && mp->status == 0 && mp->state == MP_EPILOGUE;
+}
+
+/**
+ * Create the file receiving the content of a part in the upload path
+ * 
+ * @return 0 on success, -1 if an error occurred
+*/
+static int open_upload(part_t *part)
+{
+    size_t size = strlen(upload_path) + sizeof("/upload-XXXXXX");
+    char *path = (char *)mem_alloc(size);
+    if (path == NULL)
+    {
+        perror("[-]Error allocating upload path");
+        return -1;
+    }
+    snprintf(path, size, "%s/upload-XXXXXX", upload_path);
+    int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror("[-]Error creating upload file");
+        mem_free(path);
+        return -1;
+    }
+    part->path = path;
+    part->fd = fd;
+    return 0;
+}
+
+/**
+ * Write content to the file of a part
+ * 
+ * @return 0 on success, -1 if an error occurred
+*/
+static int write_upload(part_t *part, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t written = write(part->fd, data, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("[-]Error writing upload file");
+            return -1;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/**
+ * Append content to a field kept in memory, grown by doubling
+ * 
+ * @return 0 on success, 413 if the field is too long, 500 if an error occurred
+*/
+static int keep_field(part_t *part, const char *data, size_t len)
+{
+    if (part->len > MULTIPART_MAX_FIELD)
+        return 413;
+    size_t used = part->len - len;
+    if (part->len + 1 > part->size)
+    {
+        size_t size = part->size == 0 ? 64 : part->size;
+        while (size < part->len + 1)
+            size *= 2;
+        char *value = (char *)mem_alloc(size);
+        if (value == NULL)
+        {
+            perror("[-]Error allocating field");
+            return 500;
+        }
+        if (part->data != NULL)
+            memcpy(value, part->data, used);
+        mem_free((char *)part->data);
+        part->data = value;
+        part->size = size;
+    }
+    char *value = (char *)part->data;
+    memcpy(value + used, data, len);
+    value[part->len] = '\0';
+    return 0;
+}
+
+/**
+ * Store the parts of a body for store_multipart
+*/
+static int store_part(part_event_t event, part_t *part, const char *data, size_t len, void *arg)
+{
+    request_t *req = (request_t *)arg;
+    if (event == PART_BEGIN)
+    {
+        if (req->body.parts == NULL)
+            req->body.parts = part;
+        return part->filename != NULL && open_upload(part) < 0 ? 500 : 0;
+    }
+    if (event == PART_DATA)
+    {
+        if (part->filename == NULL)
+            return keep_field(part, data, len);
+        return write_upload(part, data, len) < 0 ? 500 : 0;
+    }
+    if (part->filename != NULL)
+    {
+        int result = close(part->fd);
+        part->fd = -1;
+        if (result < 0)
+        {
+            perror("[-]Error closing upload file");
+            return 500;
+        }
+        return 0;
+    }
+    node_t *node = param_nodes(req, 1);
+    if (node == NULL)
+        return 500;
+    node->key = part->name;
+    node->value = part->data != NULL ? (char *)part->data : "";
+    node->next = req->body.params;
+    req->body.params = node;
+    req->body.n_params++;
+    return 0;
+}
+
+/**
+ * Store a multipart/form-data body, a body_callback for add_body_route
+ * The files are written as they arrive to new files in the upload path (see
+ * set_upload_path) and the other fields are kept in memory, up to MULTIPART_MAX_FIELD
+ * bytes each, and added to the params. The route callback finds the parts in
+ * req->body.parts and the parser in req->body.state: multipart_done tells whether the
+ * whole body arrived. The files are removed with the request unless they are moved
+ * with save_part. The writes go to the page cache, the event loop only blocks if it is
+ * full.
+ * 
+ * @param req the request
+ * @param data the fragment of the body
+ * @param len the length of the fragment
+ * @return 0 to go on, 415 if the body is not multipart/form-data, 400 if it is malformed, 413 if a field is too long, 500 if a file could not be written
+*/
+int store_multipart(request_t *req, const char *data, size_t len)
+{
+    multipart_t *mp = (multipart_t *)req->body.state;
+    if (mp == NULL)
+    {
+        if ((mp = (multipart_t *)mem_alloc(sizeof(multipart_t))) == NULL)
+        {
+            perror("[-]Error allocating multipart parser");
+            return 500;
+        }
+        if (init_multipart(mp, get_known_header(req, HEADER_CONTENT_TYPE), store_part, req) < 0)
+        {
+            mem_free(mp);
+            return 415;
+        }
+        req->body.state = mp;
+    }
+    int status = feed_multipart(mp, data, len);
+    return status < 0 ? 400 : status;
+}
+
+/**
+ * Set the upload path
+ * This function sets the directory where store_multipart writes the uploaded files, /tmp
+ * by default.
+ * 
+ * @param path the upload path
+*/
+void set_upload_path(char *path)
+{
+    upload_path = path;
+}
+
+/**
+ * Keep the file of a part
+ * The file is moved to path, which must be on the same filesystem as the upload path,
+ * and is no longer removed with the request.
+ * 
+ * @param part the part, its file completely written
+ * @param path the new path of the file
+ * @return 0 on success, -1 otherwise
+*/
+int save_part(part_t *part, const char *path)
+{
+    if (part->path == NULL || part->fd >= 0 || !part->complete)
+        return -1;
+    if (rename(part->path, path) < 0)
+    {
+        perror("[-]Error saving upload file");
+        return -1;
+    }
+    part->path = NULL;
+    return 0;
+}
+
+/**
+ * Release the files of parts
+ * The files still open are closed and the files that were not saved are removed.
+ * 
+ * @param parts the first part of the list, NULL is ignored
+*/
+void release_parts(part_t *parts)
+{
+    for (part_t *part = parts; part != NULL; part = part->next)
+    {
+        if (part->fd >= 0)
+            close(part->fd);
+        part->fd = -1;
+        if (part->path != NULL)
+            unlink(part->path);
+        part->path = NULL;
+    }
+}
+
+/**
+ * Free parts allocated without an arena
+ * Their files are released first like with release_parts, then the parts and what they
+ * hold are freed. The content of a part is only freed when store_multipart copied it.
+ * 
+ * @param parts the first part of the list, NULL is ignored
+*/
+void free_parts(part_t *parts)
+{
+    while (parts != NULL)
+    {
+        part_t *next = parts->next;
+        char *path = parts->path;
+        parts->next = NULL;
+        release_parts(parts);
+        free(path);
+        if (parts->name != no_name)
+            free(parts->name);
+        free(parts->filename);
+        free(parts->content_type);
+        if (parts->size > 0)
+            free((char *)parts->data);
+        free(parts);
+        parts = next;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,161 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/multipart.h
+ * @brief provides a streaming multipart/form-data parser and a body callback storing the uploaded files
+*/
+
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include "http_data.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define MULTIPART_MAX_BOUNDARY 70   // longest boundary allowed by RFC 2046
+#define MULTIPART_MAX_LINE 1024     // longest header line of a part
+#define MULTIPART_MAX_FIELD 65536   // longest field kept in memory by store_multipart
+
+// part of a multipart/form-data body
+typedef struct part_t
+{
+    char *name;             // name of the field from Content-Disposition, "" if there is none
+    char *filename;         // name of the file sent by the client, NULL for a plain field
+    char *content_type;     // NULL if the part has none
+    const char *data;       // content kept in memory, NUL terminated for a field, NULL if there is none or it was stored in a file
+    size_t len;             // bytes of content received
+    size_t size;            // capacity of data while store_multipart builds it
+    char *path;             // file holding the content, NULL if none, see store_multipart and save_part
+    int fd;                 // open while the content is written to path, -1 otherwise
+    int complete;           // the delimiter ending the part was received
+    struct part_t *next;
+}part_t;
+
+typedef enum
+{
+    PART_BEGIN,             // the headers of the part are parsed
+    PART_DATA,              // a fragment of the content
+    PART_END                // the delimiter ending the part was received
+}part_event_t;
+
+/**
+ * Handle an event of a multipart parser
+ * 
+ * @param event the event
+ * @param part the part, allocated with mem_alloc (see arena.h) and valid as long as the parser
+ * @param data the fragment of the content for PART_DATA, only valid during the call, NULL otherwise
+ * @param len the length of the fragment, never 0 for PART_DATA
+ * @param arg the argument given to init_multipart
+ * @return 0 to go on, otherwise the status returned by feed_multipart
+*/
+typedef int (*part_callback)(part_event_t event, part_t *part, const char *data, size_t len, void *arg);
+
+typedef struct multipart_t
+{
+    char delimiter[4 + MULTIPART_MAX_BOUNDARY];    // CRLF "--" boundary
+    size_t delimiter_len;
+    uint8_t shift[256];     // Horspool shift of each byte, the distance from its last occurrence to the end of the delimiter
+    int state;
+    int status;             // why the parser stopped, 0 if it did not
+    char held[4 + MULTIPART_MAX_BOUNDARY];  // end of the last fragment that may start a delimiter
+    size_t held_len;
+    char line[MULTIPART_MAX_LINE];  // header line of a part being received
+    size_t line_len;
+    part_t *parts;          // the parts received so far, in order
+    part_t *last;           // the last of them, being received unless it is complete
+    part_callback cb;
+    void *arg;
+}multipart_t;
+
+/**
+ * Initialize a multipart parser
+ * 
+ * @param mp a pointer to the multipart_t struct
+ * @param content_type the Content-Type of the body, its boundary parameter delimits the parts
+ * @param cb the callback receiving the parts
+ * @param arg the argument passed to cb
+ * @return 0 on success, -1 if the Content-Type is not multipart/form-data with a valid boundary
+*/
+extern int init_multipart(multipart_t *mp, const char *content_type, part_callback cb, void *arg);
+
+/**
+ * Parse a fragment of a multipart body
+ * The delimiters are searched with the Boyer-Moore-Horspool algorithm, the content between
+ * them reaches the callback without being copied, except for the few bytes at the end of a
+ * fragment that may start a delimiter: they are held back until the next one. The headers
+ * of a part are parsed a line at a time, only Content-Disposition and Content-Type are kept.
+ * 
+ * @param mp a pointer to the multipart_t struct
+ * @param data the fragment
+ * @param len the length of the fragment
+ * @return 0 to go on, -1 if the body is malformed or an error occurred, otherwise the status returned by the callback
+*/
+extern int feed_multipart(multipart_t *mp, const char *data, size_t len);
+
+/**
+ * Check if a multipart body has ended
+ * 
+ * @param mp a pointer to the multipart_t struct, NULL is taken as a body that did not start
+ * @return 1 if the final delimiter was received, 0 otherwise
+*/
+extern int multipart_done(const multipart_t *mp);
+
+/**
+ * Store a multipart/form-data body, a body_callback for add_body_route
+ * The files are written as they arrive to new files in the upload path (see
+ * set_upload_path) and the other fields are kept in memory, up to MULTIPART_MAX_FIELD
+ * bytes each, and added to the params. The route callback finds the parts in
+ * req->body.parts and the parser in req->body.state: multipart_done tells whether the
+ * whole body arrived. The files are removed with the request unless they are moved
+ * with save_part. The writes go to the page cache, the event loop only blocks if it is
+ * full.
+ * 
+ * @param req the request
+ * @param data the fragment of the body
+ * @param len the length of the fragment
+ * @return 0 to go on, 415 if the body is not multipart/form-data, 400 if it is malformed, 413 if a field is too long, 500 if a file could not be written
+*/
+extern int store_multipart(request_t *req, const char *data, size_t len);
+
+/**
+ * Set the upload path
+ * This function sets the directory where store_multipart writes the uploaded files, /tmp
+ * by default.
+ * 
+ * @param path the upload path
+*/
+extern void set_upload_path(char *path);
+
+/**
+ * Keep the file of a part
+ * The file is moved to path, which must be on the same filesystem as the upload path,
+ * and is no longer removed with the request.
+ * 
+ * @param part the part, its file completely written
+ * @param path the new path of the file
+ * @return 0 on success, -1 otherwise
+*/
+extern int save_part(part_t *part, const char *path);
+
+/**
+ * Release the files of parts
+ * The files still open are closed and the files that were not saved are removed.
+ * 
+ * @param parts the first part of the list, NULL is ignored
+*/
+extern void release_parts(part_t *parts);
+
+/**
+ * Free parts allocated without an arena
+ * Their files are released first like with release_parts, then the parts and what they
+ * hold are freed. The content of a part is only freed when store_multipart copied it.
+ * 
+ * @param parts the first part of the list, NULL is ignored
+*/
+extern void free_parts(part_t *parts);
+
+#endif // MULTIPART_H
\ No newline at end of file
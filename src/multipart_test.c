@@ -0,0 +1,239 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/multipart_test.c
+ * @brief tests of the streaming multipart parser of multipart.h
+*/
+
+#include "multipart.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("[-]%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+// events received by record, written as "[name]content|" for each part
+typedef struct
+{
+    char text[1024];
+    size_t len;
+    int stop;               // status returned at the first PART_DATA, 0 to go on
+}events_t;
+
+static void append(events_t *events, const char *data, size_t len)
+{
+    if (events->len + len < sizeof(events->text))
+    {
+        memcpy(events->text + events->len, data, len);
+        events->len += len;
+        events->text[events->len] = '\0';
+    }
+}
+
+static int record(part_event_t event, part_t *part, const char *data, size_t len, void *arg)
+{
+    events_t *events = (events_t *)arg;
+    if (event == PART_BEGIN)
+    {
+        append(events, "[", 1);
+        append(events, part->name, strlen(part->name));
+        append(events, "]", 1);
+    }
+    else if (event == PART_DATA)
+    {
+        if (len == 0)
+            append(events, "<empty>", 7);
+        append(events, data, len);
+        return events->stop;
+    }
+    else
+        append(events, "|", 1);
+    return 0;
+}
+
+/**
+ * Feed a body through a parser in fragments of step bytes at most
+ * Each fragment is a copy freed right after feed_multipart, so the parser cannot read the
+ * bytes of an earlier one.
+ * 
+ * @return the result of the last feed_multipart
+*/
+static int feed(multipart_t *mp, const char *body, size_t step)
+{
+    size_t len = strlen(body);
+    int status = 0;
+    for (size_t pos = 0; pos < len && status == 0; pos += step)
+    {
+        size_t n = pos + step < len ? step : len - pos;
+        char *fragment = (char *)malloc(n);
+        memcpy(fragment, body + pos, n);
+        status = feed_multipart(mp, fragment, n);
+        memset(fragment, 0, n);
+        free(fragment);
+    }
+    return status;
+}
+
+static void test_init()
+{
+    multipart_t mp;
+    events_t events = {0};
+    CHECK(init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events) == 0);
+    CHECK(mp.delimiter_len == 7);
+    CHECK(init_multipart(&mp, "multipart/form-data; charset=utf-8; boundary=\"a b\"", record, &events) == 0);
+    CHECK(mp.delimiter_len == 7 && memcmp(mp.delimiter, "\r\n--a b", 7) == 0);
+    CHECK(init_multipart(&mp, "text/plain; boundary=XyZ", record, &events) == -1);
+    CHECK(init_multipart(&mp, "multipart/form-datax; boundary=XyZ", record, &events) == -1);
+    CHECK(init_multipart(&mp, "multipart/form-data", record, &events) == -1);
+    CHECK(init_multipart(&mp, "multipart/form-data; boundary=", record, &events) == -1);
+    CHECK(init_multipart(&mp, "multipart/form-data; boundary=\"XyZ", record, &events) == -1);
+    CHECK(init_multipart(&mp, NULL, record, &events) == -1);
+
+    char type[64 + MULTIPART_MAX_BOUNDARY];
+    int len = sprintf(type, "multipart/form-data; boundary=");
+    memset(type + len, 'b', MULTIPART_MAX_BOUNDARY);
+    type[len + MULTIPART_MAX_BOUNDARY] = '\0';
+    CHECK(init_multipart(&mp, type, record, &events) == 0);
+    strcat(type, "b");
+    CHECK(init_multipart(&mp, type, record, &events) == -1);
+}
+
+static void test_split_body()
+{
+    //the content holds near misses of the delimiter, held back at the end of a fragment
+    //and handed to the callback once the next one shows they are content
+    const char *body = "preamble\r\n--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        "hello\r\n--XyZ  \r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"a \\\"b\\\".txt\"\r\n"
+        "Content-Type: text/plain \r\n\r\n"
+        "line\r\n--Xy not yet\r\n-\r\r\n--XyZ--\r\n"
+        "epilogue --XyZ";
+    const char *expected = "[title]hello|[file]line\r\n--Xy not yet\r\n-\r|";
+    //the delimiters may be split anywhere, even across several fragments
+    for (size_t step = 1; step <= strlen(body); step++)
+    {
+        multipart_t mp;
+        events_t events = {0};
+        CHECK(init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events) == 0);
+        CHECK(feed(&mp, body, step) == 0);
+        CHECK(multipart_done(&mp));
+        CHECK(strcmp(events.text, expected) == 0);
+
+        part_t *part = mp.parts;
+        CHECK(part != NULL && strcmp(part->name, "title") == 0);
+        CHECK(part != NULL && part->filename == NULL && part->content_type == NULL);
+        CHECK(part != NULL && part->len == 5 && part->complete);
+        part = part != NULL ? part->next : NULL;
+        CHECK(part != NULL && strcmp(part->name, "file") == 0);
+        CHECK(part != NULL && part->filename != NULL && strcmp(part->filename, "a \"b\".txt") == 0);
+        CHECK(part != NULL && part->content_type != NULL && strcmp(part->content_type, "text/plain") == 0);
+        CHECK(part != NULL && part->len == 22 && part->complete);
+        CHECK(part != NULL && part->next == NULL && mp.last == part);
+        free_parts(mp.parts);
+    }
+}
+
+static void test_no_preamble()
+{
+    //the first delimiter has no CRLF before it when the body starts with it
+    const char *body = "--XyZ\r\n\r\n\r\n--XyZ\r\nContent-Disposition: form-data\r\n\r\nx\r\n--XyZ--";
+    for (size_t step = 1; step <= strlen(body); step++)
+    {
+        multipart_t mp;
+        events_t events = {0};
+        init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events);
+        CHECK(feed(&mp, body, step) == 0);
+        CHECK(multipart_done(&mp));
+        CHECK(strcmp(events.text, "[]|[]x|") == 0);
+        free_parts(mp.parts);
+    }
+}
+
+static void test_incomplete()
+{
+    multipart_t mp;
+    events_t events = {0};
+    init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events);
+    CHECK(feed(&mp, "--XyZ\r\n\r\nabc\r\n--Xy", 64) == 0);
+    CHECK(!multipart_done(&mp));
+    //the start of the delimiter is held back, it may still end the part
+    CHECK(strcmp(events.text, "[]abc") == 0);
+    CHECK(mp.parts != NULL && !mp.parts->complete);
+    CHECK(!multipart_done(NULL));
+    free_parts(mp.parts);
+}
+
+static void test_malformed()
+{
+    const char *bodies[] = {
+        "--XyZx\r\n\r\n",                   //byte after the boundary
+        "--XyZ-x",                          //single dash
+        "--XyZ\rx",                         //CR without LF after the boundary
+        "--XyZ\r\nName: x\n\r\n",           //bare LF ending a header line
+        "--XyZ\r\n\n",                      //bare LF ending the headers
+    };
+    for (size_t i = 0; i < sizeof(bodies) / sizeof(bodies[0]); i++)
+    {
+        for (size_t step = 1; step <= strlen(bodies[i]); step++)
+        {
+            multipart_t mp;
+            events_t events = {0};
+            init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events);
+            CHECK(feed(&mp, bodies[i], step) == -1);
+            CHECK(!multipart_done(&mp));
+            free_parts(mp.parts);
+        }
+    }
+
+    //a header line longer than MULTIPART_MAX_LINE
+    static char body[MULTIPART_MAX_LINE + 64];
+    memset(body, 'a', sizeof(body) - 1);
+    memcpy(body, "--XyZ\r\nX: ", 10);
+    multipart_t mp;
+    events_t events = {0};
+    init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events);
+    CHECK(feed(&mp, body, 256) == -1);
+    free_parts(mp.parts);
+}
+
+static void test_callback_status()
+{
+    //the status of the callback stops the parser and is returned from then on
+    multipart_t mp;
+    events_t events = {0};
+    events.stop = 413;
+    init_multipart(&mp, "multipart/form-data; boundary=XyZ", record, &events);
+    CHECK(feed(&mp, "--XyZ\r\n\r\nabc\r\n--XyZ\r\n\r\ndef\r\n--XyZ--", 64) == 413);
+    CHECK(feed_multipart(&mp, "x", 1) == 413);
+    CHECK(!multipart_done(&mp));
+    CHECK(strcmp(events.text, "[]abc") == 0);
+    free_parts(mp.parts);
+}
+
+int main()
+{
+    test_init();
+    test_split_body();
+    test_no_preamble();
+    test_incomplete();
+    test_malformed();
+    test_callback_status();
+    if (failures > 0)
+        printf("[-]%d checks failed\n", failures);
+    return failures > 0;
+}
@@ -10,17 +10,21 @@
 */
 
 #include "process_request.h"
-#include <regex.h>
+#include "scan.h"
+#include "arena.h"
+#include "json.h"
+#include "multipart.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <strings.h>
 
 /**
  * Check if a key is valid
  * This function checks if a key is valid, i.e. if it contains at least one non-whitespace character.
- *
+ * 
  * @param key the key to check
  * @return 1 if the key is valid, 0 otherwise
  */
@@ -36,233 +40,475 @@ int is_valid_key(const char *key)
 }
 
 /**
- * Add queries to the request_t struct
+ * Decode a component of a query string or a form
+ * '+' becomes a space and %XX the byte it encodes, a '%' not followed by two hex digits is
+ * kept as it is. The decoded bytes are written forward, out may overlap in.
  * 
+ * @param out where the decoded component is written, NUL terminated, at most in
+ * @param in the component
+ * @param len the length of the component
+ * @return the byte after the NUL
 */
-int process_query(request_t *req, char *buffer)
+static char *decode_component(char *out, const char *in, size_t len)
 {
-    int n_params = 0;
-
-    char *end_path = strchr(buffer, '?');
-    if (end_path == NULL)
-        return 0;
-
-    char *copy = strdup(end_path + 1);
-    if (copy == NULL)
+    const char *end = in + len;
+    while (in < end)
     {
-        perror("[-]Error allocating memory");
-        return -1;
+        int high, low;
+        if (*in == '+')
+            *out++ = ' ';
+        else if (*in == '%' && end - in > 2 && (high = hex_value(in[1])) >= 0 && (low = hex_value(in[2])) >= 0)
+        {
+            *out++ = (char)(high << 4 | low);
+            in += 2;
+        }
+        else
+            *out++ = *in;
+        in++;
     }
+    *out = '\0';
+    return out + 1;
+}
 
-    req->path = strndup(buffer, end_path - buffer);
-
-    char *token = strtok(copy, "&");
-
-    while (token != NULL)
+/**
+ * Add the key=value pairs of a query string or a form to the params
+ * The pairs are decoded into the buffer one after the other, each key and value NUL
+ * terminated: the params point into it and nothing is copied. A pair never grows when
+ * decoded, so with one more byte for the terminators the output stays behind the input.
+ * The params are linked in order in front of the params already there.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param out where the decoded pairs are written, buffer if buffer[size] can be overwritten, buffer - 1 if the byte before can
+ * @param buffer the pairs
+ * @param size the length of the pairs
+ * @return 0 if the function was successful, -1 if a key is empty or an error occurred
+*/
+static int process_pairs(request_t *req, char *out, char *buffer, size_t size)
+{
+    char *end = buffer + size;
+    size_t max = 1;
+    for (char *p = buffer; (p = memchr(p, '&', end - p)) != NULL; p++)
+        max++;
+    node_t *nodes = param_nodes(req, max);
+    if (nodes == NULL)
+        return -1;
+    size_t n = 0;
+    while (buffer < end)
     {
-        char *value = "", *end_key = strchr(token, '=');
-        if (end_key != NULL)
+        char *end_pair = memchr(buffer, '&', end - buffer);
+        if (end_pair == NULL)
+            end_pair = end;
+        if (end_pair != buffer)
         {
-            value = strdup(end_key + 1);
-            if (value == NULL)
-            {
-                perror("[-]Error allocating memory");
-                free(copy);
+            char *end_key = memchr(buffer, '=', end_pair - buffer);
+            char *key = out;
+            out = decode_component(out, buffer, (end_key != NULL ? end_key : end_pair) - buffer);
+            if (!is_valid_key(key))
                 return -1;
+            nodes[n].key = key;
+            nodes[n].value = "";
+            if (end_key != NULL)
+            {
+                nodes[n].value = out;
+                out = decode_component(out, end_key + 1, end_pair - end_key - 1);
             }
+            nodes[n].next = &nodes[n + 1];
+            n++;
         }
-        char *key = strndup(token, end_key - token);
-        if (key == NULL)
-        {
-            perror("[-]Error allocating memory");
-            free(copy);
-            return -1;
-        }
-        if (!is_valid_key(key))
-        {
-            free(copy);
-            free(key);
-            return -1;
-        }
-
-        add_param(&(req->body.params), key, value);
-        n_params++;
-        token = strtok(NULL, "&");
-        free(key);
-        free(value);
+        buffer = end_pair + 1;
     }
-    req->body.n_params = n_params;
-    free(copy);
+    if (n == 0)
+        return 0;
+    nodes[n - 1].next = req->body.params;
+    req->body.params = nodes;
+    req->body.n_params += n;
     return 0;
 }
 
 /**
- * Parse the metadata of a request
- * This function parses the first line of a request and stores the method, path and version in the request_t struct.
- * Call process_query to parse the query string
- *
+ * Add queries to the request_t struct
+ * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the first line of the request
+ * @param query the query string, without the '?'
+ * @param size the length of the query string
  * @return 0 if the function was successful, -1 otherwise
- */
-int parse_first_line(request_t *req, char *buffer)
+*/
+int process_query(request_t *req, char *query, size_t size)
 {
-    char *copy = strdup(buffer);
-    if (copy == NULL)
-    {
-        perror("[-]Error allocating memory");
-        return -1;
-    }
-    regex_t regex;
-    regmatch_t match[4];
-    char *pattern = "([A-Z]+) ([^ ]+) HTTP/([0-9].[0-1])";
-    if (regcomp(&regex, pattern, REG_EXTENDED) != 0)
+    //the byte after the query string ends the request line, the one before ends the path
+    return process_pairs(req, query, query, size);
+}
+
+/**
+ * Initialize a parser
+ * This function resets a parser to the beginning of a new request.
+ * 
+ * @param parser a pointer to the http_parser_t struct
+*/
+void init_parser(http_parser_t *parser)
+{
+    parser->state = PARSE_FIRST_LINE;
+    parser->pos = 0;
+    parser->line = 0;
+    parser->head_len = 0;
+    parser->n_headers = 0;
+    parser->content_length = 0;
+    parser->chunked = 0;
+    parser->codings = 0;
+}
+
+/**
+ * Move a slice to another buffer
+*/
+static void rebase_slice(slice_t *slice, char *old, char *buffer)
+{
+    if (slice->data != NULL)
+        slice->data = buffer + (slice->data - old);
+}
+
+/**
+ * Move a parser to another buffer
+ * This function points the slices of the parser at a copy of the buffer they were taken from.
+ * It must be called before the old buffer is freed and before fill_request.
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @param old the buffer the slices point into
+ * @param buffer the copy of the buffer
+*/
+void rebase_parser(http_parser_t *parser, char *old, char *buffer)
+{
+    if (parser->state == PARSE_FIRST_LINE)
+        return;
+    rebase_slice(&parser->method, old, buffer);
+    rebase_slice(&parser->path, old, buffer);
+    rebase_slice(&parser->query, old, buffer);
+    rebase_slice(&parser->version, old, buffer);
+    for (size_t i = 0; i < parser->n_headers; i++)
     {
-        perror("[-]Error compiling regex");
-        free(copy);
-        return -1;
+        rebase_slice(&parser->keys[i], old, buffer);
+        rebase_slice(&parser->values[i], old, buffer);
     }
-    if (regexec(&regex, copy, 4, match, 0) != 0)
-    {
-        perror("[-]Error parsing invalid request line");
-        regfree(&regex);
-        free(copy);
+}
+
+/**
+ * Parse the request line: METHOD SP target SP HTTP/x.y
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @param line the line, without the line terminator
+ * @param len the length of the line
+ * @return 0 if the line is valid, -4 if the major version is not 1, -1 otherwise
+*/
+static int parse_first_line(http_parser_t *parser, char *line, size_t len)
+{
+    char *end = line + len;
+    char *p = line;
+    while (p < end && *p >= 'A' && *p <= 'Z')
+        p++;
+    if (p == line || p == end || *p != ' ')
         return -1;
-    }
-    req->method = strndup(copy + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-    req->path = strndup(copy + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
-    req->version = strndup(copy + match[3].rm_so, match[3].rm_eo - match[3].rm_so);
+    parser->method.data = line;
+    parser->method.len = p - line;
 
-    if (process_query(req, req->path) < 0)
-    {
-        perror("[-]Error processing query");
-        regfree(&regex);
-        free(copy);
+    char *target = ++p;
+    if ((p = scan_byte(target, end, ' ')) == NULL || p == target)
         return -1;
+    char *query = scan_byte(target, p, '?');
+    parser->path.data = target;
+    parser->path.len = (query != NULL ? query : p) - target;
+    parser->query.data = NULL;
+    parser->query.len = 0;
+    if (query != NULL)
+    {
+        parser->query.data = query + 1;
+        parser->query.len = p - query - 1;
     }
+    if (parser->path.len == 0)
+        return -1;
 
-    regfree(&regex);
-    free(copy);
+    p++;
+    if (end - p != 8 || memcmp(p, "HTTP/", 5) != 0 || !isdigit((unsigned char)p[5]) || p[6] != '.' || !isdigit((unsigned char)p[7]))
+        return -1;
+    if (p[5] != '1')
+        return -4;
+    if (p[7] != '0' && p[7] != '1')
+        return -1;
+    parser->version.data = p + 5;
+    parser->version.len = 3;
     return 0;
 }
 
 /**
- * Parse the headers of a request
- * This function parses the headers of a request and stores them in the request_t struct.
+ * Parse a header line: name ":" OWS value OWS
  * 
- * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the headers of the request
- * @return 0 if the function was successful, -1 otherwise
+ * @param parser a pointer to the http_parser_t struct
+ * @param line the line, without the line terminator
+ * @param len the length of the line
+ * @return 0 if the line is valid, -1 if it is malformed, -2 if there are too many headers
 */
-int parse_headers(request_t *req, char *buffer)
+static int parse_header(http_parser_t *parser, char *line, size_t len)
 {
-    char *copy = strdup(buffer);
-    if (copy == NULL)
-    {
-        perror("[-]Error allocating memory");
+    char *end = line + len;
+    char *p = scan_byte(line, end, ':');
+    if (p == NULL || p == line || scan_token(line, p) != p)
         return -1;
+    if (parser->n_headers == MAX_HEADERS)
+        return -2;
+    slice_t *key = &parser->keys[parser->n_headers];
+    slice_t *value = &parser->values[parser->n_headers];
+    key->data = line;
+    key->len = p - line;
+
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    value->data = p;
+    value->len = end - p;
+    header_id_t id = header_id(key->data, key->len);
+    parser->ids[parser->n_headers++] = (uint8_t)id;
+
+    if (id == HEADER_CONTENT_LENGTH)
+    {
+        if (value->len == 0 || value->len > 18)
+            return -1;
+        size_t length = 0;
+        for (size_t i = 0; i < value->len; i++)
+        {
+            if (!isdigit((unsigned char)value->data[i]))
+                return -1;
+            length = length * 10 + (value->data[i] - '0');
+        }
+        //a repeated Content-Length must not change the length of the body (RFC 9110 8.6),
+        //a first "Content-Length: 0" included
+        for (size_t i = 0; i + 1 < parser->n_headers; i++)
+        {
+            if (parser->ids[i] == HEADER_CONTENT_LENGTH && parser->content_length != length)
+                return -1;
+        }
+        parser->content_length = length;
     }
-    char *token = strtok(copy, "\r\n");
-    while (token != NULL)
+    else if (id == HEADER_TRANSFER_ENCODING)
     {
-        regex_t regex;
-        regmatch_t match[3];
-        char *pattern = "([^:]+): (.+)";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0)
+        //the codings of repeated headers add up, chunked can only be the last one (RFC 9112 6.1)
+        char *coding = value->data;
+        while (coding < end)
         {
-            perror("[-]Error compiling regex");
-            free(copy);
+            char *comma = scan_byte(coding, end, ',');
+            char *last = comma != NULL ? comma : end;
+            while (coding < last && (*coding == ' ' || *coding == '\t'))
+                coding++;
+            while (last > coding && (last[-1] == ' ' || last[-1] == '\t'))
+                last--;
+            if (last > coding)
+            {
+                if (parser->chunked)
+                    return -1;
+                parser->chunked = last - coding == 7 && strncasecmp(coding, "chunked", 7) == 0;
+                parser->codings++;
+            }
+            coding = comma != NULL ? comma + 1 : end;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check how the length of the body of a parsed head is given
+ * A chunked body cannot have a Content-Length too and an HTTP/1.0 peer cannot send one,
+ * those requests could be framed differently by a proxy in front (RFC 9112 6.3).
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @return 0 if the framing is valid, -1 if the request is malformed, -3 if a transfer coding is not supported
+*/
+static int check_framing(http_parser_t *parser)
+{
+    if (parser->codings == 0)
+        return 0;
+    if (!parser->chunked || memcmp(parser->version.data, "1.1", 3) < 0)
+        return -1;
+    for (size_t i = 0; i < parser->n_headers; i++)
+    {
+        if (parser->ids[i] == HEADER_CONTENT_LENGTH)
             return -1;
+    }
+    return parser->codings > 1 ? -3 : 0;
+}
+
+/**
+ * Parse the head of a request
+ * This function scans the request line and the headers in the buffer and stores them as
+ * slices of the buffer, nothing is copied. When the head is not complete it returns and
+ * the next call resumes from the first byte not scanned yet, so the buffer must only grow
+ * between calls.
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @param buffer the received data, starting with the request line
+ * @param len the length of the received data
+ * @return 1 if the head is complete, parser->head_len is the offset of the body
+ * @return 0 if more data is needed
+ * @return -1 if the request is malformed
+ * @return -2 if the request has more than MAX_HEADERS headers
+ * @return -3 if the body has a transfer coding other than chunked
+ * @return -4 if the major version of HTTP is not 1
+*/
+int parse_request(http_parser_t *parser, char *buffer, size_t len)
+{
+    while (parser->state != PARSE_DONE)
+    {
+        char *lf = scan_byte(buffer + parser->pos, buffer + len, '\n');
+        if (lf == NULL)
+        {
+            parser->pos = len;
+            return 0;
         }
-        if (regexec(&regex, token, 3, match, 0) != 0)
+        char *line = buffer + parser->line;
+        size_t line_len = lf - line;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--;
+        parser->pos = lf - buffer + 1;
+
+        if (parser->state == PARSE_FIRST_LINE)
         {
-            printf("token: %s\n", token);
-            perror("[-]Error parsing request headers");
-            regfree(&regex);
-            free(copy);
-            return -1;
+            //empty lines before the request line are ignored (RFC 9112 2.2)
+            if (line_len > 0)
+            {
+                int result = parse_first_line(parser, line, line_len);
+                if (result < 0)
+                    return result;
+                parser->state = PARSE_HEADERS;
+            }
+        }
+        else if (line_len == 0)
+        {
+            parser->state = PARSE_DONE;
+            parser->head_len = parser->pos;
+            int result = check_framing(parser);
+            if (result < 0)
+                return result;
         }
-        char *key = strndup(token + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-        char *value = strndup(token + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
+        else
+        {
+            int result = parse_header(parser, line, line_len);
+            if (result < 0)
+                return result;
+        }
+        parser->line = parser->pos;
+    }
+    return 1;
+}
 
-        add_header(&(req->headers), key, value);
+/**
+ * Terminate a slice in place
+ * The byte after a slice is always a delimiter of the head that is no longer needed.
+ * 
+ * @return the NUL terminated slice
+*/
+static char *terminate(slice_t slice)
+{
+    slice.data[slice.len] = '\0';
+    return slice.data;
+}
 
-        regfree(&regex);
-        token = strtok(NULL, "\r\n");
-    }
-    free(copy);
-    return 0;
+/**
+ * Get the path of a parsed head
+ * The path is terminated in place ahead of fill_request, so that the route of the request
+ * can be looked up before the room for its body is reserved.
+ * 
+ * @param parser a pointer to a parser that returned 1
+ * @return the NUL terminated path
+*/
+char *parsed_path(http_parser_t *parser)
+{
+    return terminate(parser->path);
 }
 
-int set_body(request_t *req, char *buffer, size_t size)
+/**
+ * Fill a request with a parsed head
+ * This function terminates the slices of the parser in place and points the method, path,
+ * version and headers of the request at them. The query string is decoded in place into
+ * the params.
+ * The request is valid as long as the buffer and the parser are not reused.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param parser a pointer to a parser that returned 1
+ * @return 0 if the function was successful, -1 if the query string is malformed
+*/
+int fill_request(request_t *req, http_parser_t *parser)
 {
-    req->body.data = (char *)malloc(size + 1);
-    if (req->body.data == NULL)
+    req->method_id = parse_method(parser->method.data, parser->method.len);
+    req->method = terminate(parser->method);
+    req->path = terminate(parser->path);
+    req->version = terminate(parser->version);
+    req->headers = NULL;
+    init_header_map(&parser->map, parser->nodes);
+    for (size_t i = 0; i < parser->n_headers; i++)
     {
-        perror("[-]Error setting body");
-        return -1;
+        node_t *node = &parser->nodes[i];
+        node->key = terminate(parser->keys[i]);
+        node->value = terminate(parser->values[i]);
+        node->next = i + 1 < parser->n_headers ? &parser->nodes[i + 1] : NULL;
+        index_header(&parser->map, i, parser->ids[i]);
     }
-    memcpy(req->body.data, buffer, size);
-    req->body.data[size] = '\0';
+    if (parser->n_headers > 0)
+        req->headers = &parser->nodes[0];
+    req->header_map = &parser->map;
+    if (parser->query.data != NULL)
+        return process_query(req, parser->query.data, parser->query.len);
     return 0;
 }
 
 /**
  * Process the json body of a request
- * This function processes the json body of a request and stores it in the request_t struct.
+ * This function parses the json body of a request into req->body.json, see json.h. When
+ * the document is an object its members with a string, number, boolean or null value are
+ * also stored as params, strings decoded and the others as they are written; nested
+ * arrays and objects are only reachable through req->body.json. The params point into
+ * the body like the values on the tape: a number or a literal is NUL terminated in place,
+ * the byte after it is a delimiter the parser has already passed.
  * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the json body
+ * @param buffer the buffer containing the json body, strings are decoded in place
  * @param size the size of the body
  * @return 0 if the function was successful, -1 otherwise
  */
 int process_json(request_t *req, char *buffer, size_t size)
 {
-    int n_params = 0;
-    char *copy = strdup(buffer);
-    if (copy == NULL)
-    {
-        perror("[-]Error allocating memory");
+    json_t *root = parse_json(buffer, size);
+    if (root == NULL)
         return -1;
-    }
-    // read copy line by line
-    char *token = strtok(copy, "\r\n");
-    while (token != NULL)
+    req->body.json = root;
+    if (root->type != JSON_OBJECT)
+        return 0;
+    size_t max = 0;
+    for (json_t *key = json_first(root); key != NULL; key = json_next(root, key))
+        if (key[1].type != JSON_ARRAY && key[1].type != JSON_OBJECT)
+            max++;
+    if (max == 0)
+        return 0;
+    node_t *nodes = param_nodes(req, max);
+    if (nodes == NULL)
+        return -1;
+    size_t n = 0;
+    for (json_t *key = json_first(root); key != NULL; key = json_next(root, key))
     {
-        if (token[0] == '{' || token[0] == '}')
-        {
-            token = strtok(NULL, "\r\n");
+        json_t *value = key + 1;
+        if (value->type == JSON_ARRAY || value->type == JSON_OBJECT)
             continue;
-        }
-        regex_t regex;
-        regmatch_t match[3];
-        char *pattern = "\"([^\"]+)\": \"([^\"]+)\"";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0)
+        nodes[n].key = (char *)json_string(key, NULL);
+        if (value->type == JSON_STRING)
+            nodes[n].value = (char *)json_string(value, NULL);
+        else
         {
-            perror("[-]Error compiling regex");
-            free(copy);
-            return -1;
-        }
-        if (regexec(&regex, token, 3, match, 0) != 0)
-        {
-            perror("[-]Error processing json");
-            regfree(&regex);
-            free(copy);
-            return -1;
+            value->text[value->len] = '\0';
+            nodes[n].value = value->text;
         }
-        char *key = strndup(token + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-        char *value = strndup(token + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
-
-        add_param(&(req->body.params), key, value);
-        n_params++;
-
-        regfree(&regex);
-        token = strtok(NULL, "\r\n");
-        free(key);
-        free(value);
+        nodes[n].next = &nodes[n + 1];
+        n++;
     }
-    req->body.n_params = n_params;
-    free(copy);
+    nodes[n - 1].next = req->body.params;
+    req->body.params = nodes;
+    req->body.n_params += n;
     return 0;
 }
 
@@ -271,76 +517,236 @@ int process_json(request_t *req, char *buffer, size_t size)
  * This function processes the form urlencoded body of a request and stores it in the request_t struct.
  * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the form urlencoded body
+ * @param buffer the buffer containing the form urlencoded body, decoded in place from the byte before it
  * @param size the size of the body
  * @return 0 if the function was successful, -1 otherwise
 */
 int process_urlencoded(request_t *req, char *buffer, size_t size)
 {
-    int n_params = 0;
-    char *copy = strdup(buffer);
-    if (copy == NULL)
+    return process_pairs(req, buffer - 1, buffer, size);
+}
+
+/**
+ * Collect the parts of a multipart body parsed at once for process_multipart
+ * The content of each part comes in one piece pointing into the body, the byte after the
+ * value of a field, the CR of the next delimiter, is overwritten by its NUL.
+*/
+static int collect_part(part_event_t event, part_t *part, const char *data, size_t len, void *arg)
+{
+    request_t *req = (request_t *)arg;
+    (void)len;
+    if (event == PART_DATA)
     {
-        perror("[-]Error allocating memory");
-        return -1;
+        if (part->data != NULL)
+            return -1;
+        part->data = data;
+        return 0;
     }
-    // read copy line by line
-    char *token = strtok(copy, "&");
-    while (token != NULL)
+    if (event == PART_END && part->filename == NULL)
     {
-        regex_t regex;
-        regmatch_t match[3];
-        char *pattern = "([^:]+)=(.+)";
-        if (regcomp(&regex, pattern, REG_EXTENDED) != 0)
-        {
-            perror("[-]Error compiling regex");
-            free(copy);
+        node_t *node = param_nodes(req, 1);
+        if (node == NULL)
             return -1;
-        }
-        if (regexec(&regex, token, 3, match, 0) != 0)
+        node->key = part->name;
+        node->value = "";
+        if (part->data != NULL)
         {
-            perror("[-]Error processing form urlencoded");
-            regfree(&regex);
-            free(copy);
-            return -1;
+            node->value = (char *)part->data;
+            node->value[part->len] = '\0';
         }
-        char *key = strndup(token + match[1].rm_so, match[1].rm_eo - match[1].rm_so);
-        char *value = strndup(token + match[2].rm_so, match[2].rm_eo - match[2].rm_so);
-
-        add_param(&(req->body.params), key, value);
-        n_params++;
-
-        regfree(&regex);
-        token = strtok(NULL, "&");
-        free(key);
-        free(value);
+        node->next = req->body.params;
+        req->body.params = node;
+        req->body.n_params++;
     }
-    req->body.n_params = n_params;
-    free(copy);
     return 0;
 }
 
+/**
+ * Process the multipart/form-data body of a request
+ * This function splits the body into req->body.parts without copying the content of the
+ * parts, the fields that are not files are also stored as params. Bodies that should not
+ * be held in memory are read by a route added with store_multipart instead, see multipart.h.
+ * 
+ * @param req a pointer to the request_t struct
+ * @param buffer the buffer containing the multipart body
+ * @param size the size of the body
+ * @return 0 if the function was successful, -1 otherwise
+*/
+int process_multipart(request_t *req, char *buffer, size_t size)
+{
+    multipart_t mp;
+    if (init_multipart(&mp, get_known_header(req, HEADER_CONTENT_TYPE), collect_part, req) < 0)
+        return -1;
+    int result = feed_multipart(&mp, buffer, size) != 0 || !multipart_done(&mp) ? -1 : 0;
+    req->body.parts = mp.parts; //released with the request even when the body is malformed
+    return result;
+}
+
+/**
+ * Check the media type of a Content-Type header, ignoring its parameters and the case
+ * 
+ * @return 1 if the media type matches, 0 otherwise
+*/
+static int is_content_type(const char *content, const char *type)
+{
+    size_t len = strlen(type);
+    return strncasecmp(content, type, len) == 0 && (content[len] == '\0' || content[len] == ';' || content[len] == ' ' || content[len] == '\t');
+}
+
 /**
  * Parse the body of a request
  * This function parses the body of a request and stores it in the request_t struct.
+ * The body is not copied: req->body.data points into the buffer, where JSON, form and
+ * multipart bodies are then split and decoded in place.
  * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the body of the request
+ * @param buffer the buffer containing the body of the request, preceded by one byte that can be overwritten, it must outlive the request
  * @param size the size of the body
  * @return 0 if the function was successful, -1 otherwise
  */
 int parse_body(request_t *req, char *buffer, size_t size)
 {
-    char *content = search_node(req->headers, "Content-Type")->value;
-    // add deflation here
-    if (strcmp(content, "application/json") == 0)
-        if (process_json(req, buffer, size) < 0)
-            return -1;
-    if (strcmp(content, "application/x-www-form-urlencoded") == 0)
-        if (process_urlencoded(req, buffer, size) < 0)
-            return -1;
-    if (set_body(req, buffer, size) < 0)
-        return -1;
+    //the body stays where it was received, it is held once
+    req->body.data = buffer;
+    req->body.len = size;
+    char *content = get_known_header(req, HEADER_CONTENT_TYPE);
+    if (content == NULL)
+        return 0;
+    int result = 0;
+    if (is_content_type(content, "application/json"))
+        result = process_json(req, buffer, size);
+    else if (is_content_type(content, "application/x-www-form-urlencoded"))
+        result = process_urlencoded(req, buffer, size);
+    else if (is_content_type(content, "multipart/form-data"))
+        result = process_multipart(req, buffer, size);
 
-    return 0;
+    return result;
+}
+
+/**
+ * Initialize a body reader
+ * 
+ * @param reader a pointer to the body_reader_t struct
+ * @param chunked 1 if the body is chunked, 0 if it is length bytes long
+ * @param length the value of Content-Length, ignored for a chunked body
+*/
+void init_body_reader(body_reader_t *reader, int chunked, size_t length)
+{
+    reader->state = chunked ? BODY_CHUNK_SIZE : length > 0 ? BODY_LENGTH : BODY_DONE;
+    reader->remaining = chunked ? 0 : length;
+    reader->line = 0;
+    reader->digits = 0;
+    reader->received = 0;
+}
+
+/**
+ * Read the body of a request as it arrives
+ * The data of a chunk is returned as soon as any of it is there, the framing is scanned a
+ * byte at a time. Bare LFs are refused in the framing, unlike in the head: a chunked body
+ * read differently by a proxy in front would let requests be smuggled past it.
+ * 
+ * @param reader a pointer to the body_reader_t struct
+ * @param buffer the received bytes
+ * @param len the number of received bytes
+ * @param data set to the fragment of the body, empty if the bytes consumed hold none
+ * @return the number of bytes consumed, -1 if the chunked body is malformed
+*/
+ssize_t read_body(body_reader_t *reader, char *buffer, size_t len, slice_t *data)
+{
+    data->data = NULL;
+    data->len = 0;
+    size_t i = 0;
+    while (i < len && reader->state != BODY_DONE)
+    {
+        if (reader->state == BODY_LENGTH || reader->state == BODY_CHUNK_DATA)
+        {
+            size_t n = len - i < reader->remaining ? len - i : reader->remaining;
+            data->data = buffer + i;
+            data->len = n;
+            reader->remaining -= n;
+            reader->received += n;
+            if (reader->remaining == 0)
+                reader->state = reader->state == BODY_LENGTH ? BODY_DONE : BODY_CHUNK_DATA_CR;
+            return i + n;
+        }
+        char c = buffer[i++];
+        if ((reader->state == BODY_CHUNK_SIZE || reader->state == BODY_CHUNK_EXT || reader->state == BODY_TRAILER_LINE) && ++reader->line > MAX_CHUNK_LINE)
+            return -1;
+        switch (reader->state)
+        {
+            case BODY_CHUNK_SIZE:
+            {
+                int value = hex_value(c);
+                if (value >= 0)
+                {
+                    if (reader->remaining > (SIZE_MAX >> 4))
+                        return -1;
+                    reader->remaining = reader->remaining << 4 | value;
+                    reader->digits++;
+                }
+                else if (reader->digits == 0)
+                    return -1;
+                else if (c == ';' || c == ' ' || c == '\t')
+                    reader->state = BODY_CHUNK_EXT;
+                else if (c == '\r')
+                    reader->state = BODY_CHUNK_SIZE_LF;
+                else
+                    return -1;
+                break;
+            }
+            case BODY_CHUNK_EXT:
+                if (c == '\r')
+                    reader->state = BODY_CHUNK_SIZE_LF;
+                else if (c == '\n')
+                    return -1;
+                break;
+            case BODY_CHUNK_SIZE_LF:
+                if (c != '\n')
+                    return -1;
+                reader->line = 0;
+                reader->state = reader->remaining > 0 ? BODY_CHUNK_DATA : BODY_TRAILER;
+                break;
+            case BODY_CHUNK_DATA_CR:
+                if (c != '\r')
+                    return -1;
+                reader->state = BODY_CHUNK_DATA_LF;
+                break;
+            case BODY_CHUNK_DATA_LF:
+                if (c != '\n')
+                    return -1;
+                reader->digits = 0;
+                reader->line = 0;
+                reader->state = BODY_CHUNK_SIZE;
+                break;
+            case BODY_TRAILER:
+                if (c == '\r')
+                    reader->state = BODY_END_LF;
+                else if (c == '\n')
+                    return -1;
+                else
+                {
+                    reader->line = 1;
+                    reader->state = BODY_TRAILER_LINE;
+                }
+                break;
+            case BODY_TRAILER_LINE:
+                if (c == '\r')
+                    reader->state = BODY_TRAILER_LF;
+                else if (c == '\n')
+                    return -1;
+                break;
+            case BODY_TRAILER_LF:
+                if (c != '\n')
+                    return -1;
+                reader->line = 0;
+                reader->state = BODY_TRAILER;
+                break;
+            case BODY_END_LF:
+                if (c != '\n')
+                    return -1;
+                reader->state = BODY_DONE;
+                break;
+        }
+    }
+    return i;
 }
\ No newline at end of file
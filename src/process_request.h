@@ -13,36 +13,170 @@
 #define PROCESS_REQUEST_H
 
 #include "http_data.h"
+#include "header_map.h"
+#include <sys/types.h>
+
+#define MAX_HEADERS 64
+
+enum
+{
+    PARSE_FIRST_LINE = 0,
+    PARSE_HEADERS = 1,
+    PARSE_DONE = 2
+};
+
+typedef struct
+{
+    char *data;
+    size_t len;
+} slice_t;
+
+typedef struct
+{
+    int state;              // PARSE_FIRST_LINE, PARSE_HEADERS or PARSE_DONE
+    size_t pos;             // offset of the first byte not scanned yet
+    size_t line;            // offset of the line being scanned
+    size_t head_len;        // length of the request line and headers, empty line included
+    slice_t method;
+    slice_t path;
+    slice_t query;
+    slice_t version;
+    slice_t keys[MAX_HEADERS];
+    slice_t values[MAX_HEADERS];
+    size_t n_headers;
+    size_t content_length;  // value of the Content-Length header, 0 without it
+    int chunked;            // the body is chunked, the last transfer coding of the request
+    int codings;            // transfer codings of the request, chunked included
+    uint8_t ids[MAX_HEADERS];   // header_id_t of each header
+    node_t nodes[MAX_HEADERS];  // list of headers handed to the request by fill_request
+    header_map_t map;           // index of nodes handed to the request by fill_request
+} http_parser_t;
+
+enum
+{
+    BODY_LENGTH = 0,        // Content-Length bytes
+    BODY_CHUNK_SIZE = 1,
+    BODY_CHUNK_EXT = 2,     // chunk extensions, ignored
+    BODY_CHUNK_SIZE_LF = 3,
+    BODY_CHUNK_DATA = 4,
+    BODY_CHUNK_DATA_CR = 5,
+    BODY_CHUNK_DATA_LF = 6,
+    BODY_TRAILER = 7,       // start of a trailer field or of the empty line ending the body
+    BODY_TRAILER_LINE = 8,  // trailer fields, ignored
+    BODY_TRAILER_LF = 9,
+    BODY_END_LF = 10,
+    BODY_DONE = 11
+};
+
+#define MAX_CHUNK_LINE 4096 // longest chunk size line or trailer field, extensions included
+
+typedef struct
+{
+    int state;              // BODY_LENGTH ... BODY_DONE
+    size_t remaining;       // bytes left in the body or in the current chunk
+    size_t line;            // bytes of the chunk size line or of the trailer field scanned so far
+    int digits;             // hex digits of the chunk size
+    size_t received;        // bytes of the body read so far, chunk framing excluded
+} body_reader_t;
 
 /**
- * Parse the first line of a request
- * This function parses the first line of a request and stores the method, path and version in the request_t struct.
+ * Initialize a parser
+ * This function resets a parser to the beginning of a new request.
  * 
- * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the first line of the request
- * @return 0 if the function was successful, -1 otherwise
+ * @param parser a pointer to the http_parser_t struct
+*/
+extern void init_parser(http_parser_t *parser);
+
+/**
+ * Parse the head of a request
+ * This function scans the request line and the headers in the buffer and stores them as
+ * slices of the buffer, nothing is copied. When the head is not complete it returns and
+ * the next call resumes from the first byte not scanned yet, so the buffer must only grow
+ * between calls.
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @param buffer the received data, starting with the request line
+ * @param len the length of the received data
+ * @return 1 if the head is complete, parser->head_len is the offset of the body
+ * @return 0 if more data is needed
+ * @return -1 if the request is malformed (Content-Length and Transfer-Encoding included)
+ * @return -2 if the request has more than MAX_HEADERS headers
+ * @return -3 if the body has a transfer coding other than chunked
+ * @return -4 if the major version of HTTP is not 1
+*/
+extern int parse_request(http_parser_t *parser, char *buffer, size_t len);
+
+/**
+ * Get the path of a parsed head
+ * The path is terminated in place ahead of fill_request, so that the route of the request
+ * can be looked up before the room for its body is reserved.
+ * 
+ * @param parser a pointer to a parser that returned 1
+ * @return the NUL terminated path
+*/
+extern char *parsed_path(http_parser_t *parser);
+
+/**
+ * Move a parser to another buffer
+ * This function points the slices of the parser at a copy of the buffer they were taken from.
+ * It must be called before the old buffer is freed and before fill_request.
+ * 
+ * @param parser a pointer to the http_parser_t struct
+ * @param old the buffer the slices point into
+ * @param buffer the copy of the buffer
 */
-extern int parse_first_line(request_t *req, char *buffer);
+extern void rebase_parser(http_parser_t *parser, char *old, char *buffer);
 
 /**
- * Parse the headers of a request
- * This function parses the headers of a request and stores them in the request_t struct.
+ * Fill a request with a parsed head
+ * This function terminates the slices of the parser in place and points the method, path,
+ * version and headers of the request at them. The query string is decoded in place into
+ * the params.
+ * The request is valid as long as the buffer and the parser are not reused.
  * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the headers of the request
- * @return 0 if the function was successful, -1 otherwise
+ * @param parser a pointer to a parser that returned 1
+ * @return 0 if the function was successful, -1 if the query string is malformed
 */
-extern int parse_headers(request_t *req, char *buffer);
+extern int fill_request(request_t *req, http_parser_t *parser);
 
 /**
  * Parse the body of a request
  * This function parses the body of a request and stores it in the request_t struct.
+ * The body is not copied: req->body.data points into the buffer, where JSON, form and
+ * multipart bodies are then split and decoded in place.
  * 
  * @param req a pointer to the request_t struct
- * @param buffer the buffer containing the body of the request
+ * @param buffer the buffer containing the body of the request, preceded by one byte that can be overwritten, it must outlive the request
  * @param size the size of the body
  * @return 0 if the function was successful, -1 otherwise
  */
 extern int parse_body(request_t *req, char *buffer, size_t size);
 
+/**
+ * Initialize a body reader
+ * 
+ * @param reader a pointer to the body_reader_t struct
+ * @param chunked 1 if the body is chunked, 0 if it is length bytes long
+ * @param length the value of Content-Length, ignored for a chunked body
+*/
+extern void init_body_reader(body_reader_t *reader, int chunked, size_t length);
+
+/**
+ * Read the body of a request as it arrives
+ * This function scans received bytes up to the next fragment of the body and returns it
+ * as a slice of the buffer, chunk sizes, extensions and trailer fields are consumed on the
+ * way. The reader keeps its state between calls, so a chunk size line or the framing
+ * around a chunk may be split across reads and nothing needs to be kept in the buffer:
+ * the bytes consumed can be dropped. The bytes after the end of the body are left alone.
+ * 
+ * @param reader a pointer to the body_reader_t struct
+ * @param buffer the received bytes
+ * @param len the number of received bytes
+ * @param data set to the fragment of the body, empty if the bytes consumed hold none
+ * @return the number of bytes consumed, at least 1 unless len is 0 or the body has ended
+ * @return -1 if the chunked body is malformed
+*/
+extern ssize_t read_body(body_reader_t *reader, char *buffer, size_t len, slice_t *data);
+
 #endif // PROCESS_REQUEST_H
\ No newline at end of file
@@ -0,0 +1,276 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/process_request_test.c
+ * @brief tests of the request parser and the body reader of process_request.h
+*/
+
+#include "process_request.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            printf("[-]%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * Check that a slice holds a string
+*/
+static int slice_is(slice_t slice, const char *s)
+{
+    return slice.len == strlen(s) && memcmp(slice.data, s, slice.len) == 0;
+}
+
+/**
+ * Parse a whole head at once
+ * 
+ * @return the result of parse_request
+*/
+static int parse(http_parser_t *parser, const char *head)
+{
+    static char buffer[8192];
+    size_t len = strlen(head);
+    memcpy(buffer, head, len + 1);
+    init_parser(parser);
+    return parse_request(parser, buffer, len);
+}
+
+static void test_complete_head()
+{
+    http_parser_t parser;
+    const char *head = "POST /items?id=7 HTTP/1.1\r\nHost: example.com\r\nContent-Length: 3\r\n\r\nabc";
+    CHECK(parse(&parser, head) == 1);
+    CHECK(slice_is(parser.method, "POST"));
+    CHECK(slice_is(parser.path, "/items"));
+    CHECK(slice_is(parser.query, "id=7"));
+    CHECK(slice_is(parser.version, "1.1"));
+    CHECK(parser.n_headers == 2);
+    CHECK(slice_is(parser.keys[0], "Host"));
+    CHECK(slice_is(parser.values[0], "example.com"));
+    CHECK(parser.content_length == 3);
+    CHECK(parser.head_len == strlen(head) - 3);
+}
+
+static void test_byte_at_a_time()
+{
+    //every prefix of the head is incomplete, the request line and the headers are resumed
+    //wherever the previous call stopped
+    const char *head = "GET /a/b HTTP/1.1\r\nHost: h\r\nX-Long-Header:   some value  \r\n\r\n";
+    char buffer[256];
+    size_t len = strlen(head);
+    memcpy(buffer, head, len + 1);
+    http_parser_t parser;
+    init_parser(&parser);
+    for (size_t i = 1; i < len; i++)
+        CHECK(parse_request(&parser, buffer, i) == 0);
+    CHECK(parse_request(&parser, buffer, len) == 1);
+    CHECK(slice_is(parser.path, "/a/b"));
+    CHECK(parser.n_headers == 2);
+    CHECK(slice_is(parser.keys[1], "X-Long-Header"));
+    CHECK(slice_is(parser.values[1], "some value"));
+    CHECK(parser.head_len == len);
+}
+
+static void test_line_terminators()
+{
+    http_parser_t parser;
+    //empty lines before the request line are ignored and bare LFs end the lines of a head
+    CHECK(parse(&parser, "\r\n\nGET / HTTP/1.0\nHost: h\n\n") == 1);
+    CHECK(slice_is(parser.version, "1.0"));
+    CHECK(slice_is(parser.values[0], "h"));
+}
+
+static void test_malformed()
+{
+    http_parser_t parser;
+    CHECK(parse(&parser, "GET HTTP/1.1\r\n\r\n") == -1);
+    CHECK(parse(&parser, "get / HTTP/1.1\r\n\r\n") == -1);
+    CHECK(parse(&parser, "GET / HTTP/1.1x\r\n\r\n") == -1);
+    CHECK(parse(&parser, "GET / HTTP/1.2\r\n\r\n") == -1);
+    CHECK(parse(&parser, "GET / HTTP/1.1\r\nNo colon\r\n\r\n") == -1);
+    CHECK(parse(&parser, "GET / HTTP/1.1\r\nBad name: x\r\n\r\n") == -1);
+}
+
+static void test_version()
+{
+    //other major versions are answered with 505, not parsed as HTTP/1.1
+    http_parser_t parser;
+    CHECK(parse(&parser, "GET / HTTP/2.0\r\n\r\n") == -4);
+    CHECK(parse(&parser, "GET / HTTP/9.1\r\n\r\n") == -4);
+    CHECK(parse(&parser, "GET / HTTP/0.9\r\n\r\n") == -4);
+}
+
+static void test_too_many_headers()
+{
+    static char head[MAX_HEADERS * 16 + 64];
+    http_parser_t parser;
+    int len = sprintf(head, "GET / HTTP/1.1\r\n");
+    for (int i = 0; i < MAX_HEADERS; i++)
+        len += sprintf(head + len, "X-%d: v\r\n", i);
+    strcpy(head + len, "\r\n");
+    CHECK(parse(&parser, head) == 1);
+    strcpy(head + len, "X-Last: v\r\n\r\n");
+    CHECK(parse(&parser, head) == -2);
+}
+
+static void test_content_length()
+{
+    http_parser_t parser;
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n") == 1);
+    CHECK(parser.content_length == 5);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 5\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 0\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nContent-Length: \r\n\r\n") == -1);
+}
+
+static void test_transfer_encoding()
+{
+    http_parser_t parser;
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n") == 1);
+    CHECK(parser.chunked);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.0\r\nTransfer-Encoding: chunked\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n") == -1);
+    CHECK(parse(&parser, "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n") == -3);
+}
+
+/**
+ * Read a body through a reader, step bytes at a time at most
+ * 
+ * @param body set to the bytes of the body, NUL terminated
+ * @param consumed set to the bytes consumed, framing included
+ * @return 1 if the body ended, 0 if it needs more bytes, -1 if it is malformed
+*/
+static int read_all(body_reader_t *reader, const char *input, size_t step, char *body, size_t *consumed)
+{
+    static char buffer[8192];
+    size_t len = strlen(input);
+    memcpy(buffer, input, len + 1);
+    size_t pos = 0;
+    size_t body_len = 0;
+    while (pos < len && reader->state != BODY_DONE)
+    {
+        size_t end = pos + step < len ? pos + step : len;
+        //the reader only gets the bytes received so far, the ones it consumed are dropped
+        while (pos < end && reader->state != BODY_DONE)
+        {
+            slice_t data;
+            ssize_t n = read_body(reader, buffer + pos, end - pos, &data);
+            if (n < 0)
+                return -1;
+            memcpy(body + body_len, data.data, data.len);
+            body_len += data.len;
+            pos += n;
+        }
+    }
+    body[body_len] = '\0';
+    *consumed = pos;
+    return reader->state == BODY_DONE;
+}
+
+static void test_length_body()
+{
+    body_reader_t reader;
+    char body[64];
+    size_t consumed;
+    init_body_reader(&reader, 0, 5);
+    CHECK(read_all(&reader, "hello GET /next", 64, body, &consumed) == 1);
+    CHECK(strcmp(body, "hello") == 0);
+    CHECK(consumed == 5);
+    CHECK(reader.received == 5);
+}
+
+static void test_chunked_body()
+{
+    const char *input = "4\r\nWiki\r\n5;name=value\r\npedia\r\nE\r\n in\r\n\r\nchunks.\r\n0\r\nExpires: never\r\n\r\nGET /next";
+    size_t framed = strlen(input) - strlen("GET /next");
+    //the framing may be split anywhere, the body and its end stay the same
+    for (size_t step = 1; step <= strlen(input); step++)
+    {
+        body_reader_t reader;
+        char body[64];
+        size_t consumed;
+        init_body_reader(&reader, 1, 0);
+        CHECK(read_all(&reader, input, step, body, &consumed) == 1);
+        CHECK(strcmp(body, "Wikipedia in\r\n\r\nchunks.") == 0);
+        CHECK(consumed == framed);
+        CHECK(reader.received == 23);
+    }
+}
+
+static void test_chunked_incomplete()
+{
+    body_reader_t reader;
+    char body[64];
+    size_t consumed;
+    init_body_reader(&reader, 1, 0);
+    CHECK(read_all(&reader, "3\r\nabc\r\n0\r\n", 64, body, &consumed) == 0);
+    CHECK(strcmp(body, "abc") == 0);
+    CHECK(reader.state == BODY_TRAILER);
+}
+
+static void test_chunked_malformed()
+{
+    const char *inputs[] = {
+        "4\nWiki\r\n0\r\n\r\n",             //bare LF after the size
+        "4\r\nWiki\n0\r\n\r\n",             //bare LF after the data
+        "4\r\nWikiX\r\n0\r\n\r\n",          //chunk longer than its size
+        "g\r\n",                            //not a hex digit
+        "\r\n",                             //no size
+        ";ext\r\n",                         //extension without a size
+        "0\r\n\n",                          //bare LF ending the body
+        "0\r\nTrailer: x\n\r\n",            //bare LF after a trailer field
+        "10000000000000000\r\n",            //size overflowing size_t
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+    {
+        body_reader_t reader;
+        char body[64];
+        size_t consumed;
+        init_body_reader(&reader, 1, 0);
+        CHECK(read_all(&reader, inputs[i], 64, body, &consumed) == -1);
+    }
+
+    //a chunk size line longer than MAX_CHUNK_LINE, extensions included
+    static char line[MAX_CHUNK_LINE + 16];
+    memset(line, 'a', sizeof(line) - 1);
+    memcpy(line, "1;", 2);
+    body_reader_t reader;
+    char body[64];
+    size_t consumed;
+    init_body_reader(&reader, 1, 0);
+    CHECK(read_all(&reader, line, sizeof(line), body, &consumed) == -1);
+}
+
+int main()
+{
+    test_complete_head();
+    test_byte_at_a_time();
+    test_line_terminators();
+    test_malformed();
+    test_version();
+    test_too_many_headers();
+    test_content_length();
+    test_transfer_encoding();
+    test_length_body();
+    test_chunked_body();
+    test_chunked_incomplete();
+    test_chunked_malformed();
+    if (failures > 0)
+        printf("[-]%d checks failed\n", failures);
+    return failures > 0;
+}
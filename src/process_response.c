@@ -10,142 +10,95 @@
 */
 
 #include "process_response.h"
+#include "arena.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-/**
- * Get the status message
- * This function returns the status message corresponding to the status code.
- * 
- * @param res a pointer to the response_t struct
- * @return the status message or "Unknown" if the status code is not recognized
- */
-char *get_status_message(response_t *res)
+#define STATUS(code, reason) [code - 100] = {"HTTP/1.1 " #code " " reason "\r\n", sizeof("HTTP/1.1 " #code " " reason "\r\n") - 1, reason}
+
+// status lines rendered at compile time, indexed by status code - 100
+static const struct
 {
-    char *status_code = res->status_code;
-    if (strcmp(status_code, "100") == 0)
-        return "Continue";
-    else if (strcmp(status_code, "101") == 0)
-        return "Switching Protocols";
-    else if (strcmp(status_code, "200") == 0)
-        return "OK";
-    else if (strcmp(status_code, "201") == 0)
-        return "Created";
-    else if (strcmp(status_code, "202") == 0)
-        return "Accepted";
-    else if (strcmp(status_code, "204") == 0)
-        return "No Content";
-    else if (strcmp(status_code, "301") == 0)
-        return "Moved Permanently";
-    else if (strcmp(status_code, "302") == 0)
-        return "Found";
-    else if (strcmp(status_code, "304") == 0)
-        return "Not Modified";
-    else if (strcmp(status_code, "400") == 0)
-        return "Bad Request";
-    else if (strcmp(status_code, "401") == 0)
-        return "Unauthorized";
-    else if (strcmp(status_code, "403") == 0)
-        return "Forbidden";
-    else if (strcmp(status_code, "404") == 0)
-        return "Not Found";
-    else if (strcmp(status_code, "413") == 0)
-        return "Payload Too Large";
-    else if (strcmp(status_code, "415") == 0)
-        return "Unsupported Media Type";
-    else if (strcmp(status_code, "500") == 0)
-        return "Internal Server Error";
-    else if (strcmp(status_code, "501") == 0)
-        return "Not Implemented";
-    else if (strcmp(status_code, "502") == 0)
-        return "Bad Gateway";
-    else if (strcmp(status_code, "503") == 0)
-        return "Service Unavailable";
-    return "Unknown";
-}
+    const char *line;
+    size_t len;
+    const char *reason;
+} status_lines[500] = {
+    STATUS(100, "Continue"),
+    STATUS(101, "Switching Protocols"),
+    STATUS(200, "OK"),
+    STATUS(201, "Created"),
+    STATUS(202, "Accepted"),
+    STATUS(204, "No Content"),
+    STATUS(206, "Partial Content"),
+    STATUS(301, "Moved Permanently"),
+    STATUS(302, "Found"),
+    STATUS(303, "See Other"),
+    STATUS(304, "Not Modified"),
+    STATUS(307, "Temporary Redirect"),
+    STATUS(308, "Permanent Redirect"),
+    STATUS(400, "Bad Request"),
+    STATUS(401, "Unauthorized"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(405, "Method Not Allowed"),
+    STATUS(406, "Not Acceptable"),
+    STATUS(408, "Request Timeout"),
+    STATUS(409, "Conflict"),
+    STATUS(410, "Gone"),
+    STATUS(411, "Length Required"),
+    STATUS(412, "Precondition Failed"),
+    STATUS(413, "Payload Too Large"),
+    STATUS(414, "URI Too Long"),
+    STATUS(415, "Unsupported Media Type"),
+    STATUS(416, "Range Not Satisfiable"),
+    STATUS(417, "Expectation Failed"),
+    STATUS(422, "Unprocessable Entity"),
+    STATUS(426, "Upgrade Required"),
+    STATUS(429, "Too Many Requests"),
+    STATUS(431, "Request Header Fields Too Large"),
+    STATUS(500, "Internal Server Error"),
+    STATUS(501, "Not Implemented"),
+    STATUS(502, "Bad Gateway"),
+    STATUS(503, "Service Unavailable"),
+    STATUS(504, "Gateway Timeout"),
+    STATUS(505, "HTTP Version Not Supported"),
+};
 
 /**
- * Convert the headers to a string
- * This function converts the headers of a response to a string.
+ * Get the status line of a status code
+ * This function returns the precomputed "HTTP/1.1 <code> <reason>\r\n" line of a status.
+ * For other versions the line is valid from its 9th byte, " <code> <reason>\r\n".
  * 
- * @param res a pointer to the response_t struct
- * @return a string containing the headers
+ * @param status the status code
+ * @param len set to the length of the line
+ * @return the status line or NULL if the status code is not recognized
  */
-char *headers_to_string(response_t *res)
+const char *status_line(int status, size_t *len)
 {
-    size_t max_size = 4096;
-    node_t *current = res->headers;
-    char *headers;
-    headers = (char *)malloc(max_size);
-    if (headers == NULL)
-    {
-        perror("[-]Error creating headers string");
+    if (status < 100 || status > 599 || status_lines[status - 100].line == NULL)
         return NULL;
-    }
-    headers[0] = '\0';
-    while (current != NULL)
-    {
-        if (current->key != NULL && current->value != NULL)
-        {
-            size_t headers_len = strlen(current->key) + strlen(current->value) + 4;
-            if (strlen(headers) + headers_len + 1 > max_size)
-            {
-                max_size *= 2;
-                headers = (char *)realloc(headers, max_size);
-                if (headers == NULL)
-                {
-                    perror("[-]Error creating headers string");
-                    return NULL;
-                }
-            }
-            strcat(headers, current->key);
-            strcat(headers, ": ");
-            strcat(headers, current->value);
-            strcat(headers, "\r\n");
-        }
-        current = current->next;
-    }
-    return headers;
+    *len = status_lines[status - 100].len;
+    return status_lines[status - 100].line;
 }
 
 /**
- * Get the content length
- * This function returns the content length of the response body.
+ * Get the status message
+ * This function returns the status message corresponding to the status code.
  * 
  * @param res a pointer to the response_t struct
- * @return the content length or "0" if the body is NULL
+ * @return the status message or "Unknown" if the status code is not recognized
  */
-char *content_length(response_t *res)
+char *get_status_message(response_t *res)
 {
-    char *body = res->body;
-    char *content_len;
-    if (body == NULL || strlen(body) == 0)
-    {
-        content_len = malloc(2 * sizeof(char));
-        if (content_len == NULL)
-        {
-            perror("[-]malloc failed");
-            return NULL;
-        }
-        strcpy(content_len, "0");
-        return content_len;
-    }
-
-    size_t len = strlen(body);
-    content_len = malloc(20 * sizeof(char));
-    if (content_len == NULL)
-    {
-        perror("[-]malloc failed");
-        return NULL;
-    }
-    sprintf(content_len, "%zu", len);
-    return content_len;
+    if (res->status < 100 || res->status > 599 || status_lines[res->status - 100].reason == NULL)
+        return "Unknown";
+    return (char *)status_lines[res->status - 100].reason;
 }
 
 /**
  * Validate the response
- * Add version (default 1,1), status_code (default 200) and content_length (calculate it) headers
+ * Add version (default 1,1) and content_length (calculate it) headers, streamed bodies have none
  * Check if headers and content-type header is present
  * 
  * @param res a pointer to the response_t struct
@@ -160,22 +113,13 @@ int validate_response(response_t *res)
     }
     if (res->version == NULL)
     {
-        res->version = strdup("1.1");
+        res->version = mem_strdup("1.1");
         if (res->version == NULL)
         {
             perror("[-]malloc failed");
             return -1;
         }
     }
-    if (res->status_code == NULL)
-    {
-        res->status_code = strdup("200");
-        if (res->status_code == NULL)
-        {
-            perror("[-]malloc failed");
-            return -1;
-        }
-    }
 
     if (get_header(res->headers, "Content-Type") == NULL)
     {
@@ -183,11 +127,12 @@ int validate_response(response_t *res)
         return -1;
     }
 
-    if (get_header(res->headers, "Content-Length") == NULL)
+    //a streamed body is delimited by its chunks, a 304 has none
+    if (res->stream == NULL && res->status != 304 && get_header(res->headers, "Content-Length") == NULL)
     {
-        char *content_len = content_length(res);
+        char content_len[24];
+        snprintf(content_len, sizeof(content_len), "%zu", res->body_len);
         add_header(&(res->headers), "Content-Length", content_len);
-        free(content_len);
     }
     return 0;
 }
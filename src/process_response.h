@@ -15,35 +15,28 @@
 #include "http_data.h"
 
 /**
- * Get the status message
- * This function returns the status message corresponding to the status code.
- * 
- * @param res a pointer to the response_t struct
- * @return the status message or "Unknown" if the status code is not recognized
- */
-extern char* get_status_message(response_t *res);
-
-/**
- * Convert the headers to a string
- * This function converts the headers of a response to a string.
+ * Get the status line of a status code
+ * This function returns the precomputed "HTTP/1.1 <code> <reason>\r\n" line of a status.
+ * For other versions the line is valid from its 9th byte, " <code> <reason>\r\n".
  * 
- * @param res a pointer to the response_t struct
- * @return a string containing the headers
+ * @param status the status code
+ * @param len set to the length of the line
+ * @return the status line or NULL if the status code is not recognized
  */
-extern char* headers_to_string(response_t *res);
+extern const char *status_line(int status, size_t *len);
 
 /**
- * Get the content length
- * This function returns the content length of the response body.
+ * Get the status message
+ * This function returns the status message corresponding to the status code.
  * 
  * @param res a pointer to the response_t struct
- * @return the content length or "0" if the body is NULL
+ * @return the status message or "Unknown" if the status code is not recognized
  */
-extern char* content_length(response_t *res);
+extern char* get_status_message(response_t *res);
 
 /**
  * Validate the response
- * Add version (default 1,1), status_code (default 200) and content_length (calculate it) headers
+ * Add version (default 1,1) and content_length (calculate it) headers
  * Check if headers and content-type header is present
  * 
  * @param res a pointer to the response_t struct
@@ -0,0 +1,529 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/reactor.c
+ * @brief implementation of reactor.h
+*/
+
+#define _GNU_SOURCE
+
+#include "reactor.h"
+#include "connection.h"
+#include "uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+
+/**
+ * Set a file descriptor in non-blocking mode
+ * 
+ * @param fd the file descriptor
+ * @return 0 if the flag was set, -1 otherwise
+*/
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    {
+        perror("[-]fcntl failed");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Run the route callback of a job on a worker and hand the response back to the reactor
+ * 
+ * @param arg a pointer to the job_t struct
+*/
+static void run_job(void *arg)
+{
+    job_t *job = (job_t *)arg;
+    reactor_t *reactor = (reactor_t *)job->client->owner;
+    uint64_t one = 1;
+    job->response = elaborate_response(job->client);
+    pthread_mutex_lock(&reactor->jobs_lock);
+    job->next = reactor->done;
+    reactor->done = job;
+    //wake the loop before in_flight can reach 0: stop_reactor frees the reactor right after
+    if (write(reactor->wake_fd, &one, sizeof(one)) < 0)
+        perror("[-]write failed");
+    if (--reactor->in_flight == 0)
+        pthread_cond_broadcast(&reactor->jobs_cond);
+    pthread_mutex_unlock(&reactor->jobs_lock);
+}
+
+/**
+ * Dispatch the route callback of a client to the thread pool of its reactor
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the job was queued, -1 if the queues are full or an error occurred
+*/
+static int dispatch_client(client_t *client)
+{
+    reactor_t *reactor = (reactor_t *)client->owner;
+    job_t *job = (job_t *)malloc(sizeof(job_t));
+    if (job == NULL)
+    {
+        perror("[-]malloc failed");
+        return -1;
+    }
+    job->client = client;
+    job->response = NULL;
+    job->next = NULL;
+    pthread_mutex_lock(&reactor->jobs_lock);
+    reactor->in_flight++;
+    pthread_mutex_unlock(&reactor->jobs_lock);
+    if (submit_task(reactor->pool, run_job, job) < 0)
+    {
+        pthread_mutex_lock(&reactor->jobs_lock);
+        reactor->in_flight--;
+        pthread_mutex_unlock(&reactor->jobs_lock);
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Take the jobs finished by the workers, in completion order
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @return the list of finished jobs
+*/
+static job_t *take_jobs(reactor_t *reactor)
+{
+    pthread_mutex_lock(&reactor->jobs_lock);
+    job_t *jobs = reactor->done;
+    reactor->done = NULL;
+    pthread_mutex_unlock(&reactor->jobs_lock);
+    job_t *ordered = NULL;
+    while (jobs != NULL)
+    {
+        job_t *next = jobs->next;
+        jobs->next = ordered;
+        ordered = jobs;
+        jobs = next;
+    }
+    return ordered;
+}
+
+/**
+ * Add a client to the connections of a reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+void track_client(reactor_t *reactor, client_t *client)
+{
+    client->owner = reactor;
+    client->max_request = reactor->max_request;
+    client->max_requests = reactor->max_requests;
+    client->arena_keep = reactor->arena_keep;
+    client->timeouts = reactor->timeouts;
+    if (reactor->pool != NULL)
+        client->dispatch = dispatch_client;
+    client->prev = NULL;
+    client->next = reactor->clients;
+    if (reactor->clients != NULL)
+        reactor->clients->prev = client;
+    reactor->clients = client;
+}
+
+/**
+ * Update the timer of a client
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+void update_timer(reactor_t *reactor, client_t *client)
+{
+    uint64_t deadline = update_deadline(client, reactor->now);
+    if (deadline == 0)
+        cancel_timer(&reactor->timers, &client->timer);
+    else
+        schedule_timer(&reactor->timers, &client->timer, deadline);
+}
+
+/**
+ * Remove a client from the connections of a reactor and close it
+ * Closing the socket also removes it from the epoll interest list.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+void close_client(reactor_t *reactor, client_t *client)
+{
+    cancel_timer(&reactor->timers, &client->timer);
+    if (client->prev != NULL)
+        client->prev->next = client->next;
+    else
+        reactor->clients = client->next;
+    if (client->next != NULL)
+        client->next->prev = client->prev;
+    destroy_client(client);
+}
+
+/**
+ * Close a client of the epoll loop, or defer it while a worker owns its request
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+static void finish_client(reactor_t *reactor, client_t *client)
+{
+    if (client->state == STATE_PROCESSING)
+        client->closing = 1; //closed by complete_jobs
+    else
+        close_client(reactor, client);
+}
+
+/**
+ * Close a client of the epoll loop that timed out
+ * 
+ * @param timer the timer of the client
+ * @param arg a pointer to the reactor_t struct
+*/
+static void expire_client(wheel_timer_t *timer, void *arg)
+{
+    client_t *client = (client_t *)((char *)timer - offsetof(client_t, timer));
+    finish_client((reactor_t *)arg, client);
+}
+
+/**
+ * Accept all pending connections
+ * The listening socket is edge-triggered, so accept is called until it would block.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+static void accept_clients(reactor_t *reactor)
+{
+    while (1)
+    {
+        int client_fd = accept4(reactor->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("[-]accept failed");
+            return;
+        }
+
+        client_t *client = create_client(client_fd);
+        if (client == NULL)
+        {
+            close(client_fd);
+            continue;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = client;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) < 0)
+        {
+            perror("[-]epoll_ctl failed");
+            destroy_client(client);
+            continue;
+        }
+        track_client(reactor, client);
+        update_timer(reactor, client);
+    }
+}
+
+/**
+ * Read all the available data of a client and run the parse states over it
+ * The client socket is edge-triggered, so recv is called until it would block.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+static int read_client(client_t *client)
+{
+    while (1)
+    {
+        if (client->state == STATE_PROCESSING && reserve_input(client) == 0)
+            return 0; //resumed by complete_jobs
+        ssize_t received = receive_client(client);
+        if (received == 0)
+            return -1;
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        if (process_client(client) < 0)
+            return -1;
+    }
+}
+
+/**
+ * Complete the jobs finished by the workers
+ * This function queues the responses produced by the workers on their connections and
+ * resumes them, it runs in the event loop when the wake eventfd fires.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void complete_jobs(reactor_t *reactor)
+{
+    job_t *job = take_jobs(reactor);
+    while (job != NULL)
+    {
+        job_t *next = job->next;
+        client_t *client = job->client;
+        if (reactor->uring != NULL)
+            complete_uring_job(reactor, client, job->response);
+        else if (client->closing)
+        {
+            free_output(job->response);
+            close_client(reactor, client);
+        }
+        else if (complete_response(client, job->response) < 0 || read_client(client) < 0 || flush_client(client) < 0 || is_drained(client))
+            finish_client(reactor, client);
+        else
+            update_timer(reactor, client);
+        free(job);
+        job = next;
+    }
+}
+
+/**
+ * Run the epoll event loop of a reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+static void run_epoll(reactor_t *reactor)
+{
+    struct epoll_event events[MAX_EVENTS];
+    while (reactor->running)
+    {
+        int n = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, timer_wheel_timeout(&reactor->timers, reactor->now));
+        if (n < 0 && errno != EINTR)
+        {
+            perror("[-]epoll_wait failed");
+            break;
+        }
+        reactor->now = monotonic_ms();
+        int woken = 0;
+        for (int i = 0; i < n; i++)
+        {
+            if (events[i].data.ptr == NULL)
+            {
+                //wake up from stop_reactor or from a worker, the jobs are completed after the batch
+                //because completing them can destroy clients that still have events later in it
+                woken = 1;
+                continue;
+            }
+            if (events[i].data.ptr == reactor)
+            {
+                accept_clients(reactor);
+                continue;
+            }
+
+            client_t *client = (client_t *)events[i].data.ptr;
+            if (client->closing)
+                continue;
+            int closed = 0;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                closed = read_client(client) < 0;
+            if (!closed && client->out != NULL)
+                closed = flush_client(client) < 0;
+            if (closed || is_drained(client))
+                finish_client(reactor, client);
+            else
+                update_timer(reactor, client);
+        }
+        if (woken)
+        {
+            uint64_t value;
+            if (read(reactor->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                perror("[-]read failed");
+            complete_jobs(reactor);
+        }
+        expire_timers(&reactor->timers, reactor->now, expire_client, reactor);
+    }
+}
+
+/**
+ * Run the event loop of a reactor
+ * 
+ * @param arg a pointer to the reactor_t struct
+ * @return NULL
+*/
+static void *run_reactor(void *arg)
+{
+    reactor_t *reactor = (reactor_t *)arg;
+    block_sigpipe();
+    if (reactor->cpu >= 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(reactor->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+            perror("[-]pthread_setaffinity_np failed");
+    }
+    if (reactor->uring != NULL)
+        run_uring(reactor);
+    else
+        run_epoll(reactor);
+    return NULL;
+}
+
+/**
+ * Create a reactor
+ * This function creates the epoll instance of a reactor and registers the listening socket.
+ * The listening socket is switched to non-blocking mode.
+ * 
+ * @param listen_fd the listening socket
+ * @return a pointer to the reactor_t struct
+ * @return NULL if an error occurred
+*/
+reactor_t *create_reactor(int listen_fd)
+{
+    reactor_t *reactor = (reactor_t *)malloc(sizeof(reactor_t));
+    if (reactor == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    reactor->listen_fd = listen_fd;
+    reactor->running = 0;
+    reactor->cpu = -1;
+    reactor->clients = NULL;
+    reactor->uring = NULL;
+    reactor->pool = NULL;
+    reactor->done = NULL;
+    reactor->in_flight = 0;
+    reactor->max_request = MAX_SIZE;
+    reactor->max_requests = MAX_KEEP_ALIVE_REQUESTS;
+    reactor->arena_keep = ARENA_KEEP_SIZE;
+    reactor->timeouts.idle = IDLE_TIMEOUT;
+    reactor->timeouts.header = HEADER_TIMEOUT;
+    reactor->timeouts.body = BODY_TIMEOUT;
+    reactor->now = monotonic_ms();
+    init_timer_wheel(&reactor->timers, reactor->now);
+    pthread_mutex_init(&reactor->jobs_lock, NULL);
+    pthread_cond_init(&reactor->jobs_cond, NULL);
+
+    if (set_nonblocking(listen_fd) < 0)
+    {
+        free(reactor);
+        return NULL;
+    }
+
+    if ((reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        perror("[-]epoll_create1 failed");
+        free(reactor);
+        return NULL;
+    }
+
+    if ((reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        perror("[-]eventfd failed");
+        close(reactor->epoll_fd);
+        free(reactor);
+        return NULL;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = reactor;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)
+    {
+        perror("[-]epoll_ctl failed");
+        close(reactor->wake_fd);
+        close(reactor->epoll_fd);
+        free(reactor);
+        return NULL;
+    }
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &event) < 0)
+    {
+        perror("[-]epoll_ctl failed");
+        close(reactor->wake_fd);
+        close(reactor->epoll_fd);
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+/**
+ * Start a reactor
+ * This function starts the thread running the event loop of the reactor.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @return 0 if the reactor was started, -1 otherwise
+*/
+int start_reactor(reactor_t *reactor)
+{
+    reactor->running = 1;
+    if (pthread_create(&reactor->thread_id, NULL, run_reactor, (void *)reactor) != 0)
+    {
+        perror("[-]pthread_create failed");
+        reactor->running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop a reactor
+ * This function wakes the event loop up, waits for it to exit, closes all its
+ * connections and frees the reactor. The listening socket is not closed.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void stop_reactor(reactor_t *reactor)
+{
+    if (reactor == NULL)
+        return;
+    if (reactor->running)
+    {
+        uint64_t one = 1;
+        reactor->running = 0;
+        if (write(reactor->wake_fd, &one, sizeof(one)) < 0)
+            perror("[-]write failed");
+        pthread_join(reactor->thread_id, NULL);
+    }
+    //let the workers finish the jobs of this reactor, their clients are closed below
+    pthread_mutex_lock(&reactor->jobs_lock);
+    while (reactor->in_flight > 0)
+        pthread_cond_wait(&reactor->jobs_cond, &reactor->jobs_lock);
+    pthread_mutex_unlock(&reactor->jobs_lock);
+    for (job_t *job = take_jobs(reactor), *next; job != NULL; job = next)
+    {
+        next = job->next;
+        free_output(job->response);
+        free(job);
+    }
+    free_uring(reactor);
+    while (reactor->clients != NULL)
+        close_client(reactor, reactor->clients);
+    close(reactor->wake_fd);
+    if (reactor->epoll_fd >= 0)
+        close(reactor->epoll_fd);
+    pthread_mutex_destroy(&reactor->jobs_lock);
+    pthread_cond_destroy(&reactor->jobs_cond);
+    free(reactor);
+}
\ No newline at end of file
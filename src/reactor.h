@@ -0,0 +1,118 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/reactor.h
+ * @brief provides the reactor_t struct and functions to serve connections with an edge-triggered epoll event loop
+ * (or an io_uring event loop, see uring.h)
+*/
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "client.h"
+#include "thread_pool.h"
+#include "timer_wheel.h"
+#include <pthread.h>
+
+typedef struct job_t
+{
+    client_t *client;
+    out_segment_t *response;  // serialized by the worker
+    struct job_t *next;
+} job_t;
+
+typedef struct reactor_t
+{
+    int epoll_fd;
+    int listen_fd;
+    int wake_fd;            // eventfd used to stop the event loop
+    volatile int running;
+    pthread_t thread_id;
+    int cpu;                // cpu the event loop is pinned to, -1 if not pinned
+    client_t *clients;      // connections owned by this reactor
+    struct uring_t *uring;  // io_uring backend, NULL for epoll
+    thread_pool_t *pool;    // workers running the route callbacks, NULL to run them in the event loop
+    pthread_mutex_t jobs_lock;
+    pthread_cond_t jobs_cond;
+    job_t *done;            // jobs finished by the workers, completed by the event loop
+    int in_flight;          // jobs submitted and not finished by a worker yet
+    size_t max_request;     // limit of a request of the connections
+    size_t max_requests;    // requests served on a connection before closing it, 0 for no limit
+    size_t arena_keep;      // largest chunk of arena kept by an idle connection
+    timeouts_t timeouts;    // timeouts of the connections
+    timer_wheel_t timers;   // deadlines of the connections
+    uint64_t now;           // time of the last wake up of the event loop, in milliseconds
+} reactor_t;
+
+/**
+ * Create a reactor
+ * This function creates the epoll instance of a reactor and registers the listening socket.
+ * The listening socket is switched to non-blocking mode.
+ * 
+ * @param listen_fd the listening socket
+ * @return a pointer to the reactor_t struct
+ * @return NULL if an error occurred
+*/
+extern reactor_t *create_reactor(int listen_fd);
+
+/**
+ * Add a client to the connections of a reactor
+ * The client takes the request limits and the timeouts of the reactor. When the reactor
+ * has a thread pool the route callbacks of the client are dispatched to it.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+extern void track_client(reactor_t *reactor, client_t *client);
+
+/**
+ * Update the timer of a client
+ * The timer is moved to the deadline of the client, see update_deadline, or cancelled if
+ * the client has none. The event loops call it after every event of the client, it costs
+ * O(1).
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+extern void update_timer(reactor_t *reactor, client_t *client);
+
+/**
+ * Remove a client from the connections of a reactor and close it
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+extern void close_client(reactor_t *reactor, client_t *client);
+
+/**
+ * Complete the jobs finished by the workers
+ * This function queues the responses produced by the workers on their connections and
+ * resumes them, it runs in the event loop when the wake eventfd fires.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+extern void complete_jobs(reactor_t *reactor);
+
+/**
+ * Start a reactor
+ * This function starts the thread running the event loop of the reactor.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @return 0 if the reactor was started, -1 otherwise
+*/
+extern int start_reactor(reactor_t *reactor);
+
+/**
+ * Stop a reactor
+ * This function wakes the event loop up, waits for it to exit, closes all its
+ * connections and frees the reactor. The listening socket is not closed.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+extern void stop_reactor(reactor_t *reactor);
+
+#endif // REACTOR_H
\ No newline at end of file
@@ -0,0 +1,156 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/route_test.c
+ * @brief tests of the radix tree and the frozen table of route.h
+*/
+
+#include "route.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            printf("[-]%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static void cb0(request_t *req, response_t *res) { (void)req; (void)res; }
+static void cb1(request_t *req, response_t *res) { (void)req; (void)res; }
+static void cb2(request_t *req, response_t *res) { (void)req; (void)res; }
+static void cb3(request_t *req, response_t *res) { (void)req; (void)res; }
+static int body0(request_t *req, const char *data, size_t len) { (void)req; (void)data; (void)len; return 0; }
+static int body1(request_t *req, const char *data, size_t len) { (void)req; (void)data; (void)len; return 0; }
+
+static const callback callbacks[] = {cb0, cb1, cb2, cb3};
+static const body_callback body_callbacks[] = {NULL, body0, body1};
+static char *methods[] = {"GET", "POST", "DELETE"};
+
+/**
+ * Write the path of the i-th route
+ * The paths share their length and their first blocks of eight bytes, only the last bytes
+ * tell them apart, and every path is added for several methods.
+ */
+static void route_path(char *path, size_t i)
+{
+    sprintf(path, "/api/v1/resources/%06zu", i / 3);
+}
+
+/**
+ * Add n exact routes, each with a callback and a body callback picked by its index
+ */
+static void add_routes(size_t n)
+{
+    char path[64];
+    for (size_t i = 0; i < n; i++) {
+        route_path(path, i);
+        body_callback on_body = body_callbacks[i % 3];
+        if (on_body == NULL) {
+            CHECK(add_route(methods[i % 3], path, callbacks[i % 4]) == 0);
+        } else {
+            CHECK(add_body_route(methods[i % 3], path, on_body, callbacks[i % 4]) == 0);
+        }
+    }
+}
+
+/**
+ * Check that each of n routes is found with its own callbacks and that near misses are not
+ */
+static void check_routes(size_t n)
+{
+    char path[64];
+    for (size_t i = 0; i < n; i++) {
+        route_path(path, i);
+        http_method_t m = parse_method(methods[i % 3], strlen(methods[i % 3]));
+        CHECK(find_route(m, path, NULL) == callbacks[i % 4]);
+        CHECK(find_body_route(m, path) == body_callbacks[i % 3]);
+        CHECK(get_route(methods[i % 3], path) == callbacks[i % 4]);
+    }
+    //no test adds patterns for POST, so its misses are only decided by the table or the tree
+    route_path(path, n + 2);
+    CHECK(find_route(METHOD_POST, path, NULL) == NULL);
+    route_path(path, 0);
+    CHECK(find_route(METHOD_PUT, path, NULL) == NULL);
+    path[strlen(path) - 1] = '\0';
+    CHECK(find_route(METHOD_POST, path, NULL) == NULL);
+    strcat(path, "00");
+    CHECK(find_route(METHOD_POST, path, NULL) == NULL);
+    CHECK(find_route(METHOD_POST, "/", NULL) == NULL);
+    CHECK(find_route(METHOD_POST, "", NULL) == NULL);
+    CHECK(find_route(METHOD_UNKNOWN, path, NULL) == NULL);
+}
+
+static void test_frozen_sizes()
+{
+    //below and above MIN_FROZEN_ROUTES, up to tables where most buckets hold several routes
+    size_t sizes[] = {0, 1, 31, 32, 33, 100, 1000, 5000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        add_routes(sizes[s]);
+        check_routes(sizes[s]);
+        CHECK(freeze_routes() == 0);
+        check_routes(sizes[s]);
+        CHECK(freeze_routes() == 0);
+        CHECK(add_route("GET", "/late", cb0) == -1);
+        free_routes();
+        CHECK(find_route(METHOD_GET, "/api/v1/resources/000000", NULL) == NULL);
+    }
+}
+
+static void test_patterns()
+{
+    //the patterns stay in the radix tree next to the table, exact routes win over them
+    request_t req;
+    memset(&req, 0, sizeof(req));
+    add_routes(300);
+    CHECK(add_route("GET", "/api/v1/resources/:id", cb1) == 0);
+    CHECK(add_route("GET", "/files/*path", cb2) == 0);
+    CHECK(add_route("DELETE", "/api/v1/resources/000000/*", cb3) == 0);
+    CHECK(freeze_routes() == 0);
+    check_routes(300);
+
+    size_t len;
+    const char *value;
+    CHECK(find_route(METHOD_GET, "/api/v1/resources/000000", &req) == cb0);
+    CHECK(req.n_path_params == 0);
+    CHECK(find_route(METHOD_GET, "/api/v1/resources/abc", &req) == cb1);
+    value = get_path_param(&req, "id", &len);
+    CHECK(value != NULL && len == 3 && memcmp(value, "abc", 3) == 0);
+    CHECK(find_route(METHOD_GET, "/files/a/b.txt", &req) == cb2);
+    value = get_path_param(&req, "path", &len);
+    CHECK(value != NULL && len == 7 && memcmp(value, "a/b.txt", 7) == 0);
+    CHECK(find_route(METHOD_DELETE, "/api/v1/resources/000000/x", &req) == cb3);
+    CHECK(find_route(METHOD_GET, "/api/v1/resources/abc/def", &req) == NULL);
+    //POST has no patterns, a miss does not walk the tree
+    CHECK(find_route(METHOD_POST, "/files/a", &req) == NULL);
+    free_routes();
+}
+
+static void test_replace()
+{
+    //adding a path twice keeps a single route with the last callback
+    add_routes(64);
+    CHECK(add_route("GET", "/api/v1/resources/000000", cb3) == 0);
+    CHECK(freeze_routes() == 0);
+    CHECK(find_route(METHOD_GET, "/api/v1/resources/000000", NULL) == cb3);
+    CHECK(find_body_route(METHOD_GET, "/api/v1/resources/000000") == NULL);
+    free_routes();
+}
+
+int main()
+{
+    test_frozen_sizes();
+    test_patterns();
+    test_replace();
+    if (failures > 0) {
+        printf("[-]%d checks failed\n", failures);
+    }
+    return failures > 0;
+}
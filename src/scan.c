@@ -0,0 +1,234 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/scan.c
+ * @brief implementation of scan.h
+*/
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+typedef char *(*scan_fn)(const char *p, const char *end, char c);
+typedef char *(*string_fn)(const char *p, const char *end);
+
+//tchar of RFC 9110: "!#$%&'*+-.^_`|~", digits and letters
+static const unsigned char token_chars[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1, ['+'] = 1,
+    ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1
+};
+
+static char *scan_scalar(const char *p, const char *end, char c)
+{
+    for (; p < end; p++)
+    {
+        if (*p == c)
+            return (char *)p;
+    }
+    return NULL;
+}
+
+#ifdef __SSE2__
+static char *scan_sse2(const char *p, const char *end, char c)
+{
+    __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0)
+            return (char *)p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scan_scalar(p, end, c);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static char *scan_avx2(const char *p, const char *end, char c)
+{
+    __m256i needle = _mm256_set1_epi8(c);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+        if (mask != 0)
+            return (char *)p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return scan_sse2(p, end, c);
+}
+#endif
+
+static char *string_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        if (*p == '"' || *p == '\\' || (unsigned char)*p < 0x20 || (unsigned char)*p >= 0x80)
+            return (char *)p;
+    }
+    return NULL;
+}
+
+#ifdef __SSE2__
+static char *string_sse2(const char *p, const char *end)
+{
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    __m128i control = _mm_set1_epi8(0x1f);
+    while (end - p >= 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        //bytes up to 0x1f are the ones left unchanged by an unsigned min with 0x1f
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+        //the top bit of the chunk itself marks the bytes of UTF-8 sequences
+        int mask = _mm_movemask_epi8(_mm_or_si128(stop, chunk));
+        if (mask != 0)
+            return (char *)p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return string_scalar(p, end);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static char *string_avx2(const char *p, const char *end)
+{
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i backslash = _mm256_set1_epi8('\\');
+    __m256i control = _mm256_set1_epi8(0x1f);
+    while (end - p >= 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(_mm256_min_epu8(chunk, control), chunk));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(stop, chunk));
+        if (mask != 0)
+            return (char *)p + __builtin_ctz(mask);
+        p += 32;
+    }
+    return string_sse2(p, end);
+}
+#endif
+
+/**
+ * Pick the widest implementation the cpu supports
+*/
+static scan_fn select_scan(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return scan_avx2;
+#endif
+#ifdef __SSE2__
+    return scan_sse2;
+#else
+    return scan_scalar;
+#endif
+}
+
+/**
+ * Pick the widest string scan the cpu supports
+*/
+static string_fn select_string(void)
+{
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return string_avx2;
+#endif
+#ifdef __SSE2__
+    return string_sse2;
+#else
+    return string_scalar;
+#endif
+}
+
+/**
+ * Find a byte
+ * This function compares 32 bytes at a time with AVX2 when the cpu supports it, 16 bytes at
+ * a time with SSE2 otherwise, and falls back to a byte loop on other architectures and for
+ * the tail shorter than a vector.
+ * 
+ * @param p the first byte to scan
+ * @param end the end of the bytes to scan
+ * @param c the byte to find
+ * @return a pointer to the first occurrence of c
+ * @return NULL if c is not in [p, end)
+*/
+char *scan_byte(const char *p, const char *end, char c)
+{
+    static scan_fn scan = NULL;
+    //every thread selects the same function, the first one to get here stores it
+    scan_fn fn = __atomic_load_n(&scan, __ATOMIC_RELAXED);
+    if (fn == NULL)
+    {
+        fn = select_scan();
+        __atomic_store_n(&scan, fn, __ATOMIC_RELAXED);
+    }
+    return fn(p, end, c);
+}
+
+/**
+ * Find the end of a header name
+ * This function skips the characters allowed in a header name (tchar of RFC 9110).
+ * 
+ * @param p the first byte of the name
+ * @param end the end of the line
+ * @return a pointer to the first byte that is not part of the name
+*/
+char *scan_token(const char *p, const char *end)
+{
+    while (p < end && token_chars[(unsigned char)*p])
+        p++;
+    return (char *)p;
+}
+
+/**
+ * Get the value of a hexadecimal digit
+ * 
+ * @param c the character
+ * @return the value of the digit, -1 if c is not one
+*/
+int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+/**
+ * Find the end of a run of plain JSON string characters
+ * This function skips the ASCII bytes a JSON string holds as they are, a vector at a time
+ * like scan_byte, and stops at a quote, a backslash, a control character or the first byte
+ * of a UTF-8 sequence, which the caller validates.
+ * 
+ * @param p the first byte to scan
+ * @param end the end of the bytes to scan
+ * @return a pointer to the first quote, backslash, byte below 0x20 or byte from 0x80
+ * @return NULL if there is none in [p, end)
+*/
+char *scan_json_string(const char *p, const char *end)
+{
+    static string_fn scan = NULL;
+    string_fn fn = __atomic_load_n(&scan, __ATOMIC_RELAXED);
+    if (fn == NULL)
+    {
+        fn = select_string();
+        __atomic_store_n(&scan, fn, __ATOMIC_RELAXED);
+    }
+    return fn(p, end);
+}
\ No newline at end of file
@@ -0,0 +1,62 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/scan.h
+ * @brief provides vectorized scanning for the delimiters of the request head and of JSON strings (AVX2, SSE2 or scalar)
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/**
+ * Find a byte
+ * This function compares 32 bytes at a time with AVX2 when the cpu supports it, 16 bytes at
+ * a time with SSE2 otherwise, and falls back to a byte loop on other architectures and for
+ * the tail shorter than a vector.
+ * 
+ * @param p the first byte to scan
+ * @param end the end of the bytes to scan
+ * @param c the byte to find
+ * @return a pointer to the first occurrence of c
+ * @return NULL if c is not in [p, end)
+*/
+extern char *scan_byte(const char *p, const char *end, char c);
+
+/**
+ * Find the end of a header name
+ * This function skips the characters allowed in a header name (tchar of RFC 9110).
+ * 
+ * @param p the first byte of the name
+ * @param end the end of the line
+ * @return a pointer to the first byte that is not part of the name
+*/
+extern char *scan_token(const char *p, const char *end);
+
+/**
+ * Get the value of a hexadecimal digit
+ * 
+ * @param c the character
+ * @return the value of the digit, -1 if c is not one
+*/
+extern int hex_value(char c);
+
+/**
+ * Find the end of a run of plain JSON string characters
+ * This function skips the ASCII bytes a JSON string holds as they are, a vector at a time
+ * like scan_byte, and stops at a quote, a backslash, a control character or the first byte
+ * of a UTF-8 sequence, which the caller validates.
+ * 
+ * @param p the first byte to scan
+ * @param end the end of the bytes to scan
+ * @return a pointer to the first quote, backslash, byte below 0x20 or byte from 0x80
+ * @return NULL if there is none in [p, end)
+*/
+extern char *scan_json_string(const char *p, const char *end);
+
+#endif // SCAN_H
\ No newline at end of file
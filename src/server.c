@@ -11,10 +11,14 @@
 
 #include "server.h"
 #include "http_data.h"
-#include "process_request.h"
-#include "process_response.h"
 #include "route.h"
 #include "client.h"
+#include "buffer_pool.h"
+#include "file_cache.h"
+#include "connection.h"
+#include "reactor.h"
+#include "uring.h"
+#include "thread_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,383 +28,306 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
-
-#define BUFFER_SIZE 2000
-#define MAX_SIZE 1048576
-
-enum
-{
-    STATE_FIRST_LINE = 0,
-    STATE_HEADERS = 1,
-    STATE_BODY = 2,
-    STATE_ELABORATE_RESPONSE = 3,
-    STATE_RESET = 4
-};
+#include <poll.h>
 
 /**
- * Serialize a response_t struct to a string
- *  
- * @param res response_t struct
- * @return serialized response or NULL if an error occurred
+ * Wait until a client has data to receive
+ * The blocking connections have no timer wheel, the wait is bounded by the deadline of
+ * the client instead.
+ * 
+ * @param client a pointer to the client_t struct
+ * @return 1 if data can be received, 0 if the connection timed out, -1 if an error occurred
 */
-char *serialize(response_t *res)
+static int wait_client(client_t *client)
 {
-    if (validate_response(res) < 0)
+    struct pollfd pfd = {.fd = client->client_fd, .events = POLLIN};
+    while (1)
     {
-        return NULL;
+        uint64_t now = monotonic_ms();
+        uint64_t deadline = update_deadline(client, now);
+        if (deadline == 0)
+            return 1;
+        if (deadline <= now)
+            return 0;
+        int ready = poll(&pfd, 1, (int)(deadline - now));
+        if (ready >= 0)
+            return ready;
+        if (errno != EINTR)
+        {
+            perror("[-]poll failed");
+            return -1;
+        }
     }
+}
 
-    char *serialized = malloc(MAX_SIZE * sizeof(char));
-    if (serialized == NULL)
+/**
+ * Handle a request
+ * 
+ * @param arg client file descriptor
+ * @return NULL
+*/
+void *handle_request(void *arg)
+{
+    client_t *client = get_client(*(int *)arg);
+    free(arg);
+    if (client == NULL || client->client_fd < 0)
     {
-        perror("[-]malloc failed");
+        perror("[-]Invalid client file descriptor");
         return NULL;
     }
-    serialized[0] = '\0';
+    client->thread_id = pthread_self();
+    block_sigpipe();
 
-    char *status_message;
-    if ((status_message = get_status_message(res)) == "Unknown")
+    ssize_t received;
+    while (wait_client(client) > 0 && ((received = receive_client(client)) > 0 || (received < 0 && errno == EINTR)))
     {
-        perror("[-]Invalid status code");
-        return NULL;
+        if (received < 0)
+            continue;
+        if (process_client(client) < 0 || flush_client(client) < 0 || is_drained(client))
+            break;
     }
+    remove_client(client->client_fd); //remove client from clients list and close the connection with the client
+    printf("[+]Client disconnected\n");
+    return NULL;
+}
 
-    sprintf(serialized, "HTTP/%s %s %s\r\n", res->version, res->status_code, status_message);
-    char *headers = headers_to_string(res);
-    strcat(serialized, headers);
-    strcat(serialized, "\r\n");
+void *run_server(void *arg)
+{
+    server_t *server = (server_t *)arg;
+    block_sigpipe(); //inherited by the threads of the clients
+    init_clients(); //set clients list to NULL
+    while (1)
+    {
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        pthread_t thread_id;
 
-    if (res->body != NULL)
-        strcat(serialized, res->body);
+        int fd = accept(server->server_fd, (struct sockaddr *)&client_addr, &client_addr_len);
+        if (fd < 0)
+        {
+            if (errno == EBADF || errno == EINVAL)
+                return NULL; //listening socket closed by stop_daemon
+            perror("[-]accept failed");
+            continue;
+        }
 
-    free(headers);
-    return serialized;
-}
+        client_t *client = create_client(fd); //malloc request and response
+        if (client == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        client->max_request = server->max_request_size;
+        client->max_requests = server->max_keep_alive_requests;
+        client->arena_keep = server->arena_keep_size;
+        client->timeouts.idle = server->idle_timeout;
+        client->timeouts.header = server->header_timeout;
+        client->timeouts.body = server->body_timeout;
+        int *client_fd = malloc(sizeof(int));
+        if (client_fd == NULL)
+        {
+            perror("[-]malloc failed");
+            destroy_client(client);
+            continue;
+        }
+        *client_fd = fd;
+        add_client(client);
 
-/**
- * Send a response to a client
- * 
- * @param client_fd client file descriptor
- * @param res response_t struct
- * @return 0 if the response was sent successfully, -1 otherwise
-*/
-int send_response(client_t *client)
-{
-    char *response = serialize(client->res);
-    if (response == NULL)
-        return -1;
+        if (pthread_create(&thread_id, NULL, handle_request, (void *)client_fd) != 0)
+        {
+            //out of threads: turn this client away and keep serving the others
+            perror("[-]pthread_create failed");
+            free(client_fd);
+            send_error(client, 503, "Service Unavailable");
+            flush_client(client);
+            remove_client(fd);
+            continue;
+        }
 
-    if (send(client->client_fd, response, strlen(response), 0) < 0)
-    {
-        perror("[-]send failed");
-        return -1;
+        if (pthread_detach(thread_id) != 0)
+            perror("[-]pthread_detach failed");
     }
-    free(response);
-    return 0;
+    return NULL;
 }
 
 /**
- * Send an error response to a client
+ * Initialize a server_config_t struct
+ * This function sets the default values: port 8080, 10 pending connections, any address
+ * and one thread per connection (one unpinned reactor running the callbacks itself in epoll mode).
+ * Connections are kept alive for 1000 requests and closed after 5 s without a request,
+ * 10 s to send a head or 30 s without progress on a body.
  * 
- * @param client_fd client file descriptor
- * @param status_code status code
- * @param message error message
- * @return 0 if the error response was sent successfully, -1 otherwise
+ * @param config a pointer to the server_config_t struct
 */
-int send_error(client_t *client, char *status_code, char *message)
+void init_server_config(server_config_t *config)
 {
-    response_t *res = init_response();
-    free_response(client->res);
-    client->res = res;
-    add_status_code_res(res, status_code);
-    add_body_res(res, message);
-    add_header(&(res->headers), "Content-Type", "text/plain");
-    send_response(client);
-    return 0;
+    config->port = 8080;
+    config->max_connections = 10;
+    config->ip = NULL;
+    config->mode = SERVER_MODE_THREADS;
+    config->reactors = 1;
+    config->pin_cpus = 0;
+    config->workers = 0;
+    config->queue_depth = 1024;
+    config->max_request_size = MAX_SIZE;
+    config->file_cache_size = FILE_CACHE_SIZE;
+    config->idle_timeout = IDLE_TIMEOUT;
+    config->header_timeout = HEADER_TIMEOUT;
+    config->body_timeout = BODY_TIMEOUT;
+    config->max_keep_alive_requests = MAX_KEEP_ALIVE_REQUESTS;
+    config->arena_keep_size = ARENA_KEEP_SIZE;
 }
 
-/**
- * Parse the first line of a request
- * 
- * @param req request_t struct
- * @param line first line of the request
- * @return 0 if the first line was parsed successfully, -1 otherwise
-*/
-int handle_line(client_t *client, char *request)
+server_t *start_daemon(int port, int max_connections, const char *ip)
 {
-    char *end_of_line = strstr(request, "\r\n");
-    char *line = strndup(request, end_of_line - request + 2);
-    if (line == NULL)
-    {
-        perror("[-]strndup failed");
-        send_error(client, "500", "Internal Server Error");
-        return -1;
-    }
-    else
-    {
-        if (parse_first_line(client->req, line) < 0)
-        {
-            send_error(client, "400", "Bad Request");
-            free(line);
-            return -1;
-        }
-        memmove(request, end_of_line + 2, strlen(end_of_line + 2) + 1);
-        free(line);
-    }
-    return 0;
+    server_config_t config;
+    init_server_config(&config);
+    config.port = port;
+    config.max_connections = max_connections;
+    config.ip = ip;
+    return start_daemon_config(&config);
 }
 
 /**
- * Parse the headers of a request
+ * Create a listening socket bound to the address of the server
  * 
- * @param req request_t struct
- * @param headers headers of the request
- * @return 0 if the headers were parsed successfully, -1 otherwise
+ * @param server a pointer to the server_t struct
+ * @param reuse_port set SO_REUSEPORT so that several sockets can share the port
+ * @return the socket file descriptor or -1 if an error occurred
 */
-int handle_headers(client_t *client, char *request)
+static int create_listener(server_t *server, int reuse_port)
 {
-    char *end_of_headers = strstr(request, "\r\n\r\n");
-    char *headers = strndup(request, end_of_headers - request + 4);
-    if (headers == NULL)
+    int server_fd;
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
-        perror("[-]strndup failed");
-        send_error(client, "500", "Internal Server Error");
+        perror("[-]socket failed");
         return -1;
     }
-    if (parse_headers(client->req, headers) < 0)
+
+    int opt = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
     {
-        send_error(client, "400", "Bad Request");
-        free(headers);
+        perror("[-]setsockopt failed");
+        close(server_fd);
         return -1;
     }
-    free(headers);
-    return 0;
-}
 
-/**
- * Parse the body of a request
- * 
- * @param req request_t struct
- * @param request request string
- * @return 0 if the body was parsed successfully, -1 otherwise
-*/
-int handle_body(client_t *client, char *request)
-{
-    size_t content_length = strtoul(get_header(client->req->headers, "Content-Length"), NULL, 10);
-    if (content_length < 0)
+    if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
-        send_error(client, "400", "Bad Request");
+        perror("[-]setsockopt SO_REUSEPORT failed");
+        close(server_fd);
         return -1;
     }
-    if (content_length > MAX_SIZE)
+
+    if (bind(server_fd, (struct sockaddr *)&server->server_addr, sizeof(server->server_addr)) < 0)
     {
-        send_error(client, "413", "Request Entity Too Large");
+        perror("[-]bind failed");
+        close(server_fd);
         return -1;
     }
-    if (parse_body(client->req, request, content_length) < 0)
+
+    if (listen(server_fd, server->max_connections) < 0)
     {
-        send_error(client, "400", "Bad Request");
+        perror("[-]listen failed");
+        close(server_fd);
         return -1;
     }
-    return 0;
+    return server_fd;
 }
 
 /**
- * Handle a response
+ * Stop the reactors of a server and close their listening sockets
  * 
- * @param client_fd client file descriptor
- * @param req request_t struct
- * @param res response_t struct
- * @return 0 if the response was handled successfully, -1 otherwise
+ * @param server a pointer to the server_t struct
 */
-int handle_response(client_t *client)
+static void stop_reactors(server_t *server)
 {
-    char *path = client->req->path;
-    char *method = client->req->method;
-    callback cb = get_route(method, path);
-    if (cb == NULL)
+    for (int i = 0; i < server->n_reactors; i++)
     {
-        if (strcmp(method, "GET") == 0)
-        {
-            
-        }
-        send_error(client, "404", "Not Found");
-        return -1;
+        if (server->reactors[i] == NULL)
+            continue;
+        int listen_fd = server->reactors[i]->listen_fd;
+        stop_reactor(server->reactors[i]);
+        if (listen_fd != server->server_fd)
+            close(listen_fd);
     }
-    cb(client->req, client->res);
-    return 0;
+    free(server->reactors);
+    server->reactors = NULL;
+    server->n_reactors = 0;
 }
 
 /**
- * Handle a request
+ * Start the reactors of a server
+ * Every reactor gets its own SO_REUSEPORT listening socket, so the kernel spreads the
+ * incoming connections and the reactors share neither an accept queue nor a client list.
+ * If io_uring fails on any reactor, they all run on epoll instead and server->mode says so.
  * 
- * @param arg client file descriptor
- * @return NULL
+ * @param server a pointer to the server_t struct, server_fd is used by the first reactor
+ * @param config a pointer to the server_config_t struct
+ * @return 0 if all the reactors were started, -1 otherwise
 */
-void *handle_request(void *arg)
+static int start_reactors(server_t *server, const server_config_t *config)
 {
-    client_t *client = get_client(*(int *)arg);
-    free(arg);
-    if (client->client_fd < 0)
-    {
-        perror("[-]Invalid client file descriptor");
-        return NULL;
-    }
-
-    int state = STATE_FIRST_LINE;
-    size_t received, total_received = 0;
-    char *buffer = malloc(BUFFER_SIZE * sizeof(char) + 1);
-    char *request = malloc(MAX_SIZE * sizeof(char) + 1);
-    if (buffer == NULL || request == NULL)
+    int n_reactors = config->reactors > 0 ? config->reactors : 1;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    server->reactors = (struct reactor_t **)calloc(n_reactors, sizeof(struct reactor_t *));
+    if (server->reactors == NULL)
     {
         perror("[-]malloc failed");
-        send_error(client, "500", "Internal Server Error");
+        return -1;
     }
-    else
+    server->n_reactors = n_reactors;
+
+    for (int i = 0; i < n_reactors; i++)
     {
-        request[0] = '\0';
-        while ((received = recv(client->client_fd, buffer, BUFFER_SIZE, 0)) > 0)
+        int listen_fd = i == 0 ? server->server_fd : create_listener(server, 1);
+        if (listen_fd < 0)
+            return -1;
+        if (server->mode == SERVER_MODE_IO_URING && (server->reactors[i] = create_uring_reactor(listen_fd)) == NULL)
         {
-            buffer[received] = '\0';
-            if ((total_received += received) > MAX_SIZE)
-            {
-                send_error(client, "413", "Request Entity Too Large");
-                state = STATE_RESET;
-            }
-            else
-            {
-                memcpy(request + strlen(request), buffer, received);
-                request[strlen(request)] = '\0';
-            }
-            if (state == STATE_FIRST_LINE)
-            {
-                if (strstr(request, "\r\n") != NULL)
-                {
-                    if (handle_line(client, request) < 0)
-                        state = STATE_RESET;
-                    else
-                        state = STATE_HEADERS;
-                }
-            }
-            if (state == STATE_HEADERS)
-            {
-                char * end_of_headers = strstr(request, "\r\n\r\n");
-                if (end_of_headers != NULL)
-                {
-                    if (handle_headers(client, request) < 0)
-                        state = STATE_RESET;
-                    else
-                    {
-                        if (get_header(client->req->headers, "Content-Length") != NULL)
-                            state = STATE_BODY;
-                        else
-                            state = STATE_ELABORATE_RESPONSE;
-                    }
-                    //remove headers from request
-                    memmove(request, end_of_headers + 4, strlen(end_of_headers + 4) + 1); 
-                    total_received -= strlen(end_of_headers) + 4;
-                }
-            }
-            if (state == STATE_BODY)
+            printf("[-]io_uring unavailable, falling back to epoll\n");
+            server->mode = SERVER_MODE_EPOLL;
+            if (i > 0)
             {
-                size_t content_length = strtoul(get_header(client->req->headers, "Content-Length"), NULL, 10);
-                size_t request_length = strlen(request);
-                if (request_length == content_length)
-                {
-                    if (handle_body(client, request) < 0)
-                        state = STATE_RESET;
-                    else
-                        state = STATE_ELABORATE_RESPONSE;
-                }
-                else if (request_length > content_length)
-                {
-                    send_error(client, "400", "Bad Request");
-                    state = STATE_RESET;
-                }
+                //all the reactors run the same backend: the io_uring ones start over on epoll
+                if (listen_fd != server->server_fd)
+                    close(listen_fd);
+                stop_reactors(server);
+                return start_reactors(server, config);
             }
-            if (state == STATE_ELABORATE_RESPONSE)
-            {
-                if (handle_response(client) < 0)
-                    perror("[-]Error handling response");
-                else
-                    send_response(client);
-                state = STATE_RESET;
-            }
-            if (state == STATE_RESET)
-            {
-                free_request(client->req);
-                free_response(client->res);
-                client->req = init_request();
-                client->res = init_response();
-                request[0] = '\0';
-                state = STATE_FIRST_LINE;
-            }
-        }
-    }
-    free(request);
-    free(buffer);
-    remove_client(client->client_fd); //remove client from clients list and close the connection with the client
-    printf("[+]Client disconnected\n");
-    return NULL;
-}
-
-void *run_server(void *arg)
-{
-    server_t *server = (server_t *)arg;
-    init_clients(); //set clients list to NULL
-    while (1)
-    {
-        struct sockaddr_in client_addr;
-        int *client_fd = malloc(sizeof(int));
-        socklen_t client_addr_len = sizeof(client_addr);
-        pthread_t thread_id;
-
-        client_t *client = (client_t *)malloc(sizeof(client_t));
-        if (client == NULL)
-        {
-            perror("[-]malloc failed");
-            free(client_fd);
-            return NULL;
-        }
-
-        if ((*client_fd = accept(server->server_fd, (struct sockaddr *)&client_addr, &client_addr_len)) < 0)
-        {
-            perror("[-]accept failed");
-            free(client_fd);
-            free(client);
-            return NULL;
-        }
-
-        client->client_fd = *client_fd;
-        client->req = init_request(); //malloc request and set all fields to NULL
-        client->res = init_response(); //malloc response and set all fields to NULL
-        client->thread_id = thread_id;
-        client->next = NULL;
-
-        if (add_client(client) < 0 || client->req == NULL || client->res == NULL)
-        {
-            free(client_fd);
-            free(client);
-            return NULL;
         }
-
-        if (pthread_create(&thread_id, NULL, handle_request, (void *)client_fd) < 0)
-        {
-            perror("[-]pthread_create failed");
-            return NULL;
-        }
-
-        if (pthread_detach(thread_id) < 0)
+        if (server->reactors[i] == NULL && (server->reactors[i] = create_reactor(listen_fd)) == NULL)
         {
-            perror("[-]pthread_detach failed");
-            return NULL;
+            if (listen_fd != server->server_fd)
+                close(listen_fd);
+            return -1;
         }
+        if (config->pin_cpus && n_cpus > 0)
+            server->reactors[i]->cpu = i % n_cpus;
+        server->reactors[i]->pool = server->pool;
+        server->reactors[i]->max_request = server->max_request_size;
+        server->reactors[i]->max_requests = server->max_keep_alive_requests;
+        server->reactors[i]->arena_keep = server->arena_keep_size;
+        server->reactors[i]->timeouts.idle = server->idle_timeout;
+        server->reactors[i]->timeouts.header = server->header_timeout;
+        server->reactors[i]->timeouts.body = server->body_timeout;
+        if (start_reactor(server->reactors[i]) < 0)
+            return -1;
     }
-    return NULL;
+    server->thread_id = server->reactors[0]->thread_id;
+    return 0;
 }
 
-server_t *start_daemon(int port, int max_connections, const char *ip)
+/**
+ * Start the server with a configuration
+ * 
+ * @param config a pointer to the server_config_t struct
+ * @return a pointer to the server_t struct or NULL if an error occurred
+*/
+server_t *start_daemon_config(const server_config_t *config)
 {
+    int port = config->port;
+    const char *ip = config->ip;
     server_t *server = (server_t *)malloc(sizeof(server_t));
     if (server == NULL)
     {
@@ -409,46 +336,54 @@ server_t *start_daemon(int port, int max_connections, const char *ip)
     }
     
     server->port = port;
-    server->max_connections = max_connections;
-
-    if ((server->server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
-    {
-        perror("[-]socket failed");
-        free(server);
-        return NULL;
-    }
-
-    int opt = 1;
-    if (setsockopt(server->server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-    {
-        perror("[-]setsockopt failed");
-        close(server->server_fd);
-        free(server);
-        return NULL;
-    }
+    server->max_connections = config->max_connections;
+    server->mode = config->mode;
+    server->reactors = NULL;
+    server->n_reactors = 0;
+    server->pool = NULL;
+    server->max_request_size = config->max_request_size;
+    server->idle_timeout = config->idle_timeout;
+    server->header_timeout = config->header_timeout;
+    server->body_timeout = config->body_timeout;
+    server->max_keep_alive_requests = config->max_keep_alive_requests;
+    server->arena_keep_size = config->arena_keep_size;
+
+    //connections only read the routes from now on, a failure keeps the radix tree alone
+    freeze_routes();
 
     server->server_addr.sin_family = AF_INET;
     server->server_addr.sin_addr.s_addr = ip == NULL ? INADDR_ANY : inet_addr(ip);
     server->server_addr.sin_port = htons(port);
 
-    if (bind(server->server_fd, (struct sockaddr *)&server->server_addr, sizeof(server->server_addr)) < 0)
+    int reuse_port = server->mode != SERVER_MODE_THREADS && config->reactors > 1;
+    if ((server->server_fd = create_listener(server, reuse_port)) < 0)
     {
-        perror("[-]bind failed");
-        close(server->server_fd);
         free(server);
         return NULL;
     }
 
-    if (listen(server->server_fd, max_connections) < 0)
+    printf("[+]Server started at port %d\n", port);
+    init_file_cache(config->file_cache_size);
+
+    if (server->mode != SERVER_MODE_THREADS)
     {
-        perror("[-]listen failed");
-        close(server->server_fd);
-        free(server);
-        return NULL;
+        if (config->workers > 0 && (server->pool = create_thread_pool(config->workers, config->queue_depth)) == NULL)
+        {
+            close(server->server_fd);
+            free(server);
+            return NULL;
+        }
+        if (start_reactors(server, config) < 0)
+        {
+            stop_reactors(server);
+            destroy_thread_pool(server->pool);
+            close(server->server_fd);
+            free(server);
+            return NULL;
+        }
+        return server;
     }
 
-    printf("[+]Server started at port %d\n", port);
-
     // Create a daemon thread
     pthread_t thread_id;
     if (pthread_create(&thread_id, NULL, run_server, (void *)server) < 0)
@@ -472,9 +407,22 @@ server_t *start_daemon(int port, int max_connections, const char *ip)
 
 void stop_daemon(server_t *server)
 {
+    if (server->mode != SERVER_MODE_THREADS)
+    {
+        stop_reactors(server);
+        destroy_thread_pool(server->pool);
+        close(server->server_fd);
+        free(server);
+        free_buffer_pool();
+        free_file_cache();
+        printf("[+]Server stopped\n");
+        return;
+    }
     free_clients();
     close(server->server_fd);
     pthread_cancel(server->thread_id);
     free(server);
+    free_buffer_pool();
+    free_file_cache();
     printf("[+]Server stopped\n");
 }
\ No newline at end of file
@@ -17,14 +17,69 @@
 #include "route.h"
 #include "http_data.h"
 
+typedef enum
+{
+    SERVER_MODE_THREADS = 0,    // one blocking thread per connection
+    SERVER_MODE_EPOLL = 1,      // edge-triggered epoll event loop with non-blocking connections
+    SERVER_MODE_IO_URING = 2    // io_uring event loop, falls back to epoll when unavailable
+} server_mode_t;
+
+typedef struct
+{
+    int port;
+    int max_connections;
+    const char *ip;
+    server_mode_t mode;
+    int reactors;               // epoll/io_uring mode: number of event loops, each with its own SO_REUSEPORT socket
+    int pin_cpus;               // epoll/io_uring mode: pin reactor i to cpu i modulo the online cpus
+    int workers;                // epoll/io_uring mode: threads running the route callbacks, 0 to run them in the reactors
+    size_t queue_depth;         // epoll/io_uring mode: callbacks queued per worker before answering 503
+    size_t max_request_size;    // limit of the head plus the body of a request, larger ones get 413/431
+    size_t file_cache_size;     // bytes of static files kept in memory by add_file_body, 0 to disable the cache
+    unsigned idle_timeout;      // milliseconds a kept-alive connection may wait for its next request, 0 for no limit
+    unsigned header_timeout;    // milliseconds a request may take to send its head, 0 for no limit
+    unsigned body_timeout;      // milliseconds a request may pause while sending its body, 0 for no limit
+    size_t max_keep_alive_requests; // requests served on a connection before closing it, 0 for no limit
+    size_t arena_keep_size;     // largest arena chunk a connection keeps while idle, larger ones are freed
+} server_config_t;
+
 typedef struct{
     int server_fd;
     int port;
     int max_connections;
+    server_mode_t mode;
     struct sockaddr_in server_addr;
     pthread_t thread_id;
+    struct reactor_t **reactors;
+    int n_reactors;
+    struct thread_pool_t *pool;
+    size_t max_request_size;
+    unsigned idle_timeout;
+    unsigned header_timeout;
+    unsigned body_timeout;
+    size_t max_keep_alive_requests;
+    size_t arena_keep_size;
 } server_t;
 
+/**
+ * Initialize a server_config_t struct
+ * This function sets the default values: port 8080, 10 pending connections, any address
+ * and one thread per connection (one unpinned reactor running the callbacks itself in epoll mode).
+ * Connections are kept alive for 1000 requests and closed after 5 s without a request,
+ * 10 s to send a head or 30 s without progress on a body.
+ * 
+ * @param config a pointer to the server_config_t struct
+*/
+extern void init_server_config(server_config_t *config);
+
+/**
+ * Start the server with a configuration
+ * 
+ * @param config a pointer to the server_config_t struct
+ * @return a pointer to the server_t struct or NULL if an error occurred
+*/
+extern server_t * start_daemon_config(const server_config_t *config);
+
 extern server_t * start_daemon(int port, int max_connections, const char *ip);
 extern void stop_daemon(server_t * server);
 
@@ -0,0 +1,176 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/stream.c
+ * @brief implementation of stream.h
+*/
+
+#include "stream.h"
+#include "buffer_pool.h"
+#include "client.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Create a stream
+ * The stream is allocated with malloc, it outlives the arena of the response it belongs to.
+ * 
+ * @param cb the callback producing the body, NULL if the route callback writes all of it
+ * @param arg the argument passed to cb
+ * @param free_arg releases arg once the stream is done or dropped, NULL if nothing is to be released
+ * @return the stream or NULL if an error occurred, arg is released then
+*/
+stream_t *create_stream(stream_callback cb, void *arg, void (*free_arg)(void *arg))
+{
+    stream_t *stream = (stream_t *)malloc(sizeof(stream_t));
+    if (stream == NULL)
+    {
+        perror("[-]malloc failed");
+        if (free_arg != NULL)
+            free_arg(arg);
+        return NULL;
+    }
+    stream->cb = cb;
+    stream->arg = arg;
+    stream->free_arg = free_arg;
+    stream->chunks = NULL;
+    stream->tail = NULL;
+    stream->ended = 0;
+    stream->raw = 0;
+    stream->failed = 0;
+    return stream;
+}
+
+/**
+ * Make room at the end of the written chunks
+ * 
+ * @param stream the stream
+ * @param len the number of bytes to append
+ * @return where to write them or NULL if an error occurred
+*/
+static char *reserve(stream_t *stream, size_t len)
+{
+    out_segment_t *tail = stream->tail;
+    if (tail == NULL || tail->size - tail->len < len)
+    {
+        size_t size;
+        char *buffer = get_buffer(len, &size);
+        if (buffer == NULL)
+            return NULL;
+        if ((tail = create_segment(buffer, 0, size)) == NULL)
+        {
+            put_buffer(buffer, size);
+            return NULL;
+        }
+        if (stream->tail == NULL)
+            stream->chunks = tail;
+        else
+            stream->tail->next = tail;
+        stream->tail = tail;
+    }
+    char *p = tail->data + tail->len;
+    tail->len += len;
+    return p;
+}
+
+/**
+ * Write a chunk of a streamed body
+ * The data is copied, small chunks written in a row share a buffer from the pool and go
+ * out in one send. Writing nothing does nothing, the end of the body is sent by end_stream.
+ * 
+ * @param stream the stream
+ * @param data the data of the chunk, it may contain NUL bytes
+ * @param len the length of the data
+ * @return 0 if the chunk was written, -1 if the stream has ended or an error occurred
+*/
+int write_chunk(stream_t *stream, const void *data, size_t len)
+{
+    if (stream->ended || stream->failed)
+        return -1;
+    if (len == 0)
+        return 0; //an empty chunk would end the body
+    char size[20];
+    int size_len = stream->raw ? 0 : snprintf(size, sizeof(size), "%zx\r\n", len);
+    char *p = reserve(stream, size_len + len + (stream->raw ? 0 : 2));
+    if (p == NULL)
+    {
+        stream->failed = 1;
+        return -1;
+    }
+    memcpy(p, size, size_len);
+    memcpy(p + size_len, data, len);
+    if (!stream->raw)
+        memcpy(p + size_len + len, "\r\n", 2);
+    return 0;
+}
+
+/**
+ * End a streamed body
+ * The chunks written before are sent, then the last empty chunk, and the callback is not
+ * called anymore.
+ * 
+ * @param stream the stream
+*/
+void end_stream(stream_t *stream)
+{
+    stream->ended = 1;
+}
+
+/**
+ * Take the output of a stream
+ * When nothing is written yet the callback of the stream is called first. Once the stream
+ * has ended the chunks are followed by the end of the body.
+ * 
+ * @param stream the stream
+ * @param ended set to 1 if the stream has ended, nothing more is to be taken
+ * @return the output segments, NULL if there are none or the stream failed
+*/
+out_segment_t *pull_stream(stream_t *stream, int *ended)
+{
+    *ended = 0;
+    if (!stream->ended && !stream->failed && stream->chunks == NULL)
+    {
+        if (stream->cb == NULL)
+            stream->ended = 1; //the route callback wrote the whole body
+        else if (stream->cb(stream, stream->arg) < 0 || (stream->chunks == NULL && !stream->ended))
+            stream->failed = 1;
+    }
+    if (stream->failed)
+        return NULL;
+    if (stream->ended && !stream->raw)
+    {
+        char *p = reserve(stream, 5);
+        if (p == NULL)
+        {
+            stream->failed = 1;
+            return NULL;
+        }
+        memcpy(p, "0\r\n\r\n", 5);
+    }
+    out_segment_t *chunks = stream->chunks;
+    stream->chunks = NULL;
+    stream->tail = NULL;
+    *ended = stream->ended;
+    return chunks;
+}
+
+/**
+ * Free a stream
+ * The chunks not taken are dropped and the argument of the stream is released.
+ * 
+ * @param stream the stream, NULL is ignored
+*/
+void free_stream(stream_t *stream)
+{
+    if (stream == NULL)
+        return;
+    free_output(stream->chunks);
+    if (stream->free_arg != NULL)
+        stream->free_arg(stream->arg);
+    free(stream);
+}
\ No newline at end of file
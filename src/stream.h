@@ -0,0 +1,60 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/stream.h
+ * @brief provides the streams behind streamed response bodies, see begin_stream_res
+*/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "http_data.h"
+#include <stddef.h>
+
+struct stream_t
+{
+    stream_callback cb;         // NULL if every chunk is written by the route callback
+    void *arg;
+    void (*free_arg)(void *arg);
+    struct out_segment_t *chunks;   // written and not sent yet
+    struct out_segment_t *tail;
+    int ended;
+    int raw;                    // no chunk framing for an HTTP/1.0 peer, the body ends with the connection
+    int failed;
+};
+
+/**
+ * Create a stream
+ * The stream is allocated with malloc, it outlives the arena of the response it belongs to.
+ * 
+ * @param cb the callback producing the body, NULL if the route callback writes all of it
+ * @param arg the argument passed to cb
+ * @param free_arg releases arg once the stream is done or dropped, NULL if nothing is to be released
+ * @return the stream or NULL if an error occurred, arg is released then
+*/
+extern stream_t *create_stream(stream_callback cb, void *arg, void (*free_arg)(void *arg));
+
+/**
+ * Take the output of a stream
+ * When nothing is written yet the callback of the stream is called first. Once the stream
+ * has ended the chunks are followed by the end of the body.
+ * 
+ * @param stream the stream
+ * @param ended set to 1 if the stream has ended, nothing more is to be taken
+ * @return the output segments, NULL if there are none or the stream failed
+*/
+extern struct out_segment_t *pull_stream(stream_t *stream, int *ended);
+
+/**
+ * Free a stream
+ * The chunks not taken are dropped and the argument of the stream is released.
+ * 
+ * @param stream the stream, NULL is ignored
+*/
+extern void free_stream(stream_t *stream);
+
+#endif // STREAM_H
\ No newline at end of file
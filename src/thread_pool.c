@@ -0,0 +1,233 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/thread_pool.c
+ * @brief implementation of thread_pool.h
+*/
+
+#include "thread_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Push a task at the bottom of the queue of a worker
+ * 
+ * @return 0 if the task was queued, -1 if the queue is full
+*/
+static int push_task(worker_t *worker, task_t task)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->bottom - worker->top == worker->capacity)
+    {
+        pthread_mutex_unlock(&worker->lock);
+        return -1;
+    }
+    worker->tasks[worker->bottom % worker->capacity] = task;
+    worker->bottom++;
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
+
+/**
+ * Take the oldest task of the own queue, so that requests are served in arrival order
+ * 
+ * @return 0 if a task was taken, -1 if the queue is empty
+*/
+static int pop_task(worker_t *worker, task_t *task)
+{
+    pthread_mutex_lock(&worker->lock);
+    if (worker->bottom == worker->top)
+    {
+        pthread_mutex_unlock(&worker->lock);
+        return -1;
+    }
+    *task = worker->tasks[worker->top % worker->capacity];
+    worker->top++;
+    pthread_mutex_unlock(&worker->lock);
+    return 0;
+}
+
+/**
+ * Steal the newest task of the queue of another worker
+ * Taking the opposite end keeps thieves away from the tasks the owner takes next.
+ * 
+ * @return 0 if a task was stolen, -1 if the queue is empty
+*/
+static int steal_task(worker_t *victim, task_t *task)
+{
+    if (pthread_mutex_trylock(&victim->lock) != 0)
+        return -1;
+    if (victim->bottom == victim->top)
+    {
+        pthread_mutex_unlock(&victim->lock);
+        return -1;
+    }
+    victim->bottom--;
+    *task = victim->tasks[victim->bottom % victim->capacity];
+    pthread_mutex_unlock(&victim->lock);
+    return 0;
+}
+
+/**
+ * Find a task for a worker, from its own queue first and then from the others
+ * 
+ * @return 0 if a task was found, -1 otherwise
+*/
+static int find_task(worker_t *worker, task_t *task)
+{
+    thread_pool_t *pool = worker->pool;
+    if (pop_task(worker, task) == 0)
+        return 0;
+    int self = (int)(worker - pool->workers);
+    for (int i = 1; i < pool->n_workers; i++)
+    {
+        if (steal_task(&pool->workers[(self + i) % pool->n_workers], task) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+static void *run_worker(void *arg)
+{
+    worker_t *worker = (worker_t *)arg;
+    thread_pool_t *pool = worker->pool;
+    while (1)
+    {
+        task_t task;
+        if (find_task(worker, &task) == 0)
+        {
+            __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+            task.fn(task.arg);
+            continue;
+        }
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0 && pool->running)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        int stop = !pool->running && __atomic_load_n(&pool->queued, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop)
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Create a thread pool
+ * This function starts n_workers threads, each with its own queue of queue_depth tasks.
+ * 
+ * @param n_workers the number of worker threads
+ * @param queue_depth the capacity of the queue of each worker
+ * @return a pointer to the thread_pool_t struct
+ * @return NULL if an error occurred
+*/
+thread_pool_t *create_thread_pool(int n_workers, size_t queue_depth)
+{
+    if (n_workers <= 0 || queue_depth == 0)
+        return NULL;
+    thread_pool_t *pool = (thread_pool_t *)malloc(sizeof(thread_pool_t));
+    if (pool == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    pool->workers = (worker_t *)calloc(n_workers, sizeof(worker_t));
+    if (pool->workers == NULL)
+    {
+        perror("[-]malloc failed");
+        free(pool);
+        return NULL;
+    }
+    pool->n_workers = 0;
+    pool->next = 0;
+    pool->queued = 0;
+    pool->running = 1;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    for (int i = 0; i < n_workers; i++)
+    {
+        worker_t *worker = &pool->workers[i];
+        worker->tasks = (task_t *)malloc(queue_depth * sizeof(task_t));
+        if (worker->tasks == NULL)
+        {
+            perror("[-]malloc failed");
+            destroy_thread_pool(pool);
+            return NULL;
+        }
+        worker->capacity = queue_depth;
+        worker->top = 0;
+        worker->bottom = 0;
+        worker->pool = pool;
+        pthread_mutex_init(&worker->lock, NULL);
+        if (pthread_create(&worker->thread_id, NULL, run_worker, (void *)worker) != 0)
+        {
+            perror("[-]pthread_create failed");
+            pthread_mutex_destroy(&worker->lock);
+            free(worker->tasks);
+            destroy_thread_pool(pool);
+            return NULL;
+        }
+        pool->n_workers++;
+    }
+    return pool;
+}
+
+/**
+ * Submit a task to a thread pool
+ * The task is queued on the next worker in round robin order, or on the first one with
+ * room left. Idle workers steal queued tasks from busy ones.
+ * 
+ * @param pool a pointer to the thread_pool_t struct
+ * @param fn the function to run
+ * @param arg the argument of the function
+ * @return 0 if the task was queued, -1 if all the queues are full
+*/
+int submit_task(thread_pool_t *pool, task_fn fn, void *arg)
+{
+    task_t task = {fn, arg};
+    unsigned first = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    //count the task first so that a worker taking it never sees the counter underflow
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    for (int i = 0; i < pool->n_workers; i++)
+    {
+        if (push_task(&pool->workers[(first + i) % pool->n_workers], task) == 0)
+        {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_signal(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+            return 0;
+        }
+    }
+    __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_ACQ_REL);
+    return -1;
+}
+
+/**
+ * Destroy a thread pool
+ * This function lets the workers run all the queued tasks, joins them and frees the pool.
+ * 
+ * @param pool a pointer to the thread_pool_t struct
+*/
+void destroy_thread_pool(thread_pool_t *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->running = 0;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_workers; i++)
+    {
+        pthread_join(pool->workers[i].thread_id, NULL);
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        free(pool->workers[i].tasks);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->cond);
+    free(pool->workers);
+    free(pool);
+}
\ No newline at end of file
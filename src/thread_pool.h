@@ -0,0 +1,79 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/thread_pool.h
+ * @brief provides a fixed-size worker pool with per-worker work-stealing queues
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+typedef void (*task_fn)(void *arg);
+
+typedef struct
+{
+    task_fn fn;
+    void *arg;
+} task_t;
+
+typedef struct
+{
+    task_t *tasks;          // bounded ring, the owner takes from top, thieves from bottom
+    size_t capacity;
+    size_t top;
+    size_t bottom;
+    pthread_mutex_t lock;
+    pthread_t thread_id;
+    struct thread_pool_t *pool;
+} worker_t;
+
+typedef struct thread_pool_t
+{
+    worker_t *workers;
+    int n_workers;
+    unsigned next;          // worker receiving the next task
+    size_t queued;          // tasks waiting in all the queues
+    int running;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} thread_pool_t;
+
+/**
+ * Create a thread pool
+ * This function starts n_workers threads, each with its own queue of queue_depth tasks.
+ * 
+ * @param n_workers the number of worker threads
+ * @param queue_depth the capacity of the queue of each worker
+ * @return a pointer to the thread_pool_t struct
+ * @return NULL if an error occurred
+*/
+extern thread_pool_t *create_thread_pool(int n_workers, size_t queue_depth);
+
+/**
+ * Submit a task to a thread pool
+ * The task is queued on the next worker in round robin order, or on the first one with
+ * room left. Idle workers steal queued tasks from busy ones.
+ * 
+ * @param pool a pointer to the thread_pool_t struct
+ * @param fn the function to run
+ * @param arg the argument of the function
+ * @return 0 if the task was queued, -1 if all the queues are full
+*/
+extern int submit_task(thread_pool_t *pool, task_fn fn, void *arg);
+
+/**
+ * Destroy a thread pool
+ * This function lets the workers run all the queued tasks, joins them and frees the pool.
+ * 
+ * @param pool a pointer to the thread_pool_t struct
+*/
+extern void destroy_thread_pool(thread_pool_t *pool);
+
+#endif // THREAD_POOL_H
\ No newline at end of file
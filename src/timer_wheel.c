@@ -0,0 +1,207 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/timer_wheel.c
+ * @brief implementation of timer_wheel.h
+*/
+
+#include "timer_wheel.h"
+#include <string.h>
+#include <time.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/**
+ * Get the time of the monotonic clock
+ * 
+ * @return the time in milliseconds
+*/
+uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Initialize a timer wheel
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds, see monotonic_ms
+*/
+void init_timer_wheel(timer_wheel_t *wheel, uint64_t now)
+{
+    wheel->tick = now / TIMER_WHEEL_TICK;
+    wheel->count = 0;
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+}
+
+/**
+ * Initialize a timer
+ * 
+ * @param timer a pointer to the wheel_timer_t struct
+*/
+void init_timer(wheel_timer_t *timer)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+}
+
+static void unlink_timer(wheel_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/**
+ * Link a timer into the slot of its expiry
+ * The level is chosen by the distance to the expiry, so a timer is moved down at most
+ * once per level before it fires.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param timer a pointer to the wheel_timer_t struct, not linked
+*/
+static void link_timer(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t max = ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    if (expires - wheel->tick > max)
+        expires = wheel->tick + max; //moved down again when it reaches the last level
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && expires - wheel->tick >= (uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+    wheel_timer_t **slot = &wheel->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK];
+    timer->next = *slot;
+    if (*slot != NULL)
+        (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * Schedule a timer
+ * A scheduled timer is moved, so updating the deadline of a connection costs the same as
+ * scheduling it. The deadline is rounded up to the next tick, a deadline already past
+ * fires on the next tick.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param timer a pointer to the wheel_timer_t struct
+ * @param when the time in milliseconds at which the timer fires
+*/
+void schedule_timer(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t when)
+{
+    uint64_t expires = (when + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+    if (expires <= wheel->tick)
+        expires = wheel->tick + 1;
+    if (timer->pprev != NULL)
+    {
+        if (timer->expires == expires)
+            return;
+        unlink_timer(timer);
+    }
+    else
+        wheel->count++;
+    timer->expires = expires;
+    link_timer(wheel, timer);
+}
+
+/**
+ * Cancel a timer
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param timer a pointer to the wheel_timer_t struct, a timer not scheduled is ignored
+*/
+void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+    if (timer->pprev == NULL)
+        return;
+    unlink_timer(timer);
+    wheel->count--;
+}
+
+/**
+ * Move the timers of a slot of a higher level to the levels below
+ * 
+ * @return the index of the slot, 0 when the level below wrapped around too
+*/
+static size_t cascade(timer_wheel_t *wheel, int level)
+{
+    size_t index = (wheel->tick >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    wheel_timer_t *timer = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (timer != NULL)
+    {
+        wheel_timer_t *next = timer->next;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+    return index;
+}
+
+/**
+ * Fire the expired timers
+ * The wheel advances one tick at a time up to now. Every expired timer is unscheduled
+ * before its callback runs, so the callback can schedule it again, cancel other timers or
+ * free the struct the timer belongs to.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds
+ * @param expire the callback run for each expired timer
+ * @param arg the argument passed to the callback
+*/
+void expire_timers(timer_wheel_t *wheel, uint64_t now, void (*expire)(wheel_timer_t *timer, void *arg), void *arg)
+{
+    uint64_t target = now / TIMER_WHEEL_TICK;
+    while (wheel->tick < target)
+    {
+        if (wheel->count == 0)
+        {
+            wheel->tick = target;
+            break;
+        }
+        wheel->tick++;
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++)
+        {
+            if (((wheel->tick >> (TIMER_WHEEL_BITS * (level - 1))) & SLOT_MASK) != 0 || cascade(wheel, level) != 0)
+                break;
+        }
+        //the callback may cancel or schedule timers, so the slot is read again for each one
+        wheel_timer_t **slot = &wheel->slots[0][wheel->tick & SLOT_MASK];
+        while (*slot != NULL)
+        {
+            wheel_timer_t *timer = *slot;
+            unlink_timer(timer);
+            wheel->count--;
+            expire(timer, arg);
+        }
+    }
+}
+
+/**
+ * Get the time left until the wheel has work to do
+ * This is the time to wait for events before calling expire_timers again: the next tick
+ * with a timer to fire or the next tick moving timers down from a higher level.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds
+ * @return the time in milliseconds, -1 if no timer is scheduled
+*/
+int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now)
+{
+    if (wheel->count == 0)
+        return -1;
+    uint64_t tick = wheel->tick + 1;
+    //higher levels only move down when the first level wraps around
+    while ((tick & SLOT_MASK) != 0 && wheel->slots[0][tick & SLOT_MASK] == NULL)
+        tick++;
+    uint64_t when = tick * TIMER_WHEEL_TICK;
+    return when > now ? (int)(when - now) : 0;
+}
\ No newline at end of file
@@ -0,0 +1,104 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/timer_wheel.h
+ * @brief provides a hierarchical timer wheel, scheduling and cancelling a timer cost O(1) however many are pending
+*/
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_TICK 100    // milliseconds per tick
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4    // level l holds the timers due in less than 64^(l + 1) ticks, about 19 days in all
+
+// timer embedded in the struct it belongs to, linked into one slot of the wheel
+typedef struct wheel_timer_t
+{
+    struct wheel_timer_t *next;
+    struct wheel_timer_t **pprev;   // link pointing at the timer, NULL while it is not scheduled
+    uint64_t expires;               // tick at which the timer fires
+} wheel_timer_t;
+
+typedef struct timer_wheel_t
+{
+    uint64_t tick;                  // last tick processed
+    size_t count;                   // timers scheduled
+    wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/**
+ * Get the time of the monotonic clock
+ * 
+ * @return the time in milliseconds
+*/
+extern uint64_t monotonic_ms();
+
+/**
+ * Initialize a timer wheel
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds, see monotonic_ms
+*/
+extern void init_timer_wheel(timer_wheel_t *wheel, uint64_t now);
+
+/**
+ * Initialize a timer
+ * 
+ * @param timer a pointer to the wheel_timer_t struct
+*/
+extern void init_timer(wheel_timer_t *timer);
+
+/**
+ * Schedule a timer
+ * A scheduled timer is moved, so updating the deadline of a connection costs the same as
+ * scheduling it. The deadline is rounded up to the next tick, a deadline already past
+ * fires on the next tick.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param timer a pointer to the wheel_timer_t struct
+ * @param when the time in milliseconds at which the timer fires
+*/
+extern void schedule_timer(timer_wheel_t *wheel, wheel_timer_t *timer, uint64_t when);
+
+/**
+ * Cancel a timer
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param timer a pointer to the wheel_timer_t struct, a timer not scheduled is ignored
+*/
+extern void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+/**
+ * Fire the expired timers
+ * The wheel advances one tick at a time up to now. Every expired timer is unscheduled
+ * before its callback runs, so the callback can schedule it again, cancel other timers or
+ * free the struct the timer belongs to.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds
+ * @param expire the callback run for each expired timer
+ * @param arg the argument passed to the callback
+*/
+extern void expire_timers(timer_wheel_t *wheel, uint64_t now, void (*expire)(wheel_timer_t *timer, void *arg), void *arg);
+
+/**
+ * Get the time left until the wheel has work to do
+ * This is the time to wait for events before calling expire_timers again: the next tick
+ * with a timer to fire or the next tick moving timers down from a higher level.
+ * 
+ * @param wheel a pointer to the timer_wheel_t struct
+ * @param now the current time in milliseconds
+ * @return the time in milliseconds, -1 if no timer is scheduled
+*/
+extern int timer_wheel_timeout(const timer_wheel_t *wheel, uint64_t now);
+
+#endif // TIMER_WHEEL_H
\ No newline at end of file
@@ -0,0 +1,975 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/uring.c
+ * @brief implementation of uring.h
+*/
+
+#define _GNU_SOURCE
+
+#include "uring.h"
+#include "buffer_pool.h"
+#include "connection.h"
+
+#include <stdio.h>
+
+#ifdef USE_IO_URING
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 512       // provided receive buffers, must be a power of 2
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 0
+
+// the operation is stored in the low bits of user_data, the rest is the pointer it refers to
+enum
+{
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_SEND = 3,
+    OP_WAKE = 4,
+    OP_SPLICE_IN = 5,       // file into the pipe of the connection
+    OP_SPLICE_OUT = 6       // pipe of the connection into the socket
+};
+#define OP_MASK 7
+
+typedef struct uring_t
+{
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local_tail;     // tail including the sqes not yet published to the kernel
+    unsigned to_submit;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *buffers;
+    unsigned short buf_tail;
+    int multishot_accept;
+    int multishot_recv;
+    uint64_t wake_value;
+} uring_t;
+
+// per-connection state, stored in client->io_state
+typedef struct
+{
+    out_segment_t *sending;     // output owned by the send in flight
+    struct iovec iov[OUT_IOV_MAX];
+    struct msghdr msg;          // read by the kernel until the send completes
+    int pipe_fds[2];            // carries file bodies to the socket, opened on the first one
+    size_t pipe_size;
+    size_t piped;               // bytes of the file segment in the pipe, not yet sent
+    char *stash;                // received while a worker owns a full receive buffer
+    size_t stash_len;
+    int pending;                // operations in flight referring to the client
+} uring_conn_t;
+
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+
+/**
+ * Publish the queued sqes and optionally wait for completions
+ * 
+ * @param uring a pointer to the uring_t struct
+ * @param wait number of completions to wait for
+ * @param timeout the longest wait in milliseconds, -1 to wait as long as needed
+ * @return 0 on success, -1 otherwise (errno is set, ETIME if the wait timed out)
+*/
+static int submit(uring_t *uring, unsigned wait, int timeout)
+{
+    __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+    if (uring->to_submit == 0 && wait == 0)
+        return 0;
+    unsigned flags = wait > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (wait > 0 && timeout >= 0)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    int submitted = uring_enter(uring->ring_fd, uring->to_submit, wait, flags, (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                                (flags & IORING_ENTER_EXT_ARG) ? sizeof(arg) : 0);
+    if (submitted < 0)
+        return -1;
+    uring->to_submit -= submitted < (int)uring->to_submit ? (unsigned)submitted : uring->to_submit;
+    return 0;
+}
+
+/**
+ * Get a free submission queue entry
+ * The entry is zeroed and published by the next submit.
+ * 
+ * @param uring a pointer to the uring_t struct
+ * @return a pointer to the sqe
+*/
+static struct io_uring_sqe *get_sqe(uring_t *uring)
+{
+    while (uring->sq_local_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries)
+    {
+        if (submit(uring, 0, -1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            perror("[-]io_uring_enter failed");
+    }
+    unsigned index = uring->sq_local_tail & *uring->sq_mask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sq_array[index] = index;
+    uring->sq_local_tail++;
+    uring->to_submit++;
+    return sqe;
+}
+
+/**
+ * Give a receive buffer back to the kernel
+ * 
+ * @param uring a pointer to the uring_t struct
+ * @param bid the buffer id
+*/
+static void provide_buffer(uring_t *uring, unsigned short bid)
+{
+    struct io_uring_buf *buf = &uring->buf_ring->bufs[uring->buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(uring->buffers + (size_t)bid * URING_BUFFER_SIZE);
+    buf->len = URING_BUFFER_SIZE;
+    buf->bid = bid;
+    uring->buf_tail++;
+    __atomic_store_n(&uring->buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void arm_accept(reactor_t *reactor)
+{
+    uring_t *uring = reactor->uring;
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = reactor->listen_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (uring->multishot_accept)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = (uint64_t)(uintptr_t)reactor | OP_ACCEPT;
+}
+
+static void arm_wake(reactor_t *reactor)
+{
+    uring_t *uring = reactor->uring;
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = reactor->wake_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&uring->wake_value;
+    sqe->len = sizeof(uring->wake_value);
+    sqe->user_data = (uint64_t)(uintptr_t)reactor | OP_WAKE;
+}
+
+static void arm_recv(reactor_t *reactor, client_t *client)
+{
+    uring_t *uring = reactor->uring;
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->client_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    if (uring->multishot_recv)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (uint64_t)(uintptr_t)client | OP_RECV;
+    conn->pending++;
+}
+
+/**
+ * Send the next chunk of a file segment
+ * io_uring has no sendfile: the file is spliced into a pipe of the connection and the pipe
+ * into the socket, so the content of the file still never reaches user space.
+ * 
+ * @return 0 if the splice was submitted, -1 if the pipe could not be opened
+*/
+static int submit_splice(reactor_t *reactor, client_t *client, out_segment_t *segment)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (conn->pipe_fds[0] < 0)
+    {
+        if (pipe2(conn->pipe_fds, O_CLOEXEC) < 0)
+        {
+            perror("[-]pipe failed");
+            return -1;
+        }
+        int size = fcntl(conn->pipe_fds[0], F_GETPIPE_SZ);
+        conn->pipe_size = size > 0 ? (size_t)size : 4096;
+    }
+    struct io_uring_sqe *sqe = get_sqe(reactor->uring);
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->off = (uint64_t)-1;
+    if (conn->piped > 0)
+    {
+        sqe->splice_fd_in = conn->pipe_fds[0];
+        sqe->splice_off_in = (uint64_t)-1;
+        sqe->fd = client->client_fd;
+        sqe->len = conn->piped;
+        sqe->user_data = (uint64_t)(uintptr_t)client | OP_SPLICE_OUT;
+    }
+    else
+    {
+        //never more than the pipe holds, the splice would wait for a reader that is not there
+        size_t left = segment->len - segment->sent;
+        sqe->splice_fd_in = segment->fd;
+        sqe->splice_off_in = (uint64_t)(segment->offset + segment->sent);
+        sqe->fd = conn->pipe_fds[1];
+        sqe->len = left < conn->pipe_size ? left : conn->pipe_size;
+        sqe->user_data = (uint64_t)(uintptr_t)client | OP_SPLICE_IN;
+    }
+    conn->pending++;
+    return 0;
+}
+
+/**
+ * Submit the send of the output owned by the send in flight
+ * 
+ * @return 0 if the send was submitted, -1 otherwise
+*/
+static int submit_send(reactor_t *reactor, client_t *client)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (conn->sending->stream != NULL && expand_stream(&conn->sending) < 0)
+        return -1;
+    if (conn->sending->fd >= 0)
+        return submit_splice(reactor, client, conn->sending);
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = gather_output(conn->sending, conn->iov, OUT_IOV_MAX);
+    struct io_uring_sqe *sqe = get_sqe(reactor->uring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->client_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&conn->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    //not linked with IOSQE_IO_LINK: a short send would cancel the linked one, its remainder
+    //is resubmitted from the completion instead, ahead of anything queued since
+    sqe->user_data = (uint64_t)(uintptr_t)client | OP_SEND;
+    conn->pending++;
+    return 0;
+}
+
+/**
+ * Send the queued output of a client
+ * The output segments are handed over to the send in flight, which gathers them with one
+ * sendmsg, so responses produced meanwhile are queued in fresh segments and never move
+ * memory the kernel is reading.
+ * Nothing is submitted while a send is in flight, its completion sends what was queued.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+ * @return 0 on success, -1 if the connection must be closed
+*/
+static int arm_send(reactor_t *reactor, client_t *client)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (client->closing || conn->sending != NULL || client->out == NULL)
+        return 0;
+    conn->sending = client->out;
+    client->out = NULL;
+    client->out_tail = NULL;
+    return submit_send(reactor, client);
+}
+
+/**
+ * Send the queued output of a client and update its timer
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+ * @return 0 if the connection can go on, -1 if it must be closed, also once its last response is sent
+*/
+static int continue_client(reactor_t *reactor, client_t *client)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (arm_send(reactor, client) < 0)
+        return -1;
+    if (client->closing)
+        return 0;
+    if (conn->sending == NULL && is_drained(client))
+        return -1;
+    update_timer(reactor, client);
+    return 0;
+}
+
+static void close_pipe(uring_conn_t *conn)
+{
+    if (conn->pipe_fds[0] >= 0)
+    {
+        close(conn->pipe_fds[0]);
+        close(conn->pipe_fds[1]);
+    }
+}
+
+/**
+ * Close a client once no operation and no worker refer to it anymore
+ * Shutting the socket down completes the pending recv and send.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+*/
+static void release_client(reactor_t *reactor, client_t *client)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (!client->closing)
+    {
+        client->closing = 1;
+        cancel_timer(&reactor->timers, &client->timer);
+        shutdown(client->client_fd, SHUT_RDWR);
+    }
+    if (conn->pending > 0 || client->state == STATE_PROCESSING)
+        return;
+    free_output(conn->sending);
+    close_pipe(conn);
+    free(conn->stash);
+    free(conn);
+    client->io_state = NULL;
+    close_client(reactor, client);
+}
+
+static void handle_accept(reactor_t *reactor, struct io_uring_cqe *cqe)
+{
+    uring_t *uring = reactor->uring;
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        if (cqe->res == -EINVAL && uring->multishot_accept)
+            uring->multishot_accept = 0;
+        arm_accept(reactor);
+    }
+    if (cqe->res < 0)
+    {
+        if (cqe->res != -EINVAL && cqe->res != -EAGAIN && cqe->res != -EINTR && cqe->res != -ECONNABORTED)
+            fprintf(stderr, "[-]accept failed: %s\n", strerror(-cqe->res));
+        return;
+    }
+
+    client_t *client = create_client(cqe->res);
+    if (client == NULL)
+    {
+        close(cqe->res);
+        return;
+    }
+    uring_conn_t *conn = (uring_conn_t *)calloc(1, sizeof(uring_conn_t));
+    if (conn == NULL)
+    {
+        perror("[-]malloc failed");
+        destroy_client(client);
+        return;
+    }
+    conn->pipe_fds[0] = -1;
+    conn->pipe_fds[1] = -1;
+    client->io_state = conn;
+    track_client(reactor, client);
+    update_timer(reactor, client);
+    arm_recv(reactor, client);
+}
+
+/**
+ * Keep received bytes until the worker owning the request is done
+ * The receive buffer does not move while the request points into it, so what does not
+ * fit waits here and is delivered by complete_uring_job.
+ * 
+ * @param client a pointer to the client_t struct
+ * @param data the received bytes
+ * @param len the number of bytes
+ * @return 0 if the bytes were kept, -1 if the connection must be closed
+*/
+static int stash_input(client_t *client, const char *data, size_t len)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    if (conn->stash_len + len > client->max_request)
+        return -1;
+    char *stash = realloc(conn->stash, conn->stash_len + len);
+    if (stash == NULL)
+    {
+        perror("[-]realloc failed");
+        return -1;
+    }
+    memcpy(stash + conn->stash_len, data, len);
+    conn->stash = stash;
+    conn->stash_len += len;
+    return 0;
+}
+
+/**
+ * Append received bytes to a client and run the parse states over them
+ * 
+ * @param client a pointer to the client_t struct
+ * @param data the received bytes
+ * @param len the number of bytes
+ * @return 0 if the connection can go on, -1 if it must be closed
+*/
+static int deliver(client_t *client, const char *data, size_t len)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    while (len > 0)
+    {
+        size_t space = conn->stash_len > 0 ? 0 : reserve_input(client);
+        if (space == 0)
+        {
+            if (client->state == STATE_PROCESSING)
+                return stash_input(client, data, len);
+            return -1;
+        }
+
+        size_t n = len < space ? len : space;
+        memcpy(client->request + client->request_len, data, n);
+        client->request_len += n;
+        client->request[client->request_len] = '\0';
+        data += n;
+        len -= n;
+        if (process_client(client) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void handle_recv(reactor_t *reactor, client_t *client, struct io_uring_cqe *cqe)
+{
+    uring_t *uring = reactor->uring;
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    if (!more)
+        conn->pending--;
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        int result = client->closing ? 0 : deliver(client, uring->buffers + (size_t)bid * URING_BUFFER_SIZE, cqe->res);
+        provide_buffer(uring, bid);
+        if (result < 0 || continue_client(reactor, client) < 0)
+        {
+            release_client(reactor, client);
+            return;
+        }
+    }
+    else if (cqe->res == -EINVAL && uring->multishot_recv)
+        uring->multishot_recv = 0;
+    else if (cqe->res != -ENOBUFS)
+    {
+        release_client(reactor, client); //peer closed the connection or recv failed
+        return;
+    }
+
+    if (client->closing)
+        release_client(reactor, client);
+    else if (!more)
+        arm_recv(reactor, client);
+}
+
+static void handle_send(reactor_t *reactor, client_t *client, struct io_uring_cqe *cqe)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    conn->pending--;
+    if (cqe->res < 0 || client->closing)
+    {
+        release_client(reactor, client);
+        return;
+    }
+    conn->sending = consume_output(conn->sending, cqe->res);
+    //partial write or more segments than one sendmsg gathers
+    int result = conn->sending != NULL ? submit_send(reactor, client) : continue_client(reactor, client);
+    if (result < 0)
+        release_client(reactor, client);
+}
+
+static void handle_splice(reactor_t *reactor, client_t *client, struct io_uring_cqe *cqe, int to_socket)
+{
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    conn->pending--;
+    //0 from the file means it was truncated after its length was announced
+    if (cqe->res <= 0 || client->closing)
+    {
+        release_client(reactor, client);
+        return;
+    }
+    if (!to_socket)
+        conn->piped = cqe->res;
+    else
+    {
+        conn->piped -= cqe->res;
+        conn->sending = consume_output(conn->sending, cqe->res);
+    }
+    int result = conn->sending != NULL ? submit_send(reactor, client) : continue_client(reactor, client);
+    if (result < 0)
+        release_client(reactor, client);
+}
+
+/**
+ * Complete a job finished by a worker for a client of an io_uring reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+ * @param response the response serialized by the worker
+*/
+void complete_uring_job(reactor_t *reactor, client_t *client, out_segment_t *response)
+{
+    if (client->closing)
+    {
+        free_output(response);
+        client->state = STATE_RESET;
+        release_client(reactor, client);
+        return;
+    }
+    uring_conn_t *conn = (uring_conn_t *)client->io_state;
+    char *stash = conn->stash;
+    size_t stash_len = conn->stash_len;
+    conn->stash = NULL;
+    conn->stash_len = 0;
+    int result = complete_response(client, response);
+    if (result == 0 && stash != NULL)
+        result = deliver(client, stash, stash_len);
+    free(stash);
+    if (result < 0 || continue_client(reactor, client) < 0)
+        release_client(reactor, client);
+}
+
+/**
+ * Close a client of the io_uring loop that timed out
+ * 
+ * @param timer the timer of the client
+ * @param arg a pointer to the reactor_t struct
+*/
+static void expire_client(wheel_timer_t *timer, void *arg)
+{
+    client_t *client = (client_t *)((char *)timer - offsetof(client_t, timer));
+    release_client((reactor_t *)arg, client);
+}
+
+/**
+ * Run the event loop of an io_uring reactor
+ * The wait for completions is bounded by the next deadline of the timer wheel.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void run_uring(reactor_t *reactor)
+{
+    uring_t *uring = reactor->uring;
+    arm_accept(reactor);
+    arm_wake(reactor);
+    while (reactor->running)
+    {
+        int timeout = timer_wheel_timeout(&reactor->timers, reactor->now);
+        if (submit(uring, 1, timeout) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+        {
+            perror("[-]io_uring_enter failed");
+            break;
+        }
+        reactor->now = monotonic_ms();
+        unsigned head = *uring->cq_head;
+        unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
+        {
+            struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+            void *ptr = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+            switch (cqe->user_data & OP_MASK)
+            {
+                case OP_ACCEPT:
+                    handle_accept(reactor, cqe);
+                    break;
+                case OP_RECV:
+                    handle_recv(reactor, (client_t *)ptr, cqe);
+                    break;
+                case OP_SEND:
+                    handle_send(reactor, (client_t *)ptr, cqe);
+                    break;
+                case OP_SPLICE_IN:
+                case OP_SPLICE_OUT:
+                    handle_splice(reactor, (client_t *)ptr, cqe, (cqe->user_data & OP_MASK) == OP_SPLICE_OUT);
+                    break;
+                case OP_WAKE:
+                    //stop_reactor cleared running or a worker finished a job
+                    complete_jobs(reactor);
+                    if (reactor->running)
+                        arm_wake(reactor);
+                    break;
+            }
+            head++;
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+        expire_timers(&reactor->timers, reactor->now, expire_client, reactor);
+    }
+}
+
+/**
+ * Cancel the operations in flight and wait for them to complete
+ * Until then the kernel may still write into the receive buffers and read the msghdr and
+ * the iovecs of the connections. The wait is bounded: an operation that does not complete
+ * within a second is left to the teardown of the ring.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+static void cancel_pending(reactor_t *reactor)
+{
+    uring_t *uring = reactor->uring;
+    int pending = 0;
+    for (client_t *client = reactor->clients; client != NULL; client = client->next)
+    {
+        uring_conn_t *conn = (uring_conn_t *)client->io_state;
+        if (conn == NULL || conn->pending == 0)
+            continue;
+        pending += conn->pending;
+        shutdown(client->client_fd, SHUT_RDWR);
+    }
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    sqe->user_data = 0; //no operation, its completion is ignored
+    uint64_t deadline = monotonic_ms() + 1000;
+    while (pending > 0)
+    {
+        uint64_t now = monotonic_ms();
+        if (now >= deadline)
+            break;
+        if (submit(uring, 1, (int)(deadline - now)) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && errno != ETIME)
+            break;
+        unsigned head = *uring->cq_head;
+        unsigned tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+            unsigned op = cqe->user_data & OP_MASK;
+            if (op != OP_RECV && op != OP_SEND && op != OP_SPLICE_IN && op != OP_SPLICE_OUT)
+                continue;
+            if (cqe->flags & IORING_CQE_F_MORE)
+                continue;
+            client_t *client = (client_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+            ((uring_conn_t *)client->io_state)->pending--;
+            pending--;
+        }
+        __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Free the io_uring of a reactor
+ * This function cancels every pending operation and waits for them to complete before the
+ * ring, its receive buffers and the per-connection io_uring state are released. The sockets
+ * of the connections are shut down so that their operations complete on kernels that cannot
+ * cancel them all at once, but they are not closed.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void free_uring(reactor_t *reactor)
+{
+    uring_t *uring = reactor->uring;
+    if (uring == NULL)
+        return;
+    cancel_pending(reactor);
+    close(uring->ring_fd);
+    munmap(uring->sqes, uring->sqes_size);
+    if (uring->cq_ring != uring->sq_ring)
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sq_ring, uring->sq_ring_size);
+    munmap(uring->buf_ring, uring->buf_ring_size);
+    free(uring->buffers);
+    free(uring);
+    reactor->uring = NULL;
+
+    for (client_t *client = reactor->clients; client != NULL; client = client->next)
+    {
+        uring_conn_t *conn = (uring_conn_t *)client->io_state;
+        if (conn != NULL)
+        {
+            free_output(conn->sending);
+            close_pipe(conn);
+            free(conn->stash);
+            free(conn);
+            client->io_state = NULL;
+        }
+    }
+}
+
+/**
+ * Map the rings of an io_uring instance
+ * 
+ * @param uring a pointer to the uring_t struct with ring_fd set
+ * @param params the parameters returned by io_uring_setup
+ * @return 0 on success, -1 otherwise
+*/
+static int map_rings(uring_t *uring, struct io_uring_params *params)
+{
+    uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (uring->cq_ring_size > uring->sq_ring_size)
+            uring->sq_ring_size = uring->cq_ring_size;
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          uring->ring_fd, IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED)
+        return -1;
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+        uring->cq_ring = uring->sq_ring;
+    else
+    {
+        uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              uring->ring_fd, IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED)
+        {
+            munmap(uring->sq_ring, uring->sq_ring_size);
+            return -1;
+        }
+    }
+    uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->ring_fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED)
+    {
+        if (uring->cq_ring != uring->sq_ring)
+            munmap(uring->cq_ring, uring->cq_ring_size);
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        return -1;
+    }
+
+    char *sq = (char *)uring->sq_ring;
+    char *cq = (char *)uring->cq_ring;
+    uring->sq_entries = params->sq_entries;
+    uring->sq_head = (unsigned *)(sq + params->sq_off.head);
+    uring->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+    uring->sq_mask = (unsigned *)(sq + params->sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(sq + params->sq_off.array);
+    uring->sq_local_tail = *uring->sq_tail;
+    uring->cq_head = (unsigned *)(cq + params->cq_off.head);
+    uring->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+    uring->cq_mask = (unsigned *)(cq + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+    return 0;
+}
+
+/**
+ * Register the provided receive buffers of an io_uring instance
+ * 
+ * @param uring a pointer to the uring_t struct with the rings mapped
+ * @return 0 on success, -1 if the kernel does not support buffer rings or an error occurred
+*/
+static int register_buffers(uring_t *uring)
+{
+    uring->buf_ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+    uring->buf_ring = mmap(NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->buf_ring == MAP_FAILED)
+        return -1;
+    uring->buffers = malloc((size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+    if (uring->buffers == NULL)
+    {
+        munmap(uring->buf_ring, uring->buf_ring_size);
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (uring_register(uring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        free(uring->buffers);
+        munmap(uring->buf_ring, uring->buf_ring_size);
+        return -1;
+    }
+    uring->buf_tail = 0;
+    for (unsigned short bid = 0; bid < URING_BUFFERS; bid++)
+        provide_buffer(uring, bid);
+    return 0;
+}
+
+/**
+ * Create an io_uring reactor
+ * This function creates a reactor whose event loop submits accept, recv and send to an
+ * io_uring instead of waiting on epoll.
+ * 
+ * @param listen_fd the listening socket
+ * @return a pointer to the reactor_t struct
+ * @return NULL if the library was built without USE_IO_URING, if the kernel does not
+ *         support the required io_uring features or if an error occurred
+*/
+reactor_t *create_uring_reactor(int listen_fd)
+{
+    uring_t *uring = (uring_t *)calloc(1, sizeof(uring_t));
+    if (uring == NULL)
+    {
+        perror("[-]malloc failed");
+        return NULL;
+    }
+    uring->multishot_accept = 1;
+    uring->multishot_recv = 1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_COOP_TASKRUN;
+    if ((uring->ring_fd = uring_setup(URING_ENTRIES, &params)) < 0 && errno == EINVAL)
+    {
+        memset(&params, 0, sizeof(params));
+        uring->ring_fd = uring_setup(URING_ENTRIES, &params);
+    }
+    if (uring->ring_fd < 0)
+    {
+        perror("[-]io_uring_setup failed");
+        free(uring);
+        return NULL;
+    }
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        //needed to bound the wait by the timeouts of the connections
+        fprintf(stderr, "[-]io_uring_enter has no timeout on this kernel\n");
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+    if (map_rings(uring, &params) < 0)
+    {
+        perror("[-]io_uring mmap failed");
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+    if (register_buffers(uring) < 0)
+    {
+        perror("[-]io_uring buffer ring registration failed");
+        munmap(uring->sqes, uring->sqes_size);
+        if (uring->cq_ring != uring->sq_ring)
+            munmap(uring->cq_ring, uring->cq_ring_size);
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        close(uring->ring_fd);
+        free(uring);
+        return NULL;
+    }
+
+    reactor_t *reactor = (reactor_t *)malloc(sizeof(reactor_t));
+    if (reactor == NULL)
+    {
+        perror("[-]malloc failed");
+        reactor_t tmp = {.uring = uring};
+        free_uring(&tmp);
+        return NULL;
+    }
+    reactor->epoll_fd = -1;
+    reactor->listen_fd = listen_fd;
+    reactor->running = 0;
+    reactor->cpu = -1;
+    reactor->clients = NULL;
+    reactor->uring = uring;
+    reactor->pool = NULL;
+    reactor->done = NULL;
+    reactor->in_flight = 0;
+    reactor->max_request = MAX_SIZE;
+    reactor->max_requests = MAX_KEEP_ALIVE_REQUESTS;
+    reactor->arena_keep = ARENA_KEEP_SIZE;
+    reactor->timeouts.idle = IDLE_TIMEOUT;
+    reactor->timeouts.header = HEADER_TIMEOUT;
+    reactor->timeouts.body = BODY_TIMEOUT;
+    reactor->now = monotonic_ms();
+    init_timer_wheel(&reactor->timers, reactor->now);
+    pthread_mutex_init(&reactor->jobs_lock, NULL);
+    pthread_cond_init(&reactor->jobs_cond, NULL);
+    if ((reactor->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+    {
+        perror("[-]eventfd failed");
+        free_uring(reactor);
+        free(reactor);
+        return NULL;
+    }
+    return reactor;
+}
+
+#else
+
+/**
+ * Create an io_uring reactor
+ * This function creates a reactor whose event loop submits accept, recv and send to an
+ * io_uring instead of waiting on epoll.
+ * 
+ * @param listen_fd the listening socket
+ * @return a pointer to the reactor_t struct
+ * @return NULL if the library was built without USE_IO_URING, if the kernel does not
+ *         support the required io_uring features or if an error occurred
+*/
+reactor_t *create_uring_reactor(int listen_fd)
+{
+    (void)listen_fd;
+    fprintf(stderr, "[-]io_uring backend not built, rebuild with -DCWEBSERVER_IO_URING=ON\n");
+    return NULL;
+}
+
+/**
+ * Run the event loop of an io_uring reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void run_uring(reactor_t *reactor)
+{
+    (void)reactor;
+}
+
+/**
+ * Free the io_uring of a reactor
+ * This function cancels every pending operation and waits for them to complete before the
+ * ring, its receive buffers and the per-connection io_uring state are released. The sockets
+ * of the connections are shut down so that their operations complete on kernels that cannot
+ * cancel them all at once, but they are not closed.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+void free_uring(reactor_t *reactor)
+{
+    (void)reactor;
+}
+
+/**
+ * Complete a job finished by a worker for a client of an io_uring reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+ * @param response the response serialized by the worker
+*/
+void complete_uring_job(reactor_t *reactor, client_t *client, out_segment_t *response)
+{
+    (void)reactor;
+    (void)client;
+    (void)response;
+}
+
+#endif // USE_IO_URING
\ No newline at end of file
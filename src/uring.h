@@ -0,0 +1,56 @@
+/*!
+ * c web server
+ * Copyright (c) 2024 Daniele Ye <daniele.ye03@gmail.com>
+ * MIT Licensed
+*/
+
+/**
+ * @file lib/uring.h
+ * @brief provides an io_uring event loop for reactors (multishot accept, provided-buffer recv, batched send)
+*/
+
+#ifndef URING_H
+#define URING_H
+
+#include "reactor.h"
+
+/**
+ * Create an io_uring reactor
+ * This function creates a reactor whose event loop submits accept, recv and send to an
+ * io_uring instead of waiting on epoll.
+ * 
+ * @param listen_fd the listening socket
+ * @return a pointer to the reactor_t struct
+ * @return NULL if the library was built without USE_IO_URING, if the kernel does not
+ *         support the required io_uring features or if an error occurred
+*/
+extern reactor_t *create_uring_reactor(int listen_fd);
+
+/**
+ * Run the event loop of an io_uring reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+extern void run_uring(reactor_t *reactor);
+
+/**
+ * Complete a job finished by a worker for a client of an io_uring reactor
+ * 
+ * @param reactor a pointer to the reactor_t struct
+ * @param client a pointer to the client_t struct
+ * @param response the response serialized by the worker
+*/
+extern void complete_uring_job(reactor_t *reactor, client_t *client, out_segment_t *response);
+
+/**
+ * Free the io_uring of a reactor
+ * This function cancels every pending operation and waits for them to complete before the
+ * ring, its receive buffers and the per-connection io_uring state are released. The sockets
+ * of the connections are shut down so that their operations complete on kernels that cannot
+ * cancel them all at once, but they are not closed.
+ * 
+ * @param reactor a pointer to the reactor_t struct
+*/
+extern void free_uring(reactor_t *reactor);
+
+#endif // URING_H
\ No newline at end of file